@@ -0,0 +1,14 @@
+/*
+ * contracts.h
+ *
+ * Contracts of mm.c, checked only when built with -DDEBUG
+ */
+#include <assert.h>
+
+#ifdef DEBUG
+#define REQUIRES(COND) assert(COND)
+#define ENSURES(COND) assert(COND)
+#else
+#define REQUIRES(COND) ((void)0)
+#define ENSURES(COND) ((void)0)
+#endif
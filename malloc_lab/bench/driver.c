@@ -0,0 +1,339 @@
+/*
+ * driver.c
+ *
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * Random trace driver of mm.c, for utilization, throughput and
+ * stress tests.
+ *      usage: driver [-n ops] [-c every] [-s slots] [-r seed] [-w dir]
+ * Each workload runs on a new heap as follows:
+ *      1. an op picks a random slot, an empty slot is filled by malloc
+ *         (1/10 by calloc), a full one is realloc'ed (3/10) or freed
+ *      2. a block is filled with a tag byte, and the tag is verified
+ *         before it's realloc'ed or freed, calloc is checked for zeros
+ *      3. util is peak of live payload over heap size, throughput is
+ *         ops per second, without the final frees
+ * Workloads, by size of requests:
+ *      small   - 1 to 64 bytes
+ *      mixed   - 1 to 256 bytes mostly, 1/4 up to 8KB
+ *      large   - 1000 to 101000 bytes, 200 slots, 1/10 of ops
+ *      classes - 10 fixed sizes from 8 to 256 bytes
+ *      spiky   - 1 to 512 bytes, 1/50 of 100KB to 2MB
+ *
+ * @note
+ *      1. same seed gives same trace, whatever placement or build
+ *      2. -c runs mm_checkheap every that many ops, build with -DDEBUG
+ *         so contracts are checked too
+ *      3. -w also writes each workload to dir/<name>.rep in the trace
+ *         format of the handout's mdriver, a block gets a new id
+ *         each time it's malloc'ed, calloc is written as a malloc
+ *      4. placement is picked by MM_FIT of environment, see mm.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "mm.h"
+#include "memlib.h"
+
+#define NO_OF_WORKLOAD 5
+#define LARGE_WORKLOAD 2      /// uses LARGE_SLOTS and 1/10 of ops
+#define LARGE_SLOTS    200
+
+/** a live block of trace */
+typedef struct {
+    char *p;
+    size_t n;
+    unsigned char tag;
+    unsigned int id;          /// id in .rep trace
+} slot_t;
+
+static const char *names[NO_OF_WORKLOAD] =
+    {"small", "mixed", "large", "classes", "spiky"};
+
+static unsigned long long rand_state = 88172645463325252ULL;
+static int check_every = 0;
+
+/**
+ * @brief
+ *      xorshift64, so a trace doesn't depend on libc
+ */
+static unsigned long long next_rand(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+/**
+ * @brief
+ *      size of a new request of a workload
+ */
+static size_t pick_size(int kind) {
+    static const size_t classes[] = {8, 16, 24, 32, 48, 64, 96, 128, 200,
+                                     256};
+
+    switch (kind) {
+        case 0:
+            return 1 + next_rand() % 64;
+        case 1:
+            return (next_rand() % 4) ? 1 + next_rand() % 256
+                                     : 1 + next_rand() % 8192;
+        case 2:
+            return 1000 + next_rand() % 100000;
+        case 3:
+            return classes[next_rand() % 10];
+        default:
+            return (next_rand() % 50 == 0) ? 100000 + next_rand() % 2000000
+                                           : 1 + next_rand() % 512;
+    }
+}
+
+/**
+ * @brief
+ *      check payload of a block still holds its tag
+ * @ret
+ *      0 if OK, -1 otherwise
+ */
+static int verify(slot_t *s, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if ((unsigned char)s->p[i] != s->tag) {
+            printf("payload of %p is corrupted at %zu\n", s->p, i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      exit with a message if heap is inconsistent, when -c is given
+ */
+static void check(int op) {
+    if (check_every && mm_checkheap(0)) {
+        printf("checkheap failed at op %d\n", op);
+        exit(1);
+    }
+}
+
+/**
+ * @brief
+ *      run one workload on a new heap
+ * @param
+ *      kind: index of workload
+ *      nslots/nops: live blocks at most and ops
+ *      rep: ops are written here as .rep body if not NULL
+ *      util/ids: peak util and number of ids are stored here
+ * @ret
+ *      ops per second
+ */
+static double run(int kind, int nslots, int nops, FILE *rep,
+                  double *util, unsigned int *ids) {
+    slot_t *slots = calloc(nslots, sizeof(slot_t));
+    size_t live = 0, peak = 0, n, i;
+    struct timespec start, end;
+    unsigned int next_id = 0;
+    int op, r;
+    slot_t *s;
+    char *q;
+
+    mem_reset_brk();
+    if (mm_init()) {
+        printf("mm_init failed\n");
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (op = 0; op < nops; op++) {
+        s = &slots[next_rand() % nslots];
+        r = next_rand() % 10;
+        if (NULL == s->p) {
+            n = pick_size(kind);
+            s->p = (0 == r) ? mm_calloc(1, n) : mm_malloc(n);
+            if (NULL == s->p || ((uintptr_t)s->p & 7)) {
+                printf("malloc of %zu returns %p\n", n, s->p);
+                exit(1);
+            }
+            for (i = 0; 0 == r && i < n; i++) {
+                if (s->p[i]) {
+                    printf("calloc of %zu isn't zeroed\n", n);
+                    exit(1);
+                }
+            }
+            s->n = n;
+            s->tag = next_rand();
+            s->id = next_id++;
+            memset(s->p, s->tag, n);
+            live += n;
+            if (rep) {
+                fprintf(rep, "a %u %zu\n", s->id, n);
+            }
+        } else if (r < 3) {
+            // grow, shrink, or a size of workload
+            n = (0 == r) ? s->n + 1 + next_rand() % (s->n + 64) :
+                (1 == r) ? 1 + next_rand() % s->n : pick_size(kind);
+            if (verify(s, s->n)) {
+                exit(1);
+            }
+            if (NULL == (q = mm_realloc(s->p, n))) {
+                printf("realloc of %zu returns NULL\n", n);
+                exit(1);
+            }
+            s->p = q;
+            if (verify(s, n < s->n ? n : s->n)) {
+                exit(1);
+            }
+            live = live - s->n + n;
+            s->n = n;
+            memset(s->p, s->tag, n);
+            if (rep) {
+                fprintf(rep, "r %u %zu\n", s->id, n);
+            }
+        } else {
+            if (verify(s, s->n)) {
+                exit(1);
+            }
+            mm_free(s->p);
+            live -= s->n;
+            s->p = NULL;
+            if (rep) {
+                fprintf(rep, "f %u\n", s->id);
+            }
+        }
+        if (live > peak) {
+            peak = live;
+        }
+        if (check_every && 0 == op % check_every) {
+            check(op);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (i = 0; i < (size_t)nslots; i++) {
+        if (slots[i].p) {
+            if (verify(&slots[i], slots[i].n)) {
+                exit(1);
+            }
+            mm_free(slots[i].p);
+            if (rep) {
+                fprintf(rep, "f %u\n", slots[i].id);
+            }
+        }
+    }
+    check(nops);
+
+    *util = (double)peak / mem_heapsize();
+    *ids = next_id;
+    free(slots);
+    return nops / ((end.tv_sec - start.tv_sec) +
+                   (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+/**
+ * @brief
+ *      write a .rep file: header of mdriver, then the ops
+ * @param
+ *      body: ops of run, rewound here
+ */
+static void write_rep(const char *dir, const char *name, FILE *body,
+                      unsigned int ids) {
+    char path[4096], line[64];
+    unsigned int ops = 0;
+    FILE *fp;
+
+    rewind(body);
+    while (fgets(line, sizeof(line), body)) {
+        ops++;
+    }
+    snprintf(path, sizeof(path), "%s/%s.rep", dir, name);
+    if (NULL == (fp = fopen(path, "w"))) {
+        fprintf(stderr, "can't open %s\n", path);
+        exit(1);
+    }
+    // suggested heap size, ids, ops, weight
+    fprintf(fp, "20000000\n%u\n%u\n1\n", ids, ops);
+    rewind(body);
+    while (fgets(line, sizeof(line), body)) {
+        fputs(line, fp);
+    }
+    fclose(fp);
+}
+
+/**
+ * @brief
+ *      print usage
+ */
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-n ops] [-c every] [-s slots] [-r seed] "
+                    "[-w dir]\n", prog);
+    fprintf(stderr, "  -n  ops of a workload, 200000 by default\n");
+    fprintf(stderr, "  -c  mm_checkheap every that many ops\n");
+    fprintf(stderr, "  -s  live blocks at most, 2000 by default\n");
+    fprintf(stderr, "  -r  seed of traces, 0 by default\n");
+    fprintf(stderr, "  -w  write traces to dir/<workload>.rep\n");
+}
+
+int main(int argc, char **argv) {
+    int nops = 200000, nslots = 2000, seed = 0, kind, opt;
+    double util, tput, util_sum = 0, tput_sum = 0;
+    char *dir = NULL;
+    unsigned int ids;
+    FILE *rep = NULL;
+
+    while ((opt = getopt(argc, argv, "n:c:s:r:w:")) != -1) {
+        switch (opt) {
+            case 'n':
+                nops = atoi(optarg);
+                break;
+            case 'c':
+                check_every = atoi(optarg);
+                break;
+            case 's':
+                nslots = atoi(optarg);
+                break;
+            case 'r':
+                seed = atoi(optarg);
+                break;
+            case 'w':
+                dir = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    if (optind != argc || nops <= 0 || nslots <= 0) {
+        usage(argv[0]);
+        exit(1);
+    }
+    rand_state += 0x9E3779B97F4A7C15ULL * seed;
+
+    mem_init();
+    for (kind = 0; kind < NO_OF_WORKLOAD; kind++) {
+        if (dir && NULL == (rep = tmpfile())) {
+            fprintf(stderr, "can't create a temporary file\n");
+            exit(1);
+        }
+        if (LARGE_WORKLOAD == kind) {
+            tput = run(kind, LARGE_SLOTS, nops / 10, rep, &util, &ids);
+        } else {
+            tput = run(kind, nslots, nops, rep, &util, &ids);
+        }
+        printf("%-8s util %5.1f%%  %8.0f Kops/s\n", names[kind],
+               util * 100, tput / 1000);
+        util_sum += util;
+        tput_sum += tput;
+        if (rep) {
+            write_rep(dir, names[kind], rep, ids);
+            fclose(rep);
+        }
+    }
+    printf("%-8s util %5.1f%%  %8.0f Kops/s\n", "avg",
+           util_sum * 100 / NO_OF_WORKLOAD, tput_sum / NO_OF_WORKLOAD / 1000);
+    mem_deinit();
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * memlib.c
+ *
+ * Stand-in for memlib of the malloc lab handout: a MAX_HEAP region is
+ * mapped once and mem_sbrk moves a break inside it.
+ *
+ * @note
+ *      1. heap begins 8 bytes past a page, as the handout's does with
+ *         a malloc'ed region, so mm.c can't rely on a better alignment
+ *      2. mem_sbrk isn't locked, mm.c calls it under its own lock
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "memlib.h"
+
+#ifndef MAX_HEAP
+#define MAX_HEAP (100 * (1 << 20))   /// bytes of heap at most
+#endif
+
+static char *mem_start_brk;   /// first byte of heap
+static char *mem_brk;         /// last byte of heap plus 1
+static char *mem_max_addr;    /// max legal heap address plus 1
+
+/**
+ * @brief
+ *      map the region of heap, exit if it can't be mapped
+ */
+void mem_init(void) {
+    char *p = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (MAP_FAILED == p) {
+        fprintf(stderr, "mem_init: mmap failed\n");
+        exit(1);
+    }
+    mem_start_brk = p + 8;
+    mem_max_addr = p + MAX_HEAP;
+    mem_brk = mem_start_brk;
+}
+
+void mem_deinit(void) {
+    munmap(mem_start_brk - 8, MAX_HEAP);
+}
+
+/**
+ * @brief
+ *      reset break to start of heap, i.e., an empty heap
+ */
+void mem_reset_brk(void) {
+    mem_brk = mem_start_brk;
+}
+
+/**
+ * @brief
+ *      extend heap by incr bytes
+ * @ret
+ *      old break, (void *)-1 if incr < 0 or heap is full
+ */
+void *mem_sbrk(int incr) {
+    char *old_brk = mem_brk;
+
+    if (incr < 0 || incr > mem_max_addr - mem_brk) {
+        fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+        return (void *)-1;
+    }
+    mem_brk += incr;
+    return old_brk;
+}
+
+void *mem_heap_lo(void) {
+    return mem_start_brk;
+}
+
+void *mem_heap_hi(void) {
+    return mem_brk - 1;
+}
+
+size_t mem_heapsize(void) {
+    return mem_brk - mem_start_brk;
+}
+
+size_t mem_pagesize(void) {
+    return getpagesize();
+}
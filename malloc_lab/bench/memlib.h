@@ -0,0 +1,21 @@
+/*
+ * memlib.h
+ *
+ * Stand-in for memlib of the malloc lab handout, so mm.c can be built
+ * and measured outside of it. Same interface, see memlib.c
+ */
+#ifndef __MEMLIB_H__
+#define __MEMLIB_H__
+
+#include <unistd.h>
+
+void mem_init(void);
+void mem_deinit(void);
+void *mem_sbrk(int incr);
+void mem_reset_brk(void);
+void *mem_heap_lo(void);
+void *mem_heap_hi(void);
+size_t mem_heapsize(void);
+size_t mem_pagesize(void);
+
+#endif /* __MEMLIB_H__ */
@@ -0,0 +1,18 @@
+/*
+ * mm.h
+ *
+ * Interface of mm.c, as in the malloc lab handout
+ */
+#ifndef __MM_H__
+#define __MM_H__
+
+#include <stdio.h>
+
+extern int mm_init(void);
+extern void *mm_malloc(size_t size);
+extern void mm_free(void *ptr);
+extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern int mm_checkheap(int verbose);
+
+#endif /* __MM_H__ */
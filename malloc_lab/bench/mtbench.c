@@ -0,0 +1,168 @@
+/*
+ * mtbench.c
+ *
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * Thread scaling bench of mm.c built with -DMM_THREADED.
+ *      usage: mtbench [-o ops] threads...
+ * Each thread does ops of malloc/free on SLOTS slots of its own:
+ *      1. an empty slot is malloc'ed 8 to 128 bytes, 1/32 of them 256
+ *         to 4256 bytes, and the block is zeroed
+ *      2. a full slot is freed, 1/16 of them is handed to a random
+ *         exchange slot instead, and freed by whichever thread swaps
+ *         it out, so there are frees of blocks of other threads
+ *      3. million ops per second of all threads is printed, with heap
+ *         size, and mm_checkheap is run at the end
+ *
+ * @note
+ *      A thread uses the arena of cpu it runs on, so the number of
+ *      cpus, not threads, decides how many arenas are in use
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "mm.h"
+#include "memlib.h"
+
+#define MAX_THREADS 64
+#define SLOTS       512   /// live blocks of a thread at most
+#define XFER_SLOTS  64    /// exchange slots of a thread
+
+static void *xfer[MAX_THREADS][XFER_SLOTS];   /// blocks handed over
+static int nthreads;
+static int nops = 400000;
+
+/**
+ * @brief
+ *      ops of one thread
+ * @param
+ *      arg: index of thread
+ */
+static void *worker(void *arg) {
+    long id = (long)arg;
+    unsigned long long r = 1234567 + id * 7919;
+    void *slots[SLOTS] = {NULL};
+    void *old;
+    size_t n;
+    int op, i;
+
+    for (op = 0; op < nops; op++) {
+        r ^= r << 13;
+        r ^= r >> 7;
+        r ^= r << 17;
+        i = r % SLOTS;
+        if (NULL == slots[i]) {
+            n = ((r >> 20) % 32 == 0) ? 256 + (r >> 24) % 4000
+                                      : 8 + (r >> 24) % 120;
+            if (NULL == (slots[i] = mm_malloc(n))) {
+                printf("malloc of %zu returns NULL\n", n);
+                exit(1);
+            }
+            memset(slots[i], 0, n);
+            *(long *)slots[i] = i;
+            continue;
+        }
+        if ((r >> 20) % 16 == 0) {
+            old = __atomic_exchange_n(&xfer[(r >> 30) % nthreads]
+                                           [(r >> 40) % XFER_SLOTS],
+                                      slots[i], __ATOMIC_ACQ_REL);
+            if (old) {
+                mm_free(old);
+            }
+        } else {
+            if (*(long *)slots[i] != i) {
+                printf("block of slot %d is corrupted\n", i);
+                exit(1);
+            }
+            mm_free(slots[i]);
+        }
+        slots[i] = NULL;
+    }
+    for (i = 0; i < SLOTS; i++) {
+        if (slots[i]) {
+            mm_free(slots[i]);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief
+ *      run nthreads on a new heap
+ * @ret
+ *      million ops per second
+ */
+static double run(void) {
+    pthread_t tids[MAX_THREADS];
+    struct timespec start, end;
+    long i;
+    int k;
+
+    mem_reset_brk();
+    if (mm_init()) {
+        printf("mm_init failed\n");
+        exit(1);
+    }
+    memset(xfer, 0, sizeof(xfer));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nthreads; i++) {
+        pthread_create(&tids[i], NULL, worker, (void *)i);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (i = 0; i < nthreads; i++) {
+        for (k = 0; k < XFER_SLOTS; k++) {
+            if (xfer[i][k]) {
+                mm_free(xfer[i][k]);
+            }
+        }
+    }
+    if (mm_checkheap(0)) {
+        printf("checkheap failed\n");
+        exit(1);
+    }
+    return (double)nthreads * nops / 1e6 /
+           ((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main(int argc, char **argv) {
+    double mops;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        switch (opt) {
+            case 'o':
+                nops = atoi(optarg);
+                break;
+            default:
+                optind = argc + 1;
+                break;
+        }
+    }
+    if (optind >= argc || nops <= 0) {
+        fprintf(stderr, "usage: %s [-o ops] threads...\n", argv[0]);
+        exit(1);
+    }
+
+    mem_init();
+    printf("%ld cpus online\n", sysconf(_SC_NPROCESSORS_ONLN));
+    for (; optind < argc; optind++) {
+        nthreads = atoi(argv[optind]);
+        if (nthreads <= 0 || nthreads > MAX_THREADS) {
+            fprintf(stderr, "threads must be 1 to %d\n", MAX_THREADS);
+            exit(1);
+        }
+        mops = run();
+        printf("%2d threads: %7.2f Mops/s  heap %zu KB\n", nthreads, mops,
+               mem_heapsize() >> 10);
+    }
+    mem_deinit();
+    return 0;
+}
@@ -4,7 +4,8 @@
  * @author Wei-Lin Tsai weilints@andrew.cmu.edu
  * 
  * Approach: segregated fits decribed on p. 871 
- * Search method: first fit from minimum sized free list 
+ * Search method: good fit by two-level bitmap of free lists (TLSF),
+ *                or another placement policy by MM_FIT
  * Coalescing policy: immediate
  *
  * Howto:
@@ -15,8 +16,8 @@
  *      3. use extend_heap function to allocate a basic size of heap
  *
  *   == malloc ==
- *      1. Find a suitable block from free list (use first-fit 
- *         search in each list)
+ *      1. Find a suitable block from free list (head of its own list,
+ *         or head of the first non-empty list which always fits)
  *      2. If found 
  *          2.a allocate memory(set allocate bit), do split if acceptable
  *          2.b remove block from list 
@@ -36,38 +37,146 @@
  * --
  *
  * Data structure of block:
- *   Same as Fig 9.48(a)(b) on textbook p. 869
+ *   Same as Fig 9.48(a)(b) on textbook p. 869, but an allocated block
+ *   has no footer. Bit 1 of header tells if previous block is
+ *   allocated, so footer is only needed to find a free previous block
  *   Allocated:
- *      31-------------0-
- *      | block size|a/f|  Header
- *      -----------------
- *      | payload       |
- *      -----------------
- *      | padding(opt)  |
- *      -----------------
- *      | block size|a/f|  Footer 
- *      -----------------
+ *      31-------------------0-
+ *      | block size|p/f|a/f|  Header
+ *      -----------------------
+ *      | payload             |
+ *      -----------------------
+ *      | padding(opt)        |
+ *      -----------------------
  *   Freed
- *      31-------------0-
- *      | block size|a/f|  Header
+ *      31-------------------0-
+ *      | block size|p/f|a/f|  Header
+ *      -----------------------
+ *      | pred offset   |  Offset of predecessor
  *      -----------------
- *      | pred ptr      |  Pointer to predecessor
- *      -----------------
- *      | succ ptr      |  Pointer to successor
+ *      | succ offset   |  Offset of successor
  *      -----------------
  *      | padding(opt)  |
  *      -----------------
  *      | block size|a/f|  Footer 
  *      -----------------
  *   As a result 
- *   Header/Footer = 4/4; ptr to pred/succ = 8/8. total is 24 byes 
+ *   Header/Footer = 4/4; offset of pred/succ = 4/4. total is 16 byes 
+ *   for a free block, an allocated one has 4 bytes overhead
+ *   An offset is bytes from bottom of heap (arena table, never a free
+ *   block), so 0 is NULL. Heap is below 4GB by SIZE_MASK of a chunk
+ *   and MAX_HEAP of memlib
+ *   A free block in tree of FIT_TREE has left/right child ptr and max
+ *   block size of its subtree instead of pred/succ, it's big enough
  *
  * -- 
  *
  * Free lists organization 
- *   We have 12 free-lists, denoted as free_list_size_1_head 
- *   ~ free_list_size_2048_head
- *   the size of each list is defined ad TYPE_1_SIZE ~ TYPE_2048_SIZE
+ *   Each arena has NO_OF_LIST free-lists in two levels as TLSF
+ *   1. first level is power of 2 of size, second level splits it to
+ *      SL_COUNT lists. Sizes below SMALL_BLK_SIZE have a list per
+ *      DSIZE, see get_list_index_by_size
+ *   2. fl_bitmap has a bit per first level with a non-empty list,
+ *      sl_bitmap[fl] has a bit per non-empty list of first level fl
+ *   3. a request of asize is rounded up to the next list, so any
+ *      block of the first non-empty list from there fits, it's found
+ *      by ctz of bitmaps in O(1)
+ *
+ * --
+ *
+ * Placement policies
+ *   mm_init reads environment variable MM_FIT to select one of
+ *   1. good (default): as above, O(1), but a block may be split from
+ *      a much bigger one
+ *   2. first: first block which fits, walking non-empty lists from
+ *      list of its size
+ *   3. best: smallest block which fits, in first list having one
+ *   4. tree: free blocks from TREE_MIN_SIZE are kept in a treap of
+ *      each arena ordered by address (priority is hash of address),
+ *      a node keeps max size of its subtree. A large request takes
+ *      the block of lowest address which fits in O(log n), so large
+ *      blocks are packed to bottom of heap. Smaller ones are as good
+ *
+ * --
+ *
+ * Arenas
+ *   1. the arena table is at bottom of heap, mm_init makes one arena,
+ *      or one per cpu (NO_OF_ARENA_MAX at most) in MM_THREADED
+ *   2. an arena owns chunks of heap, each chunk is formed as
+ *      | arena index | prologue hdr | prologue ftr | blocks | epilogue |
+ *      so blocks never coalesce across arenas. An arena at top of heap
+ *      grows its last chunk as before, or it starts a new chunk
+ *   3. an allocated block keeps index of its arena in high bits of
+ *      header, see ARENA_SHIFT, so free knows where it goes
+ *
+ * --
+ *
+ * Slab for small requests
+ *   1. a request up to SLAB_MAX_SIZE is rounded to one of
+ *      NO_OF_SLAB_CLASS object sizes, 8 ~ 64 by 8, ~ 128 by 16 and
+ *      ~ 256 by 32, see get_slab_class
+ *   2. objects of a class are cut from runs, a run is an allocated
+ *      block of RUN_SIZE bytes aligned to RUN_SIZE, with slab_run_t at
+ *      its beginning. Objects have no header, freed ones are kept in a
+ *      stack linked by first word, never used ones after run->unused
+ *   3. each arena keeps a list of runs with free objects per class,
+ *      so allocate and free are O(1). An empty run goes back to heap
+ *      unless it's the only one of its class
+ *   4. run_map is a bitmap of RUN_SIZE aligned addresses which are
+ *      runs, free checks it to know if a pointer is an object of a run
+ *      (pointer rounded down to RUN_SIZE). It's an allocated block,
+ *      doubled when heap grows, old maps are kept so it can be read
+ *      without lock. They're 1/32768 of heap in total
+ *
+ * --
+ *
+ * Large requests by mmap (MM_MMAP, off with DRIVER or -DMM_NO_MMAP)
+ *   1. a request from mmap_threshold is mmapped alone, so its pages
+ *      go back to OS when it's freed
+ *      | length | padding | header |  payload ... |
+ *      length (8 bytes) is bytes mmapped, header has MMAPPED bit, a
+ *      pointer out of heap with this bit is mmapped
+ *   2. threshold begins at MMAP_THRESHOLD_MIN, it's raised to size of
+ *      a freed mmapped block (MMAP_THRESHOLD_MAX at most) as glibc, so
+ *      transient buffers of a size move to heap instead of paying
+ *      mmap/munmap each time
+ *   3. realloc of a mmapped block uses mremap while it's still large
+ *   4. the driver wants every block in heap, so it's off with DRIVER
+ *
+ * --
+ *
+ * Returning memory to OS
+ *   1. each arena counts bytes freed since its last trim. When it's
+ *      trim_threshold and half of the arena or more, and a free makes
+ *      a free block of TRIM_MIN_SIZE or more, page-aligned interior of
+ *      that block is released by madvise(MADV_DONTNEED), and count is
+ *      reset. Header, links and footer are kept, the pages are zero
+ *      when touched again. So there's a madvise per half of heap freed
+ *      at most, a hot block isn't faulted in again and again
+ *   2. top of heap is trimmed the same way. mem_sbrk can't shrink
+ *      heap, so free block at top keeps its address space but not its
+ *      pages
+ *   3. trim_threshold begins at TRIM_THRESHOLD, it's raised to twice
+ *      mmap_threshold with it as glibc, so transient buffers moved to
+ *      heap aren't released and faulted in each time
+ *
+ * --
+ *
+ * Thread safety (build with -DMM_THREADED)
+ *   1. each arena has a lock, a thread uses the arena of cpu it runs
+ *      on, and moves to the arena of its current cpu if the lock is
+ *      busy. mem_sbrk and run_map are changed under sbrk_lock
+ *   2. each thread caches freed slab objects in a bin per class. A
+ *      cached object is still allocated in its run, and is linked by
+ *      its first word
+ *   3. malloc/free of a small object only touch bins of calling
+ *      thread, arena lock is taken when a bin is empty (refill
+ *      TCACHE_FILL objects) or full (flush half of it), and for blocks
+ *   4. a block or object of another arena is pushed to remote_free of
+ *      its arena without lock, the owner frees them next time it's
+ *      locked
+ *   5. bins are flushed when a thread exits, and dropped by mm_init
+ *   6. mm_init and mm_checkheap should not run with other calls
  *
  * --
  *
@@ -78,12 +187,23 @@
  *      Hence, not many error condition handeling in normal mode
  */
 
+#if !defined(DRIVER) && !defined(MM_NO_MMAP)
+#define MM_MMAP             /// mmap large requests
+#endif
+#if defined(MM_THREADED) || defined(MM_MMAP)
+#define _GNU_SOURCE         /// for sched_getcpu and mremap
+#endif
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef MM_THREADED
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <sys/mman.h>
 #include "contracts.h"
 
 #include "mm.h"
@@ -124,38 +244,113 @@
 #define DSIZE       8       /// Doubleword size (bytes)
 #define CHUNKSIZE  (1<<7)   /// Extend heap by this amount (bytes)
 
-/** header/footer = 4/4; ptr to pred/succ = 8/8. total is 24 byes */
-#define MIN_BLK_SIZE    24   /// minimum block size for double link-list block
-/** minimum size of each free-list */
-#define TYPE_1_SIZE     24 * 1
-#define TYPE_2_SIZE     24 * 2
-#define TYPE_4_SIZE     24 * 4
-#define TYPE_8_SIZE     24 * 8 
-#define TYPE_16_SIZE    24 * 16
-#define TYPE_32_SIZE    24 * 32
-#define TYPE_64_SIZE    24 * 64
-#define TYPE_128_SIZE   24 * 128
-#define TYPE_256_SIZE   24 * 256
-#define TYPE_512_SIZE   24 * 512
-#define TYPE_1024_SIZE  24 * 1024
-#define TYPE_2048_SIZE  24 * 2048
-#define NO_OF_SIZE_TYPE 12   /// number of different type size
+/** header/footer = 4/4; offset of pred/succ = 4/4. total is 16 byes */
+#define MIN_BLK_SIZE    16   /// minimum block size for double link-list block
+/** two-level free lists */
+#define SL_SHIFT        3    /// a power of 2 of size is split to 8 lists
+#define SL_COUNT        (1 << SL_SHIFT)
+#define SMALL_BLK_SIZE  (DSIZE * SL_COUNT) /// sizes below have list per DSIZE
+#define FL_COUNT        24   /// first levels, sizes below 2^29
+#define NO_OF_LIST      (FL_COUNT * SL_COUNT)  /// number of free lists
+
+/** placement policies */
+#define FIT_GOOD        0    /// head of first list which fits, TLSF
+#define FIT_FIRST       1    /// first block which fits
+#define FIT_BEST        2    /// smallest block which fits
+#define FIT_TREE        3    /// lowest address which fits for large blocks
+#define TREE_MIN_SIZE   1024 /// free blocks from this size are in tree
+
+/** arena index is kept in 3 high bits of header of allocated block */
+#define ARENA_SHIFT     29
+#define NO_OF_ARENA_MAX 8
+#define SIZE_MASK       0x1ffffff8  /// bits of size in header/footer
+#define PREV_ALLOC      0x2         /// bit of header, previous block is
+                                    /// allocated
+#define MMAPPED         0x4         /// bit of header, block is mmapped
+#define ARENA_CHUNKSIZE (1<<16)     /// Extend an arena by this at least
+                                    /// in MM_THREADED
+
+/** slab for small requests */
+#define SLAB_MAX_SIZE    256  /// requests up to this size are served by runs
+#define NO_OF_SLAB_CLASS 16   /// number of object sizes
+#define RUN_SIZE         4096 /// size and alignment of a run
+#define RUN_MAP_MIN      64   /// bytes of first run_map, covers 2MB
+
+/** large requests by mmap */
+#define MMAP_HDR_SIZE      (2*DSIZE)         /// length and header
+#define MMAP_THRESHOLD_MIN (128*1024)        /// first threshold
+#define MMAP_THRESHOLD_MAX (32*1024*1024)    /// threshold is raised to this
+
+/** returning memory to OS */
+#define TRIM_THRESHOLD     (128*1024)        /// first trim_threshold
+#define TRIM_MIN_SIZE      (64*1024)         /// free blocks to be released
+
+/** per thread cache of MM_THREADED */
+#define TCACHE_BIN_MAX  32   /// objects in a bin at most, half is flushed then
+#define TCACHE_FILL     16   /// objects taken from runs when a bin is empty
+
+/** header of a run, at beginning of its payload */
+typedef struct slab_run {
+    struct slab_run *prev;       /// in list of its class of its arena
+    struct slab_run *next;
+    char *free;                  /// freed objects, linked by first word
+    char *unused;                /// objects never allocated begin here
+    unsigned int obj_size;       /// bytes of an object
+    unsigned int cls;            /// slab class
+    unsigned int nobj;           /// objects in run
+    unsigned int nused;          /// objects allocated
+} slab_run_t;
+
+/** an arena, it's in arena table at bottom of heap */
+typedef struct {
+    char *heap_listp;                      /// prologue of its first chunk
+    char *heap_end;                        /// end of its last chunk
+    char *free_list_head[NO_OF_LIST];      /// list index fl * SL_COUNT + sl
+    unsigned int fl_bitmap;                /// first levels not empty
+    unsigned char sl_bitmap[FL_COUNT];     /// lists not empty
+    char *tree_root;                       /// large free blocks in FIT_TREE
+    size_t freed;                          /// bytes freed since last trim
+    size_t heap_size;                      /// bytes of blocks of its chunks
+    slab_run_t *slab_runs[NO_OF_SLAB_CLASS]; /// runs with free objects
+    unsigned int index;                    /// index in arena table
+#ifdef MM_THREADED
+    pthread_mutex_t lock;                  /// protects everything above
+    char *remote_free;                     /// blocks freed by other arenas'
+                                           /// threads, linked by payload
+#endif
+} arena_t;
 
 /** Global variables */
 static char *heap_listp = 0;     /// Pointer to first block
-/** use 12 global ptr point to each sized free list */
-static char *free_list_size_1_head   = 0; /// list index = 0  
-static char *free_list_size_2_head   = 0; /// list index = 1
-static char *free_list_size_4_head   = 0; /// list index = 2
-static char *free_list_size_8_head   = 0; /// list index = 3
-static char *free_list_size_16_head  = 0; /// list index = 4
-static char *free_list_size_32_head  = 0; /// list index = 5
-static char *free_list_size_64_head  = 0; /// list index = 6
-static char *free_list_size_128_head = 0; /// list index = 7
-static char *free_list_size_256_head = 0; /// list index = 8
-static char *free_list_size_512_head = 0; /// list index = 9
-static char *free_list_size_1024_head= 0; /// list index =10
-static char *free_list_size_2048_head= 0; /// list index =11
+static arena_t *arenas = 0;      /// arena table
+static unsigned int no_of_arena = 0;
+static unsigned int fit_policy = FIT_GOOD;  /// placement policy
+static size_t page_size = 0;
+static size_t trim_threshold = TRIM_THRESHOLD; /// bytes freed between trims
+#ifdef MM_MMAP
+static size_t mmap_threshold = MMAP_THRESHOLD_MIN; /// mmap from this size
+#endif
+static char *run_map = 0;        /// bitmap of runs, its first word is
+                                 /// number of bits
+
+#ifdef MM_THREADED
+/** freed slab objects cached by a thread, a bin per class.
+ *  It's allocated from heap */
+typedef struct {
+    char *bin[NO_OF_SLAB_CLASS];           /// singly linked by first word
+    unsigned int count[NO_OF_SLAB_CLASS];  /// objects in each bin
+} tcache_t;
+
+static pthread_mutex_t sbrk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;        /// to flush cache at thread exit
+static unsigned int heap_epoch = 0;     /// bumped by mm_init
+static __thread tcache_t *tcache;       /// cache of calling thread
+static __thread unsigned int tcache_epoch; /// heap_epoch of tcache
+static __thread arena_t *thread_arena;  /// arena of calling thread
+static __thread unsigned int arena_epoch;  /// heap_epoch of thread_arena
+#endif
 
 /*
  *  Helper functions
@@ -196,14 +391,37 @@ static inline unsigned int pack_size(unsigned int size, unsigned int alloc) {
 /** Read the size and allocated fields from address p */
 static inline unsigned int get_size(unsigned int *p){
     REQUIRES(in_heap(p));
-    return ( get_word_val(p) & ~0x7);
+    return ( get_word_val(p) & SIZE_MASK);
 }
 static inline unsigned int get_alloc(unsigned int *p){
     REQUIRES(in_heap(p));
     return ( get_word_val(p) & 0x1);
 }
+static inline unsigned int get_prev_alloc(unsigned int *p){
+    REQUIRES(in_heap(p));
+    return ( get_word_val(p) & PREV_ALLOC);
+}
+
+/** Set or clear prev-allocated bit in header of block bp. It's atomic
+ *  as bp may be allocated, its owner may read its header without lock */
+static inline void set_prev_alloc(char *bp, unsigned int prev_alloc){
+    unsigned int *p = (unsigned int *)(bp - WSIZE);
+
+    REQUIRES(in_heap(p));
+    if (prev_alloc) {
+        __atomic_fetch_or(p, PREV_ALLOC, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(p, ~PREV_ALLOC, __ATOMIC_RELAXED);
+    }
+}
+
+/** Read header of allocated block bp without lock of its arena */
+static inline unsigned int get_alloc_header(char *bp){
+    return __atomic_load_n((unsigned int *)(bp - WSIZE), __ATOMIC_RELAXED);
+}
 
-/** Given block ptr bp, compute address of its header and footer */
+/** Given block ptr bp, compute address of its header and footer,
+ *  only a free block has footer */
 static inline unsigned int *get_header_ptr(char *bp){
     REQUIRES(NULL != bp);
     REQUIRES(aligned(bp));
@@ -224,6 +442,7 @@ static inline char *get_next_blk_ptr(char *bp) {
     REQUIRES(aligned(bp));
     return (bp + get_size((unsigned int *)(bp - WSIZE))); 
 }
+/** previous block should be free */
 static inline char *get_prev_blk_ptr(char *bp) {
     REQUIRES(NULL != bp);
     REQUIRES(in_heap(bp));
@@ -231,30 +450,28 @@ static inline char *get_prev_blk_ptr(char *bp) {
     return (bp - get_size((unsigned int *)(bp - DSIZE))); 
 }
 
+/** Convert a block pointer to offset in free list and back */
+static inline unsigned int get_offset(void *bp){
+    return (NULL == bp) ? 0 : (unsigned int)((char *)bp - (char *)arenas);
+}
+static inline char *get_offset_ptr(unsigned int offset){
+    return (0 == offset) ? NULL : (char *)arenas + offset;
+}
+
 /** Set pred/succ pointer of given block */
 static inline void set_pred_ptr(void *bp, void *pred_ptr){
     REQUIRES(NULL != bp);
     REQUIRES(in_heap(bp));
     REQUIRES(aligned(bp));
     REQUIRES(aligned(pred_ptr));
-    *(size_t*)bp = (uintptr_t)pred_ptr;
+    *(unsigned int *)bp = get_offset(pred_ptr);
 }
 static inline void set_succ_ptr(void *bp, void *succ_ptr){
     REQUIRES(NULL != bp);
     REQUIRES(in_heap(bp));
     REQUIRES(aligned(bp));
     REQUIRES(aligned(succ_ptr));
-    *((size_t*)bp + 1) = (uintptr_t)succ_ptr;
-}
-
-/** Reset block's pointers to NULL */ 
-static inline void reset_list_note (void *bp){
-    REQUIRES(NULL != bp);
-    REQUIRES(in_heap(bp));
-    REQUIRES(aligned(bp));
-    // reset to be null
-    set_pred_ptr(bp, NULL);
-    set_succ_ptr(bp, NULL);
+    *((unsigned int *)bp + 1) = get_offset(succ_ptr);
 }
 
 /** get pred/succ pointer of given block */
@@ -262,120 +479,190 @@ static inline char *get_pred_ptr(void *bp){
     REQUIRES(NULL != bp);
     REQUIRES(in_heap(bp));
     REQUIRES(aligned(bp));
-    return (char *)(*(long*)bp);
+    return get_offset_ptr(*(unsigned int *)bp);
 }
 static inline char *get_succ_ptr(void *bp){
     REQUIRES(NULL != bp);
     REQUIRES(in_heap(bp));
     REQUIRES(aligned(bp));
-    return (char *)(*((long*)bp + 1));
+    return get_offset_ptr(*((unsigned int *)bp + 1));
 }
 
-/** given list_index, return corresponding free-list head*/
-static inline char *get_list_head_by_index(size_t list_index){
-    switch (list_index) {
-        case 0:
-            return free_list_size_1_head;
-        case 1:
-            return free_list_size_2_head;
-        case 2:
-            return free_list_size_4_head;
-        case 3:
-            return free_list_size_8_head;
-        case 4:
-            return free_list_size_16_head;
-        case 5:
-            return free_list_size_32_head;
-        case 6:
-            return free_list_size_64_head;
-        case 7:
-            return free_list_size_128_head;
-        case 8:
-            return free_list_size_256_head;
-        case 9:
-            return free_list_size_512_head;
-        case 10:
-            return free_list_size_1024_head;
-        case 11:
-            return free_list_size_2048_head;
-        default:
-            return free_list_size_1_head;
+/** get/set left/right child ptr and max block size of subtree of a
+ *  block in tree */
+static inline char *get_left_ptr(char *bp){
+    REQUIRES(in_heap(bp));
+    return *(char **)bp;
+}
+static inline char *get_right_ptr(char *bp){
+    REQUIRES(in_heap(bp));
+    return *((char **)bp + 1);
+}
+static inline size_t get_tree_max(char *bp){
+    return (NULL == bp) ? 0 : *((size_t *)bp + 2);
+}
+static inline void set_left_ptr(char *bp, char *left){
+    REQUIRES(in_heap(bp));
+    *(char **)bp = left;
+}
+static inline void set_right_ptr(char *bp, char *right){
+    REQUIRES(in_heap(bp));
+    *((char **)bp + 1) = right;
+}
+
+/** Recompute max block size of subtree of bp from its children */
+static inline void update_tree_max(char *bp){
+    size_t max = get_size(get_header_ptr(bp));
+
+    if (get_tree_max(get_left_ptr(bp)) > max) {
+        max = get_tree_max(get_left_ptr(bp));
     }
+    if (get_tree_max(get_right_ptr(bp)) > max) {
+        max = get_tree_max(get_right_ptr(bp));
+    }
+    *((size_t *)bp + 2) = max;
+}
+
+/** treap priority of a block, hash of its address */
+static inline unsigned int get_tree_prio(char *bp){
+    return ((uint64_t)(uintptr_t)bp * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+/** if a free block of size is kept in tree instead of lists */
+static inline int in_tree(size_t size){
+    return FIT_TREE == fit_policy && size >= TREE_MIN_SIZE;
+}
+
+/** given list_index, return corresponding free-list head*/
+static inline char *get_list_head_by_index(arena_t *ar, size_t list_index){
+    return ar->free_list_head[list_index];
 }
 
 /** given blk's size, return the list_index which it should fall*/
 static inline size_t get_list_index_by_size(size_t size){
-    if ( size <= TYPE_1_SIZE) {
-        return 0;  
-    } else if (size <= TYPE_2_SIZE) {
-        return 1;
-    } else if (size <= TYPE_4_SIZE) {
-        return 2;
-    } else if (size <= TYPE_8_SIZE) {
-        return 3;
-    } else if (size <= TYPE_16_SIZE) {
-        return 4;
-    } else if (size <= TYPE_32_SIZE) {
-        return 5;
-    } else if (size <= TYPE_64_SIZE) {
-        return 6;
-    } else if (size <= TYPE_128_SIZE) {
-        return 7;
-    } else if (size <= TYPE_256_SIZE) {
-        return 8;
-    } else if (size <= TYPE_512_SIZE) {
-        return 9;
-    } else if (size <= TYPE_1024_SIZE) {
-        return 10;
-    } else {
-        return NO_OF_SIZE_TYPE - 1;
+    unsigned int fl, sl;
+
+    if (size < SMALL_BLK_SIZE) {
+        return size / DSIZE;
+    }
+    fl = 31 - __builtin_clz(size);           // floor(log2(size))
+    sl = (size >> (fl - SL_SHIFT)) - SL_COUNT;
+    // first level 1 is log2(SMALL_BLK_SIZE)
+    return (fl - SL_SHIFT - 2) * SL_COUNT + sl;
+}
+
+/** given asize, return the first list_index whose blocks all fit,
+ *  it may be NO_OF_LIST or more */
+static inline size_t get_fit_index_by_size(size_t asize){
+    if (asize < SMALL_BLK_SIZE) {
+        return asize / DSIZE;
     }
+    // round up to size of next list
+    asize += (1 << (31 - __builtin_clz(asize) - SL_SHIFT)) - 1;
+    return get_list_index_by_size(asize);
 }
 
 /** given blk's size, return address(pointer) of corresponding
  *  list_head ptr */
-static inline char **get_list_head_by_size(size_t size){
-    if ( size <= TYPE_1_SIZE) {
-        return &free_list_size_1_head;  
-    } else if (size <= TYPE_2_SIZE) {
-        return &free_list_size_2_head;
-    } else if (size <= TYPE_4_SIZE) {
-        return &free_list_size_4_head;
-    } else if (size <= TYPE_8_SIZE) {
-        return &free_list_size_8_head;
-    } else if (size <= TYPE_16_SIZE) {
-        return &free_list_size_16_head;
-    } else if (size <= TYPE_32_SIZE) {
-        return &free_list_size_32_head;
-    } else if (size <= TYPE_64_SIZE) {
-        return &free_list_size_64_head;
-    } else if (size <= TYPE_128_SIZE) {
-        return &free_list_size_128_head;
-    } else if (size <= TYPE_256_SIZE) {
-        return &free_list_size_256_head;
-    } else if (size <= TYPE_512_SIZE) {
-        return &free_list_size_512_head;
-    } else if (size <= TYPE_1024_SIZE) {
-        return &free_list_size_1024_head;
+static inline char **get_list_head_by_size(arena_t *ar, size_t size){
+    return &ar->free_list_head[get_list_index_by_size(size)];
+}
+
+/** Reset all linked-list */
+static inline void reset_all_list_head(arena_t *ar){
+    size_t i;
+
+    for (i = 0; i < NO_OF_LIST; i++) {
+        ar->free_list_head[i] = NULL;
+    }
+    ar->fl_bitmap = 0;
+    memset(ar->sl_bitmap, 0, sizeof(ar->sl_bitmap));
+    ar->tree_root = NULL;
+}
+
+/** Pack a size and allocated bit of a block in arena ar */
+static inline unsigned int pack_alloc(arena_t *ar, unsigned int size) {
+    return pack_size(size, 1) | (ar->index << ARENA_SHIFT);
+}
+
+/** given request size, return adjusted block size */
+static inline size_t get_asize(size_t size) {
+    if (size <= MIN_BLK_SIZE - WSIZE){  // minimum size = 16
+        return MIN_BLK_SIZE; // 2*DSIZE
+    }
+    return DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE);
+}
+
+/** given request size, return its slab class */
+static inline unsigned int get_slab_class(size_t size) {
+    if (size <= 64) {
+        return (size - 1) / 8;
+    } else if (size <= 128) {
+        return 8 + (size - 65) / 16;
     } else {
-        return &free_list_size_2048_head;
+        return 12 + (size - 129) / 32;
     }
 }
 
-/** Reset all linked-list */
-static inline void reset_all_list_head(){
-    free_list_size_1_head   = NULL;
-    free_list_size_2_head   = NULL;
-    free_list_size_4_head   = NULL;
-    free_list_size_8_head   = NULL;
-    free_list_size_16_head  = NULL;
-    free_list_size_32_head  = NULL;
-    free_list_size_64_head  = NULL;
-    free_list_size_128_head = NULL;
-    free_list_size_256_head = NULL;
-    free_list_size_512_head = NULL;
-    free_list_size_1024_head = NULL;
-    free_list_size_2048_head = NULL;
+/** given slab class, return its object size */
+static inline unsigned int get_slab_size(unsigned int cls) {
+    if (cls < 8) {
+        return (cls + 1) * 8;
+    } else if (cls < 12) {
+        return 64 + (cls - 7) * 16;
+    } else {
+        return 128 + (cls - 11) * 32;
+    }
+}
+
+/** given ptr, return the run it's in, NULL if it's not in a run */
+static inline slab_run_t *get_run(void *bp) {
+    uintptr_t run = (uintptr_t)bp & ~(uintptr_t)(RUN_SIZE - 1);
+    uintptr_t base = (uintptr_t)mem_heap_lo() & ~(uintptr_t)(RUN_SIZE - 1);
+    char *map = __atomic_load_n(&run_map, __ATOMIC_ACQUIRE);
+    size_t i = (run - base) / RUN_SIZE;
+
+    if (NULL == map || i >= *(size_t *)map) {
+        return NULL;
+    }
+    map += sizeof(size_t);
+    if (__atomic_load_n(&map[i / 8], __ATOMIC_RELAXED) & (1 << (i % 8))) {
+        return (slab_run_t *)run;
+    }
+    return NULL;
+}
+
+/** Given allocated block or slab object ptr bp, return its arena */
+static inline arena_t *get_arena_of(void *bp) {
+    slab_run_t *run = get_run(bp);
+
+    if (NULL != run) {
+        bp = run;
+    }
+    return &arenas[get_alloc_header(bp) >> ARENA_SHIFT];
+}
+
+/** if allocated ptr bp is a mmapped block */
+static inline int is_mmapped(void *bp) {
+    return !in_heap(bp) && (get_alloc_header(bp) & MMAPPED);
+}
+
+/** Given mmapped block ptr bp, return bytes mmapped */
+static inline size_t get_mmap_len(void *bp) {
+    return *(size_t *)((char *)bp - MMAP_HDR_SIZE);
+}
+
+/** Given allocated block or slab object ptr bp, return its payload size */
+static inline size_t get_payload_size(void *bp) {
+    slab_run_t *run = get_run(bp);
+
+    if (NULL != run) {
+        return run->obj_size;
+    }
+    if (is_mmapped(bp)) {
+        return get_mmap_len(bp) - MMAP_HDR_SIZE;
+    }
+    return (get_alloc_header(bp) & SIZE_MASK) - WSIZE;
 }
 
 /// Wei-Lin's helper functions end
@@ -383,13 +670,37 @@ static inline void reset_all_list_head(){
 
 
 /** Functions prototype declarations */
-static void *extend_heap(size_t words);
-static void *coalesce(void *bp);
-static void *find_fit(size_t asize);
-static void *find_fit_from_list(size_t asize, size_t list_index);
-static void place(void *bp, size_t asize);
-static void list_push_front(char *bp);
-static void remove_from_list(char *bp);
+static void *extend_heap(arena_t *ar, size_t words);
+static void *coalesce(arena_t *ar, void *bp);
+static void *find_fit(arena_t *ar, size_t asize);
+static void place(arena_t *ar, void *bp, size_t asize);
+static void list_push_front(arena_t *ar, char *bp);
+static void remove_from_list(arena_t *ar, char *bp);
+static char *tree_insert(char *root, char *bp);
+static char *tree_remove(char *root, char *bp);
+static char *tree_find(char *root, size_t asize);
+static void *alloc_block(arena_t *ar, size_t asize);
+static void free_block(arena_t *ar, void *bp);
+static void trim_block(arena_t *ar, char *bp);
+static void count_freed(arena_t *ar, char *bp, size_t size);
+static void *slab_alloc(arena_t *ar, unsigned int cls);
+static void slab_free(arena_t *ar, slab_run_t *run, void *bp);
+static void free_object(arena_t *ar, void *bp);
+static int resize_block(arena_t *ar, void *bp, size_t asize);
+#ifdef MM_MMAP
+static void *mmap_alloc(size_t size);
+static void mmap_free(void *bp);
+static void *mmap_realloc(void *bp, size_t size);
+#endif
+#ifdef MM_THREADED
+static arena_t *lock_arena(void);
+static void release_block(arena_t *ar, void *bp);
+static tcache_t *get_tcache(void);
+static void *tcache_get(unsigned int cls);
+static int tcache_put(slab_run_t *run, void *bp);
+static void tcache_flush(arena_t *ar, tcache_t *tc, size_t index,
+                         unsigned int n);
+#endif
 
 /*
  *  Malloc Implementation
@@ -401,10 +712,11 @@ static void remove_from_list(char *bp);
  * @brief
  *      Initialize first space from heap for later mm_malloc use 
  *
- * 1. Reset all list-head ptr
- * 2. Allocate and initialize Prologue/Epilogue 
- * 3. Allocate CHUNKSIZE memory space from heap
- * 4. Refer Fig. 9.42 on text book p. 863 for a graph demo of heap head 
+ * 1. Select placement policy by MM_FIT, allocate arena table and
+ *    reset all list-head ptr
+ * 2. Allocate CHUNKSIZE memory space from heap as first chunk of
+ *    arena 0, its Prologue/Epilogue is initialized by extend_heap
+ * 3. Refer Fig. 9.42 on text book p. 863 for a graph demo of heap head 
  *
  * @note 
  *      1. Update global variable heap_listp
@@ -412,35 +724,82 @@ static void remove_from_list(char *bp);
  * @ret -1 on error, 0 on success.
  */
 int mm_init(void) {
+    size_t i;
+    size_t table_size;
+    char *fit = getenv("MM_FIT");
 
-    // init list head 
-    reset_all_list_head();
+    heap_listp = 0;
+    run_map = 0;
 
-    /* Create the initial empty heap */
-    if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1) {
-        return -1;
+    page_size = sysconf(_SC_PAGESIZE);
+    trim_threshold = TRIM_THRESHOLD;
+#ifdef MM_MMAP
+    mmap_threshold = MMAP_THRESHOLD_MIN;
+#endif
+
+    fit_policy = FIT_GOOD;
+    if (NULL != fit && !strcmp(fit, "first")) {
+        fit_policy = FIT_FIRST;
+    } else if (NULL != fit && !strcmp(fit, "best")) {
+        fit_policy = FIT_BEST;
+    } else if (NULL != fit && !strcmp(fit, "tree")) {
+        fit_policy = FIT_TREE;
     }
+#ifdef MM_THREADED
+    // caches and arenas of all threads point to old heap
+    heap_epoch++;
+    no_of_arena = sysconf(_SC_NPROCESSORS_ONLN);
+    if (no_of_arena < 1) {
+        no_of_arena = 1;
+    } else if (no_of_arena > NO_OF_ARENA_MAX) {
+        no_of_arena = NO_OF_ARENA_MAX;
+    }
+#else
+    no_of_arena = 1;
+#endif
 
-    /* Init Prologue/Epilogue */
-    set_word_val((unsigned int *)heap_listp, 0);    // alignment padding 
-    heap_listp += WSIZE;                            // Prologue header 
-    set_word_val((unsigned int *)heap_listp, pack_size(DSIZE, 1));    
-    heap_listp += WSIZE;                            // Prologue footer  
-    set_word_val((unsigned int *)heap_listp, pack_size(DSIZE, 1));    
-    heap_listp += WSIZE;                            // Prologue footer  
-    set_word_val((unsigned int *)heap_listp, pack_size(0, 1));    
+    /* Create arena table at bottom of heap */
+    table_size = DSIZE * ((no_of_arena * sizeof(arena_t) + (DSIZE-1)) / DSIZE);
+    if ((arenas = mem_sbrk(table_size)) == (void *)-1) {
+        return -1;
+    }
 
-    // adjust pointer to comlete init 
-    heap_listp -= WSIZE;       
+    // init arenas, they have no chunk yet
+    for (i = 0; i < no_of_arena; i++) {
+        arenas[i].heap_listp = NULL;
+        arenas[i].heap_end = NULL;
+        reset_all_list_head(&arenas[i]);
+        memset(arenas[i].slab_runs, 0, sizeof(arenas[i].slab_runs));
+        arenas[i].index = i;
+        arenas[i].freed = 0;
+        arenas[i].heap_size = 0;
+#ifdef MM_THREADED
+        pthread_mutex_init(&arenas[i].lock, NULL);
+        arenas[i].remote_free = NULL;
+#endif
+    }
 
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (NULL ==  extend_heap(CHUNKSIZE/WSIZE)) {
+    if (NULL ==  extend_heap(&arenas[0], CHUNKSIZE/WSIZE)) {
 	return -1;
     }
 
+    heap_listp = arenas[0].heap_listp;
     return 0;
 }
 
+#ifdef MM_THREADED
+/**
+ * @brief
+ *      init heap at first malloc if mm_init isn't called, called once
+ */
+static void init_once(void) {
+    if (heap_listp == 0) {
+        mm_init();
+    }
+}
+#endif
+
 
 /**
  * @brief 
@@ -448,11 +807,13 @@ int mm_init(void) {
  *
  * Do following steps
  *      1. check heap correctness and handle special case 
- *      2. adjust size because we have minimum size requirement for 
+ *      2. a small request takes an object from a run of its class,
+ *         a large one is mmapped
+ *      3. adjust size because we have minimum size requirement for 
  *         each block
- *      3. find from free lists to see if available
- *      4. if found, allocate space by calling place()
- *      5. if not found, extend heap and allocate space
+ *      4. find from free lists to see if available
+ *      5. if found, allocate space by calling place()
+ *      6. if not found, extend heap and allocate space
  *
  * @param
  *      size: number of bytes to be allocate 
@@ -462,43 +823,62 @@ int mm_init(void) {
  */
 void *malloc (size_t size) {
     size_t asize;      /// Adjusted block size 
-    size_t extendsize; /// Amount to extend heap if no fit 
+    arena_t *ar;
     char *bp;      
 
-    checkheap(0);      // Let's make sure the heap is ok!
+    // check corner case 
+    if (size == 0) {
+        return NULL;
+    }
 
     // mem init at first time 
+#ifdef MM_THREADED
+    pthread_once(&heap_once, init_once);
+#else
     if (heap_listp == 0){
 	mm_init();
     }
- 
-    // check corner case 
-    if (size == 0) {
-        return NULL;
-    }
+#endif
 
-    // Adjust block size to include overhead and alignment reqs
-    if (size <= 2*DSIZE){  // minimum size = 24
-	asize = MIN_BLK_SIZE; // 3*DSIZE
-    } else {
-        asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
+    // small object from a run
+    if (size <= SLAB_MAX_SIZE) {
+#ifdef MM_THREADED
+        // from cache of this thread, without lock
+        if (NULL != (bp = tcache_get(get_slab_class(size)))) {
+            return bp;
+        }
+        ar = lock_arena();
+        bp = slab_alloc(ar, get_slab_class(size));
+        pthread_mutex_unlock(&ar->lock);
+#else
+        bp = slab_alloc(&arenas[0], get_slab_class(size));
+#endif
+        return bp;
     }
 
-    // first fit search 
-    if ( NULL != (bp = find_fit(asize))) {
-        place (bp, asize);
+#ifdef MM_MMAP
+    if (size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED) &&
+        NULL != (bp = mmap_alloc(size))) {
         return bp;
     }
+#endif
 
-    // if not fit, get more memory
-    extendsize = ( asize > CHUNKSIZE ) ? asize : CHUNKSIZE;
-    if ( NULL == ( bp = extend_heap(extendsize/WSIZE))){ // get memory failed
+    // size field of a heap block can't hold it
+    if (size > SIZE_MASK - DSIZE) {
         return NULL;
     }
-   
-    // get extended memory, place and return 
-    place(bp, asize);
-    
+
+    // Adjust block size to include overhead and alignment reqs
+    asize = get_asize(size);
+
+#ifdef MM_THREADED
+    ar = lock_arena();
+    bp = alloc_block(ar, asize);
+    pthread_mutex_unlock(&ar->lock);
+#else
+    ar = &arenas[0];
+    bp = alloc_block(ar, asize);
+#endif
     return bp;
 }
 
@@ -515,7 +895,10 @@ void *malloc (size_t size) {
  *      ptr: pointer of a memory block to be freed 
  */
 void free (void *ptr) {
-    size_t size;
+#ifdef MM_THREADED
+    slab_run_t *run;
+    arena_t *ar;
+#endif
 
     // check corner case 
     if (ptr == NULL) {
@@ -530,27 +913,39 @@ void free (void *ptr) {
 
     // check if the ptr is valid 
     if (!in_heap(ptr)){
+#ifdef MM_MMAP
+        if (is_mmapped(ptr)) {
+            mmap_free(ptr);
+            return;
+        }
+#endif
         fprintf(stderr, "Error, the addr to be free is invalid: %lx\n", \
         (long)ptr);
         return;
     }
 
-    size = get_size(get_header_ptr(ptr));
-
-    // begin free 
-    set_word_val(get_header_ptr(ptr), pack_size(size, 0));
-    set_word_val(get_footer_ptr(ptr), pack_size(size, 0));
-
-    // merge free memory, if any 
-    coalesce(ptr);
+#ifdef MM_THREADED
+    // small object to cache of this thread, without lock
+    if (NULL != (run = get_run(ptr)) && 0 == tcache_put(run, ptr)) {
+        return;
+    }
+    ar = lock_arena();
+    release_block(ar, ptr);
+    pthread_mutex_unlock(&ar->lock);
+#else
+    free_object(&arenas[0], ptr);
+#endif
 }
 
 /** 
  * @brief
  *      realloc a memory space with size byts for oldptr
  * @note
- *      1. will do memory content copy 
- *      2. old memory space will be freed
+ *      1. a slab object is kept if size is still in its class
+ *      2. a block is resized in place if possible, see resize_block,
+ *         a mmapped one is remapped if it's still large
+ *      3. otherwise will do memory content copy, and old memory space
+ *         will be freed
  * @param
  *      oldptr: pointer to old memory space 
  *      size: new size in terms of bytes to be allocated
@@ -562,6 +957,9 @@ void free (void *ptr) {
 void *realloc(void *oldptr, size_t size) {
     size_t oldsize;
     void *newptr;
+    slab_run_t *run;
+    arena_t *ar;
+    int resized;
     
     /* If size == 0 then this is just free, and we return NULL. */
     if(size == 0) {
@@ -573,6 +971,34 @@ void *realloc(void *oldptr, size_t size) {
     if(oldptr == NULL) {
         return malloc(size);
     }
+
+    /* Keep it in place if it fits */
+#ifdef MM_MMAP
+    if (is_mmapped(oldptr)) {
+        if (size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED) &&
+            NULL != (newptr = mmap_realloc(oldptr, size))) {
+            return newptr;
+        }
+    } else
+#endif
+    if (NULL != (run = get_run(oldptr))) {
+        if (size <= SLAB_MAX_SIZE && get_slab_class(size) == run->cls) {
+            return oldptr;
+        }
+    } else if (size <= SIZE_MASK - DSIZE) {
+#ifdef MM_THREADED
+        ar = lock_arena();
+        resized = get_arena_of(oldptr) == ar &&
+                  0 == resize_block(ar, oldptr, get_asize(size));
+        pthread_mutex_unlock(&ar->lock);
+#else
+        ar = &arenas[0];
+        resized = 0 == resize_block(ar, oldptr, get_asize(size));
+#endif
+        if (resized) {
+            return oldptr;
+        }
+    }
     
     newptr = malloc(size);
     
@@ -582,7 +1008,7 @@ void *realloc(void *oldptr, size_t size) {
     }
     
     /* Copy the old data. */
-    oldsize = get_size(get_header_ptr(oldptr));
+    oldsize = get_payload_size(oldptr);
     if(size < oldsize) oldsize = size;
     memcpy(newptr, oldptr, oldsize);
     
@@ -618,8 +1044,8 @@ void *calloc (size_t nmemb, size_t size) {
  *      check
  *      1. alignment
  *      2. if block is in heap
- *      3. if header is matched with footer
- *      4. if size >= MIN_BLK_SIZE (24)
+ *      3. if header is matched with footer, for a free block
+ *      4. if size >= MIN_BLK_SIZE (16)
  *      5. if two joint freed block because we coalesced immediately
  * @param
  *      block pointer to be checked 
@@ -642,14 +1068,17 @@ static void checkblock(void *bp)
     } 
 
     // check header/footer correctness
-    if (get_word_val(get_header_ptr(bp)) != get_word_val(get_footer_ptr(bp))){
+    if (!get_alloc(get_header_ptr(bp)) &&
+        (get_word_val(get_header_ptr(bp)) & ~PREV_ALLOC) != 
+         get_word_val(get_footer_ptr(bp))){
         printf("In function checkblock():");
 	printf("Error: block[%p] header does not match footer\n", bp);
     }
     
     // check if size >= MIN size 
     if (get_size(get_header_ptr(bp)) < MIN_BLK_SIZE){
-        if ( bp != heap_listp) {  // heap_listp can waive this check 
+        // prologue can waive this check 
+        if ( get_size(get_header_ptr(bp)) != DSIZE) {
             printf("In function checkblock():");
 	    printf("Error: block[%p] size is too small\n", bp);
 	}
@@ -676,7 +1105,9 @@ static void checkblock(void *bp)
  *      2. if block is in heap
  *      3. if block is freed
  *      4. if block fall to correct list 
+ *      5. if bitmaps tell whether list is empty
  * @param
+ *      ar: arena of the list
  *      list_index of free-list to be checked  
  * @attention
  *      will not terminate program when error encountered, just 
@@ -684,10 +1115,19 @@ static void checkblock(void *bp)
  * @ret
  *      number of frees blocks in this list
  */
-static size_t check_one_list(size_t list_index){
+static size_t check_one_list(arena_t *ar, size_t list_index){
     size_t list_size = 0;
-    char *bp = get_list_head_by_index(list_index);
+    char *bp = get_list_head_by_index(ar, list_index);
     char *bp_next;
+    size_t fl = list_index / SL_COUNT;
+    size_t sl = list_index % SL_COUNT;
+
+    // check bitmaps
+    if ((NULL != bp) != ((ar->sl_bitmap[fl] >> sl) & 1) ||
+        (0 != ar->sl_bitmap[fl]) != ((ar->fl_bitmap >> fl) & 1)) {
+        printf("In function check_one_list():");
+        printf("Error: bitmap of list[%zu] is wrong\n", list_index);
+    }
 
     // traverse the list from begin to end 
     for(; bp != NULL; bp = get_succ_ptr(bp)) {
@@ -727,17 +1167,110 @@ static size_t check_one_list(size_t list_index){
     return list_size;
 }
 
+/**
+ * @brief
+ *      check if a subtree of tree is valid
+ * @note
+ *      check for each node
+ *      1. if block is in heap, freed and big enough for tree
+ *      2. if it's ordered by address, between lo and hi
+ *      3. if max size of subtree is right
+ *      4. if priority isn't higher than its parent
+ * @param
+ *      bp: root of subtree
+ *      lo/hi: nodes of subtree should be between them
+ *      prio: priority of parent
+ * @attention
+ *      will not terminate program when error encountered, just
+ *      print error msg
+ * @ret
+ *      number of free blocks in this subtree
+ */
+static size_t check_tree(char *bp, char *lo, char *hi, unsigned int prio){
+    size_t max;
+
+    if (NULL == bp) {
+        return 0;
+    }
+    if (!in_heap(bp) || get_alloc(get_header_ptr(bp)) ||
+        get_size(get_header_ptr(bp)) < TREE_MIN_SIZE) {
+        printf("In function check_tree():");
+        printf("Error: block[%p] should not be in tree\n", bp);
+        return 1;
+    }
+    if (bp <= lo || bp >= hi || get_tree_prio(bp) > prio) {
+        printf("In function check_tree():");
+        printf("Error: block[%p] is out of order\n", bp);
+    }
+
+    max = get_tree_max(bp);
+    update_tree_max(bp);
+    if (max != get_tree_max(bp)) {
+        printf("In function check_tree():");
+        printf("Error: block[%p] has wrong max size\n", bp);
+    }
+
+    return 1 + check_tree(get_left_ptr(bp), lo, bp, get_tree_prio(bp)) + 
+           check_tree(get_right_ptr(bp), bp, hi, get_tree_prio(bp));
+}
+
+/**
+ * @brief
+ *      check if a run is valid
+ * @note
+ *      check
+ *      1. if run is big enough for its objects
+ *      2. if freed objects are in run and on object boundary
+ *      3. if freed and never used objects add up with used ones
+ * @param
+ *      run: the run to be checked
+ * @attention
+ *      will not terminate program when error encountered, just
+ *      print error msg
+ */
+static void check_run(slab_run_t *run) {
+    char *objs = (char *)run + sizeof(slab_run_t);
+    char *end = objs + run->nobj * run->obj_size;
+    unsigned int no_free = (end - run->unused) / run->obj_size;
+    char *bp;
+
+    if (run->obj_size != get_slab_size(run->cls) ||
+        end > (char *)run + get_size(get_header_ptr((char *)run)) - WSIZE ||
+        run->unused > end) {
+        printf("In function check_run():");
+        printf("Error: run[%p] has bad size or class\n", run);
+        return;
+    }
+
+    for (bp = run->free; bp != NULL; bp = *(char **)bp) {
+        if (bp < objs || bp >= end || (bp - objs) % run->obj_size) {
+            printf("In function check_run():");
+            printf("Error: run[%p] has bad object[%p]\n", run, bp);
+            return;
+        }
+        no_free++;
+    }
+
+    if (no_free + run->nused != run->nobj) {
+        printf("In function check_run():");
+        printf("Error: run[%p] objects mismatch\n", run);
+    }
+}
+
 /**
  * @brief
  *      check if current heap is valid or not
  *
- * Do following steps
- *      1. check prologue
- *      2. check if heap_listp if valid 
- *      3. start from heap_listp, check every block correctness 
- *         by calling checkblock(), also count number of freed blocks
- *      4. check epilogue
- *      5. examines all lists' correctness by calling check_one_list
+ * Do following steps for each chunk from heap_listp to end of heap
+ *      1. check arena index and prologue
+ *      2. check if prologue is valid 
+ *      3. start from prologue, check every block correctness 
+ *         by calling checkblock(), also count number of freed blocks,
+ *         check runs by check_run(), and prev-allocated bits
+ *      4. check epilogue, the next chunk begins after it
+ * and then
+ *      5. examines all lists' correctness by calling check_one_list,
+ *         and trees by check_tree
  *      6. examines if number of freed blocks are matched
  *
  * @param 
@@ -747,7 +1280,10 @@ static size_t check_one_list(size_t list_index){
  */
 int mm_checkheap(int verbose) {
     char *bp = heap_listp;
-    size_t i;
+    char *chunk;
+    unsigned int prev_alloc;
+    char *heap_end = (char *)mem_heap_hi() + 1;
+    size_t i, j;
     // number of free blocks by checking whole heap
     size_t no_free_blk_count_by_whole_heap = 0;  
     // number of free blocks by checking each lists
@@ -757,36 +1293,58 @@ int mm_checkheap(int verbose) {
     if (verbose)
 	printf("Heap (%p):\n", heap_listp);
 
-    // check prologue
-    if (get_size(get_header_ptr(heap_listp)) != DSIZE || \
-        !get_alloc(get_header_ptr(heap_listp))){
-        printf("Bad prologue header\n");
-        return 1;
-    }
+    for (chunk = heap_listp - DSIZE; chunk < heap_end; chunk = bp) {
+        bp = chunk + DSIZE;
+
+        // check arena index and prologue
+        if (get_word_val((unsigned int *)chunk) >= no_of_arena) {
+            printf("Bad arena index of chunk %p\n", chunk);
+            return 1;
+        }
+        if (get_size(get_header_ptr(bp)) != DSIZE || \
+            !get_alloc(get_header_ptr(bp))){
+            printf("Bad prologue header\n");
+            return 1;
+        }
     
-    // check if heap_listp is valid
-    checkblock(heap_listp);
-
-    // from heap_listp to the end of heap,
-    // check each following blocks' correctness
-    for ( bp = heap_listp; get_size(get_header_ptr(bp)) > 0; \
-          bp = get_next_blk_ptr(bp)){
-        checkblock(bp); 
-        if (!get_alloc(get_header_ptr(bp))){
-            no_free_blk_count_by_whole_heap++;
+        // check if prologue is valid
+        checkblock(bp);
+
+        // from prologue to the end of chunk,
+        // check each following blocks' correctness
+        for (prev_alloc = PREV_ALLOC; get_size(get_header_ptr(bp)) > 0; \
+              bp = get_next_blk_ptr(bp)){
+            checkblock(bp); 
+            if (bp != chunk + DSIZE && 
+                get_prev_alloc(get_header_ptr(bp)) != prev_alloc) {
+                printf("Error: block[%p] has wrong prev-allocated bit\n", bp);
+            }
+            prev_alloc = get_alloc(get_header_ptr(bp)) ? PREV_ALLOC : 0;
+            if (!get_alloc(get_header_ptr(bp))){
+                no_free_blk_count_by_whole_heap++;
+            } else if ((char *)get_run(bp) == bp) {
+                check_run((slab_run_t *)bp);
+            }
+        }
+        if (get_prev_alloc(get_header_ptr(bp)) != prev_alloc) {
+            printf("Error: epilogue[%p] has wrong prev-allocated bit\n", bp);
         }
-    }
    
-    // check epilogue
-    if ((get_size(get_header_ptr(bp)) != 0) || \
-        !get_alloc(get_header_ptr(bp))){
-   	printf("Bad epilogue header\n");
-        return 1; 
+        // check epilogue
+        if ((get_size(get_header_ptr(bp)) != 0) || \
+            !get_alloc(get_header_ptr(bp))){
+   	    printf("Bad epilogue header\n");
+            return 1; 
+        }
     }
 
     // begin to check lists
-    for ( i = 0; i < NO_OF_SIZE_TYPE; i++){ 
-        no_free_blk_count_by_lists += check_one_list(i);
+    for ( j = 0; j < no_of_arena; j++){ 
+        for ( i = 0; i < NO_OF_LIST; i++){ 
+            no_free_blk_count_by_lists += check_one_list(&arenas[j], i);
+        }
+        no_free_blk_count_by_lists += check_tree(arenas[j].tree_root, NULL,
+                                                 heap_end, ~0u);
     }
 
     // check if free blk counts equal by two approaches
@@ -801,58 +1359,898 @@ int mm_checkheap(int verbose) {
 
 /**
  * @brief
- *      Extend heap withe free block and return its block pointer
- * 1. Call mem_sbrk to extend heap 
- * 2. The extended space will be formed as a new freed block 
- * 3. call coalesce() to see if can be merged, note that coalesce 
- *    function will then insert block to target list by its size
- *
- * @param 
- *      words: size to be extended in terms of bytes
+ *      Allocate a block of asize bytes from free lists or extended heap
+ * @note
+ *      lock of arena should be held in MM_THREADED
+ * @param
+ *      ar: the arena
+ *      asize: adjusted block size
  * @ret
- *      smallest pointer of available(freed) block 
- *      NULL if heap extension failed 
+ *      NULL if heap extension failed
+ *      valid block pointer if success
  */
-static void *extend_heap(size_t words){
-    char *bp; 
-    size_t size;
+static void *alloc_block(arena_t *ar, size_t asize) {
+    size_t extendsize; /// Amount to extend heap if no fit 
+    char *bp;
 
-    // adjust size to meet alignment requirement 
-    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE; 
-    if ((bp = mem_sbrk(size)) == (void *)-1) {
-	return NULL;                 
+#ifndef MM_THREADED
+    checkheap(0);      // Let's make sure the heap is ok!
+#endif
+
+    // search by placement policy
+    if ( NULL != (bp = find_fit(ar, asize))) {
+        place (ar, bp, asize);
+        return bp;
     }
-    
+
+    // if not fit, get more memory
+    extendsize = ( asize > CHUNKSIZE ) ? asize : CHUNKSIZE;
+#ifdef MM_THREADED
+    // big chunks, so arenas rarely share a cache line
+    if ( extendsize < ARENA_CHUNKSIZE ) {
+        extendsize = ARENA_CHUNKSIZE;
+    }
+#endif
+    // get memory failed
+    if ( NULL == ( bp = extend_heap(ar, extendsize/WSIZE))){
+        return NULL;
+    }
+   
+    // get extended memory, place and return 
+    place(ar, bp, asize);
+    
+    return bp;
+}
+
+/**
+ * @brief
+ *      Return an allocated block to free lists, release pages of the
+ *      merged block if it's time to trim
+ * @note
+ *      lock of arena should be held in MM_THREADED
+ * @param
+ *      ar: arena of the block
+ *      bp: block pointer to be freed
+ */
+static void free_block(arena_t *ar, void *bp) {
+    size_t size = get_size(get_header_ptr(bp));
+
+    // begin free 
+    set_word_val(get_header_ptr(bp), pack_size(size, 0) | 
+                 get_prev_alloc(get_header_ptr(bp)));
+    set_word_val(get_footer_ptr(bp), pack_size(size, 0));
+
+    // merge free memory, if any 
+    bp = coalesce(ar, bp);
+
+    count_freed(ar, bp, size);
+}
+
+/**
+ * @brief
+ *      count bytes freed into a free block, and trim the block if
+ *      enough of arena is freed since last trim
+ * @note
+ *      lock of arena should be held in MM_THREADED
+ * @param
+ *      ar: arena of the block
+ *      bp: the free block, after coalesce
+ *      size: bytes just freed in it
+ */
+static void count_freed(arena_t *ar, char *bp, size_t size) {
+    ar->freed += size;
+    if (ar->freed >= __atomic_load_n(&trim_threshold, __ATOMIC_RELAXED) && 
+        ar->freed >= ar->heap_size / 2 &&
+        get_size(get_header_ptr(bp)) >= TRIM_MIN_SIZE) {
+        trim_block(ar, bp);
+    }
+}
+
+/**
+ * @brief
+ *      release pages of a free block to OS, except its header, links
+ *      (or tree node) and footer
+ * @note
+ *      lock of arena should be held in MM_THREADED
+ * @param
+ *      ar: arena of the block
+ *      bp: the free block
+ */
+static void trim_block(arena_t *ar, char *bp) {
+    uintptr_t start = (uintptr_t)bp + 3*DSIZE;
+    uintptr_t end = (uintptr_t)get_footer_ptr(bp);
+
+    start = (start + page_size - 1) & ~(uintptr_t)(page_size - 1);
+    end &= ~(uintptr_t)(page_size - 1);
+    if (end > start) {
+        madvise((void *)start, end - start, MADV_DONTNEED);
+    }
+    ar->freed = 0;
+}
+
+/**
+ * @brief
+ *      Resize an allocated block in place
+ * @note
+ *      1. shrink it, the rest is split as a free block if it's big
+ *         enough, and counted as freed like free_block does
+ *      2. grow it by taking free block after it. If it's the last
+ *         block of heap, or only a free block is after it, heap is
+ *         extended first
+ *      lock of arena should be held in MM_THREADED
+ * @param
+ *      ar: arena of the block
+ *      bp: the block
+ *      asize: adjusted block size
+ * @ret
+ *      0 if resized, -1 if it should be moved
+ */
+static int resize_block(arena_t *ar, void *bp, size_t asize) {
+    size_t size = get_size(get_header_ptr(bp));
+    size_t oldsize = size;
+    char *next = get_next_blk_ptr(bp);
+    size_t extendsize;
+    unsigned int prev_alloc;
+
+#ifndef MM_THREADED
+    checkheap(0);
+#endif
+
+    if (asize > size) {
+        if (!get_alloc(get_header_ptr(next))) {
+            size += get_size(get_header_ptr(next));
+            next = get_next_blk_ptr(next);
+        }
+        // nothing but free space to top of heap, get more
+        if (size < asize && next == ar->heap_end && 
+            next == (char *)mem_heap_hi() + 1) {
+            extendsize = ( asize - size > CHUNKSIZE ) ? 
+                         asize - size : CHUNKSIZE;
+            extend_heap(ar, extendsize/WSIZE);
+        }
+
+        // free block after it, a new chunk may be made instead by
+        // another arena growing heap meanwhile
+        next = get_next_blk_ptr(bp);
+        size = get_size(get_header_ptr(bp));
+        if (get_alloc(get_header_ptr(next)) || 
+            size + get_size(get_header_ptr(next)) < asize) {
+            return -1;
+        }
+        size += get_size(get_header_ptr(next));
+        remove_from_list(ar, next);
+    }
+
+    prev_alloc = get_prev_alloc(get_header_ptr(bp));
+    if ((size - asize) >= (MIN_BLK_SIZE)){ // can be split
+        set_word_val(get_header_ptr(bp), pack_alloc(ar, asize) | prev_alloc);
+        next = get_next_blk_ptr(bp);
+        set_word_val(get_header_ptr(next), 
+                     pack_size(size - asize, 0) | PREV_ALLOC);
+        set_word_val(get_footer_ptr(next), pack_size(size - asize, 0));
+        next = coalesce(ar, next);
+        if (asize < oldsize) {
+            count_freed(ar, next, oldsize - asize);   // shrunk
+        }
+    } else {
+        set_word_val(get_header_ptr(bp), pack_alloc(ar, size) | prev_alloc);
+        set_prev_alloc(get_next_blk_ptr(bp), PREV_ALLOC);
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      set or clear bit of a run in run_map, the map is doubled if
+ *      it doesn't cover the run
+ * @note
+ *      lock of arena should be held in MM_THREADED. The old map is
+ *      kept, a thread may be reading it
+ * @param
+ *      ar: arena of the run
+ *      run: the run
+ *      set: 1 to set, 0 to clear
+ * @ret
+ *      0 if OK, -1 if heap is out of memory for a bigger map
+ */
+static int set_run_map(arena_t *ar, void *run, int set) {
+    uintptr_t base = (uintptr_t)mem_heap_lo() & ~(uintptr_t)(RUN_SIZE - 1);
+    size_t i = ((uintptr_t)run - base) / RUN_SIZE;
+    size_t bytes = RUN_MAP_MIN;
+    char *map = NULL;
+
+    // a bigger map, it's allocated before taking sbrk_lock
+    if (NULL == run_map || i >= *(size_t *)run_map) {
+        while (bytes * 8 <= i) {
+            bytes *= 2;
+        }
+        map = alloc_block(ar, get_asize(sizeof(size_t) + bytes));
+        if (NULL == map) {
+            return -1;
+        }
+    }
+
+#ifdef MM_THREADED
+    pthread_mutex_lock(&sbrk_lock);
+#endif
+    if (NULL != map && (NULL == run_map || i >= *(size_t *)run_map)) {
+        memset(map, 0, sizeof(size_t) + bytes);
+        if (NULL != run_map) {
+            memcpy(map + sizeof(size_t), run_map + sizeof(size_t),
+                   *(size_t *)run_map / 8);
+        }
+        *(size_t *)map = bytes * 8;
+        __atomic_store_n(&run_map, map, __ATOMIC_RELEASE);
+        map = NULL;
+    }
+    if (set) {
+        __atomic_fetch_or(&run_map[sizeof(size_t) + i / 8], 1 << (i % 8),
+                          __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(&run_map[sizeof(size_t) + i / 8], ~(1 << (i % 8)),
+                           __ATOMIC_RELAXED);
+    }
+#ifdef MM_THREADED
+    pthread_mutex_unlock(&sbrk_lock);
+#endif
+
+    // another arena made a big enough map
+    if (NULL != map) {
+        free_block(ar, map);
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      given a free block, return where an aligned run can be placed
+ *      in it, leaving a block or nothing before it
+ * @ret
+ *      NULL if the run doesn't fit
+ *      address of run
+ */
+static char *get_run_place(char *bp) {
+    char *run = (char *)(((uintptr_t)bp + (RUN_SIZE-1)) & 
+                         ~(uintptr_t)(RUN_SIZE-1));
+
+    if (run != bp && run - bp < MIN_BLK_SIZE) {
+        run += RUN_SIZE;
+    }
+    if (run - bp + RUN_SIZE > get_size(get_header_ptr(bp))) {
+        return NULL;
+    }
+    return run;
+}
+
+/**
+ * @brief
+ *      Find a free block which can hold an aligned run, or extend
+ *      heap for it
+ * @note
+ *      1. first fit from lists from RUN_SIZE, or block of lowest
+ *         address in tree
+ *      2. if not found, take the free block at top of arena if it
+ *         holds a run, or extend heap so it just holds one. If another
+ *         thread moved heap top in the meantime, extend again by a
+ *         size which always holds a run
+ * @param
+ *      ar: the arena
+ *      run: address of run in the block is stored here
+ * @ret
+ *      NULL if heap is out of memory
+ *      the free block
+ */
+static char *find_run_fit(arena_t *ar, char **run) {
+    char *heap_end = (char *)mem_heap_hi() + 1;
+    char *bp, *end;
+    size_t i;
+
+    for (i = get_list_index_by_size(RUN_SIZE); i < NO_OF_LIST; i++) {
+        for (bp = get_list_head_by_index(ar, i); bp != NULL; 
+             bp = get_succ_ptr(bp)) {
+            if (NULL != (*run = get_run_place(bp))) {
+                return bp;
+            }
+        }
+    }
+    if ((NULL != (bp = tree_find(ar->tree_root, RUN_SIZE)) &&
+         NULL != (*run = get_run_place(bp))) ||
+        (NULL != (bp = tree_find(ar->tree_root, 2*RUN_SIZE + MIN_BLK_SIZE)) &&
+         NULL != (*run = get_run_place(bp)))) {
+        return bp;
+    }
+
+    // where the extended free block will begin and end, without size
+    if (ar->heap_end == heap_end) {
+        // epilogue becomes header, it's merged with a free block before
+        bp = ar->heap_end;
+        if (!get_prev_alloc(get_header_ptr(bp))) {
+            bp -= get_size((unsigned int *)(bp - DSIZE));
+        }
+        end = ar->heap_end - WSIZE;
+    } else {
+        bp = heap_end + 2*DSIZE;
+        end = bp - WSIZE;
+    }
+    *run = (char *)(((uintptr_t)bp + (RUN_SIZE-1)) & ~(uintptr_t)(RUN_SIZE-1));
+    if (*run != bp && *run - bp < MIN_BLK_SIZE) {
+        *run += RUN_SIZE;
+    }
+    if (*run + RUN_SIZE - WSIZE <= end) {
+        return bp;   // it holds one already, never extend by 0
+    }
+
+    if (NULL != (bp = extend_heap(ar, (*run + RUN_SIZE - WSIZE - end) / WSIZE)) 
+        && NULL == (*run = get_run_place(bp))) {
+        bp = extend_heap(ar, (2*RUN_SIZE + MIN_BLK_SIZE) / WSIZE);
+        if (NULL != bp) {
+            *run = get_run_place(bp);
+        }
+    }
+    return bp;
+}
+
+/**
+ * @brief
+ *      make a new run of a class and put it to list of its arena
+ * @note
+ *      1. find a free block which can hold an aligned run
+ *      2. split space before and after the run as free blocks, if it's
+ *         big enough
+ *      3. set bit of run in run_map
+ * @param
+ *      ar: the arena
+ *      cls: slab class
+ * @ret
+ *      NULL if heap is out of memory
+ *      the new run
+ */
+static slab_run_t *new_run(arena_t *ar, unsigned int cls) {
+    char *bp, *run;
+    size_t size, lead, tail;
+    slab_run_t *r;
+
+    if (NULL == (bp = find_run_fit(ar, &run))) {
+        return NULL;
+    }
+    size = get_size(get_header_ptr(bp));
+    remove_from_list(ar, bp);
+
+    lead = run - bp;
+    tail = size - lead - RUN_SIZE;
+    if (tail < MIN_BLK_SIZE) {
+        tail = 0;
+    }
+    if (lead > 0) {
+        set_word_val(get_header_ptr(bp), pack_size(lead, 0) | PREV_ALLOC);
+        set_word_val(get_footer_ptr(bp), pack_size(lead, 0));
+        list_push_front(ar, bp);
+    }
+    set_word_val(get_header_ptr(run), pack_alloc(ar, size - lead - tail) |
+                 (lead > 0 ? 0 : PREV_ALLOC));
+    bp = get_next_blk_ptr(run);
+    if (tail > 0) {
+        set_word_val(get_header_ptr(bp), pack_size(tail, 0) | PREV_ALLOC);
+        set_word_val(get_footer_ptr(bp), pack_size(tail, 0));
+        list_push_front(ar, bp);
+    } else {
+        set_prev_alloc(bp, PREV_ALLOC);
+    }
+
+    if (set_run_map(ar, run, 1)) {
+        free_block(ar, run);
+        return NULL;
+    }
+
+    r = (slab_run_t *)run;
+    r->obj_size = get_slab_size(cls);
+    r->cls = cls;
+    r->nobj = (RUN_SIZE - WSIZE - sizeof(slab_run_t)) / r->obj_size;
+    r->nused = 0;
+    r->free = NULL;
+    r->unused = run + sizeof(slab_run_t);
+    r->prev = NULL;
+    r->next = ar->slab_runs[cls];
+    if (NULL != r->next) {
+        r->next->prev = r;
+    }
+    ar->slab_runs[cls] = r;
+    return r;
+}
+
+/**
+ * @brief
+ *      take an object of a class from first run of its list, a full
+ *      run leaves the list
+ * @note
+ *      lock of arena should be held in MM_THREADED
+ * @param
+ *      ar: the arena
+ *      cls: slab class
+ * @ret
+ *      NULL if heap is out of memory for a new run
+ *      the object
+ */
+static void *slab_alloc(arena_t *ar, unsigned int cls) {
+    slab_run_t *run = ar->slab_runs[cls];
+    char *bp;
+
+    if (NULL == run && NULL == (run = new_run(ar, cls))) {
+        return NULL;
+    }
+
+    if (NULL != run->free) {
+        bp = run->free;
+        run->free = *(char **)bp;
+    } else {
+        bp = run->unused;
+        run->unused += run->obj_size;
+    }
+
+    if (++run->nused == run->nobj) {
+        ar->slab_runs[cls] = run->next;
+        if (NULL != run->next) {
+            run->next->prev = NULL;
+        }
+    }
+    return bp;
+}
+
+/**
+ * @brief
+ *      return an object to its run, a full run joins list again, an
+ *      empty run goes back to heap unless it's the only one in list
+ * @note
+ *      lock of arena should be held in MM_THREADED
+ * @param
+ *      ar: arena of the run
+ *      run: run of the object
+ *      bp: the object
+ */
+static void slab_free(arena_t *ar, slab_run_t *run, void *bp) {
+    *(char **)bp = run->free;
+    run->free = bp;
+
+    if (run->nused-- == run->nobj) {
+        run->prev = NULL;
+        run->next = ar->slab_runs[run->cls];
+        if (NULL != run->next) {
+            run->next->prev = run;
+        }
+        ar->slab_runs[run->cls] = run;
+    }
+
+    if (0 == run->nused && (NULL != run->prev || NULL != run->next)) {
+        if (NULL != run->prev) {
+            run->prev->next = run->next;
+        } else {
+            ar->slab_runs[run->cls] = run->next;
+        }
+        if (NULL != run->next) {
+            run->next->prev = run->prev;
+        }
+        set_run_map(ar, run, 0);
+        free_block(ar, run);
+    }
+}
+
+/**
+ * @brief
+ *      free a slab object or a block of arena
+ * @note
+ *      lock of arena should be held in MM_THREADED
+ * @param
+ *      ar: arena of the object or block
+ *      bp: the object or block
+ */
+static void free_object(arena_t *ar, void *bp) {
+    slab_run_t *run = get_run(bp);
+
+    if (NULL != run) {
+        slab_free(ar, run, bp);
+    } else {
+        free_block(ar, bp);
+    }
+}
+
+#ifdef MM_MMAP
+/**
+ * @brief
+ *      mmap a block for a large request
+ * @param
+ *      size: bytes of payload
+ * @ret
+ *      NULL if mmap failed
+ *      the block
+ */
+static void *mmap_alloc(size_t size) {
+    size_t len = (size + MMAP_HDR_SIZE + page_size - 1) & ~(page_size - 1);
+    char *p;
+
+    if (len < size) {
+        return NULL;   // wrapped around
+    }
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, 
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    *(size_t *)p = len;
+    p += MMAP_HDR_SIZE;
+    *(unsigned int *)(p - WSIZE) = pack_size(0, 1) | MMAPPED;
+    return p;
+}
+
+/**
+ * @brief
+ *      munmap a mmapped block, raise threshold to its size so
+ *      requests of this size go to heap later, and trim_threshold to
+ *      twice of it
+ * @param
+ *      bp: the block
+ */
+static void mmap_free(void *bp) {
+    size_t len = get_mmap_len(bp);
+
+    if (len - MMAP_HDR_SIZE > __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED)
+        && len - MMAP_HDR_SIZE <= MMAP_THRESHOLD_MAX) {
+        __atomic_store_n(&mmap_threshold, len - MMAP_HDR_SIZE, 
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&trim_threshold, 2 * (len - MMAP_HDR_SIZE),
+                         __ATOMIC_RELAXED);
+    }
+    munmap((char *)bp - MMAP_HDR_SIZE, len);
+}
+
+/**
+ * @brief
+ *      resize a mmapped block by mremap, it may move
+ * @param
+ *      bp: the block
+ *      size: new bytes of payload
+ * @ret
+ *      NULL if mremap failed, bp is untouched
+ *      the block
+ */
+static void *mmap_realloc(void *bp, size_t size) {
+    size_t len = get_mmap_len(bp);
+    size_t new_len = (size + MMAP_HDR_SIZE + page_size - 1) & ~(page_size - 1);
+    char *p;
+
+    if (new_len < size) {
+        return NULL;   // wrapped around
+    }
+    if (new_len == len) {
+        return bp;
+    }
+    p = mremap((char *)bp - MMAP_HDR_SIZE, len, new_len, MREMAP_MAYMOVE);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    *(size_t *)p = new_len;
+    return p + MMAP_HDR_SIZE;
+}
+#endif
+
+#ifdef MM_THREADED
+/**
+ * @brief
+ *      get arena of calling thread, which is the arena of cpu it's
+ *      running on at first call, or when heap is initialized again
+ */
+static arena_t *get_arena(void) {
+    int cpu;
+
+    if (NULL == thread_arena || arena_epoch != heap_epoch) {
+        if ((cpu = sched_getcpu()) < 0) {
+            cpu = 0;
+        }
+        thread_arena = &arenas[cpu % no_of_arena];
+        arena_epoch = heap_epoch;
+    }
+    return thread_arena;
+}
+
+/**
+ * @brief
+ *      lock arena of calling thread, and free blocks other threads
+ *      returned to it
+ * @note
+ *      if the lock is busy, the thread may be moved to another cpu,
+ *      so it moves to the arena of its current cpu
+ * @ret
+ *      the locked arena
+ */
+static arena_t *lock_arena(void) {
+    arena_t *ar = get_arena();
+    char *bp, *next;
+    int cpu;
+
+    if (pthread_mutex_trylock(&ar->lock)) {
+        if ((cpu = sched_getcpu()) < 0) {
+            cpu = 0;
+        }
+        ar = thread_arena = &arenas[cpu % no_of_arena];
+        pthread_mutex_lock(&ar->lock);
+    }
+
+    if (NULL != __atomic_load_n(&ar->remote_free, __ATOMIC_RELAXED)) {
+        bp = __atomic_exchange_n(&ar->remote_free, NULL, __ATOMIC_ACQUIRE);
+        for (; NULL != bp; bp = next) {
+            next = *(char **)bp;
+            free_object(ar, bp);
+        }
+    }
+    return ar;
+}
+
+/**
+ * @brief
+ *      return an allocated block or slab object to its arena, one of
+ *      another arena is pushed to remote_free of that arena without
+ *      its lock
+ * @note
+ *      lock of ar should be held
+ * @param
+ *      ar: arena of calling thread
+ *      bp: block or object pointer to be freed
+ */
+static void release_block(arena_t *ar, void *bp) {
+    arena_t *owner = get_arena_of(bp);
+    char *head;
+
+    if (owner == ar) {
+        free_object(ar, bp);
+        return;
+    }
+
+    head = __atomic_load_n(&owner->remote_free, __ATOMIC_RELAXED);
+    do {
+        *(char **)bp = head;
+    } while (!__atomic_compare_exchange_n(&owner->remote_free, &head, bp, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief
+ *      called when a thread with a cache exits, return its blocks
+ * @param
+ *      tc: cache of the thread
+ */
+static void tcache_exit(void *tc) {
+    arena_t *ar;
+    size_t i;
+
+    if (tcache_epoch == heap_epoch) { // or heap is gone with its blocks
+        ar = lock_arena();
+        for (i = 0; i < NO_OF_SLAB_CLASS; i++) {
+            tcache_flush(ar, tc, i, ((tcache_t *)tc)->count[i]);
+        }
+        release_block(ar, tc);
+        pthread_mutex_unlock(&ar->lock);
+    }
+    tcache = NULL;
+}
+
+/**
+ * @brief
+ *      create the key to know when a thread exits, called once
+ */
+static void tcache_create_key(void) {
+    pthread_key_create(&tcache_key, tcache_exit);
+}
+
+/**
+ * @brief
+ *      get cache of calling thread, create it at first use or when
+ *      heap is initialized again
+ * @ret
+ *      NULL if heap is out of memory
+ *      cache of calling thread
+ */
+static tcache_t *get_tcache(void) {
+    arena_t *ar;
+    size_t asize = get_asize(sizeof(tcache_t));
+
+    if (NULL != tcache && tcache_epoch == heap_epoch) {
+        return tcache;
+    }
+
+    pthread_once(&tcache_once, tcache_create_key);
+    ar = lock_arena();
+    if (NULL != (tcache = alloc_block(ar, asize))) {
+        memset(tcache, 0, sizeof(tcache_t));
+        tcache_epoch = heap_epoch;
+    }
+    pthread_mutex_unlock(&ar->lock);
+    pthread_setspecific(tcache_key, tcache);
+    return tcache;
+}
+
+/**
+ * @brief
+ *      take an object from cache of calling thread, refill its bin
+ *      from runs if it's empty
+ * @param
+ *      cls: slab class
+ * @ret
+ *      NULL if cache or heap is out of memory
+ *      the object if success
+ */
+static void *tcache_get(unsigned int cls) {
+    tcache_t *tc = get_tcache();
+    size_t i = cls;
+    arena_t *ar;
+    char *bp;
+
+    if (NULL == tc) {
+        return NULL;
+    }
+
+    if (0 == tc->count[i]) {
+        ar = lock_arena();
+        while (tc->count[i] < TCACHE_FILL && 
+               NULL != (bp = slab_alloc(ar, cls))) {
+            *(char **)bp = tc->bin[i];
+            tc->bin[i] = bp;
+            tc->count[i]++;
+        }
+        pthread_mutex_unlock(&ar->lock);
+        if (0 == tc->count[i]) {
+            return NULL;
+        }
+    }
+
+    bp = tc->bin[i];
+    tc->bin[i] = *(char **)bp;
+    tc->count[i]--;
+    return bp;
+}
+
+/**
+ * @brief
+ *      put a freed object to cache of calling thread, flush half of
+ *      its bin to runs if it's full
+ * @param
+ *      run: run of the object
+ *      bp: the object
+ * @ret
+ *      0 if cached, -1 if there's no cache
+ */
+static int tcache_put(slab_run_t *run, void *bp) {
+    size_t i = run->cls;
+    arena_t *ar;
+    tcache_t *tc;
+
+    if (NULL == (tc = get_tcache())) {
+        return -1;
+    }
+
+    if (tc->count[i] >= TCACHE_BIN_MAX) {
+        ar = lock_arena();
+        tcache_flush(ar, tc, i, TCACHE_BIN_MAX / 2);
+        pthread_mutex_unlock(&ar->lock);
+    }
+
+    *(char **)bp = tc->bin[i];
+    tc->bin[i] = bp;
+    tc->count[i]++;
+    return 0;
+}
+
+/**
+ * @brief
+ *      return first n objects of a bin to their arenas
+ * @note
+ *      lock of ar should be held
+ * @param
+ *      ar: arena of calling thread
+ *      tc: the cache
+ *      index: index of bin
+ *      n: number of objects, count of bin at most
+ */
+static void tcache_flush(arena_t *ar, tcache_t *tc, size_t index,
+                         unsigned int n) {
+    char *bp;
+
+    for (; n > 0; n--) {
+        bp = tc->bin[index];
+        tc->bin[index] = *(char **)bp;
+        tc->count[index]--;
+        release_block(ar, bp);
+    }
+}
+#endif
+
+/**
+ * @brief
+ *      Extend an arena withe free block and return its block pointer
+ * 1. Call mem_sbrk to extend heap 
+ * 2. If last chunk of arena is at top of heap, its epilogue becomes
+ *    header of the extended space, otherwise the space is a new chunk
+ *    with arena index and prologue before it
+ * 3. The extended space will be formed as a new freed block 
+ * 4. call coalesce() to see if can be merged, note that coalesce 
+ *    function will then insert block to target list by its size
+ *    and clear prev-allocated bit of epilogue
+ *
+ * @param 
+ *      ar: the arena
+ *      words: size to be extended in terms of words
+ * @ret
+ *      smallest pointer of available(freed) block 
+ *      NULL if heap extension failed 
+ */
+static void *extend_heap(arena_t *ar, size_t words){
+    char *bp; 
+    size_t size;
+    unsigned int prev_alloc = PREV_ALLOC;
+
+    // adjust size to meet alignment requirement 
+    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE; 
+
+#ifdef MM_THREADED
+    pthread_mutex_lock(&sbrk_lock);
+#endif
+    if (NULL != ar->heap_end && ar->heap_end == (char *)mem_heap_hi() + 1) {
+        bp = mem_sbrk(size);
+        if (bp != (void *)-1) {
+            prev_alloc = get_prev_alloc(get_header_ptr(bp));
+        }
+    } else if ((bp = mem_sbrk(size + 4*WSIZE)) != (void *)-1) {
+        // init arena index and Prologue of new chunk
+        set_word_val((unsigned int *)bp, ar->index);
+        bp += WSIZE;                                // Prologue header 
+        set_word_val((unsigned int *)bp, pack_size(DSIZE, 1));    
+        bp += WSIZE;                                // Prologue footer  
+        set_word_val((unsigned int *)bp, pack_size(DSIZE, 1));    
+        if (NULL == ar->heap_listp) {
+            ar->heap_listp = bp;
+        }
+        bp += DSIZE;                                // first block
+    }
+#ifdef MM_THREADED
+    pthread_mutex_unlock(&sbrk_lock);
+#endif
+    if (bp == (void *)-1) {
+	return NULL;                 
+    }
+    
     /* now we have a fresh space without init, hence, init to let 
        memory allocate can recognize */   
     // init header for free block 
-    set_word_val(get_header_ptr(bp), pack_size(size, 0));
+    set_word_val(get_header_ptr(bp), pack_size(size, 0) | prev_alloc);
     // init footer for free block 
     set_word_val(get_footer_ptr(bp), pack_size(size, 0));
     // init epilogue header
     set_word_val(get_header_ptr(get_next_blk_ptr(bp)), pack_size(0, 1));
+    ar->heap_end = get_next_blk_ptr(bp);
+    ar->heap_size += size;
 
     /* Coalesce if the previous block was free */   
-    return coalesce(bp);
+    return coalesce(ar, bp);
 }
 
 /**
  * @brief 
  *      Boundary tag coalescing. Return ptr to coalesced block
  * 
- * 1. Follow text book to do the merge
+ * 1. Follow text book to do the merge, previous block is found by
+ *    its footer only if prev-allocated bit is clear
  * 2. after merged, insert to front of a specific list
+ * 3. clear prev-allocated bit of next block
  *
  * @note 
  *      See fig. 9.40 in p. 860 for each case's definition
  *      also do linked-list node add/remove handeling
  * @param 
+ *      ar: arena of the block
  *      bp: pointer of input block to be coalesced
  * @ret
  *      a new valid ptr after coalesced
  */
-static void *coalesce(void *bp) {
-    size_t prev_alloc = get_alloc(get_footer_ptr(get_prev_blk_ptr(bp)));
+static void *coalesce(arena_t *ar, void *bp) {
+    size_t prev_alloc = get_prev_alloc(get_header_ptr(bp));
     size_t next_alloc = get_alloc(get_header_ptr(get_next_blk_ptr(bp)));
     size_t size = get_size(get_header_ptr(bp));
 
@@ -860,78 +2258,136 @@ static void *coalesce(void *bp) {
         ; // do nothing
     } else if (prev_alloc && !next_alloc) {     // case 2
         size += get_size(get_header_ptr(get_next_blk_ptr(bp)));
-        remove_from_list(get_next_blk_ptr(bp));
-        set_word_val(get_header_ptr(bp), pack_size(size, 0));
+        remove_from_list(ar, get_next_blk_ptr(bp));
+        set_word_val(get_header_ptr(bp), pack_size(size, 0) | PREV_ALLOC);
         set_word_val(get_footer_ptr(bp), pack_size(size, 0));
     } else if (!prev_alloc && next_alloc) {     // case 3
-        remove_from_list(get_prev_blk_ptr(bp));
+        remove_from_list(ar, get_prev_blk_ptr(bp));
         size += get_size(get_header_ptr(get_prev_blk_ptr(bp)));
         set_word_val(get_footer_ptr(bp), pack_size(size, 0));
         bp = get_prev_blk_ptr(bp);
-        set_word_val(get_header_ptr(bp), pack_size(size, 0));
+        set_word_val(get_header_ptr(bp), pack_size(size, 0) | PREV_ALLOC);
     } else { //  !prev_alloc && !next_alloc     // case 4
-        remove_from_list(get_next_blk_ptr(bp));
-        remove_from_list(get_prev_blk_ptr(bp));
+        remove_from_list(ar, get_next_blk_ptr(bp));
+        remove_from_list(ar, get_prev_blk_ptr(bp));
         size += get_size(get_header_ptr(get_next_blk_ptr(bp)));
         size += get_size(get_header_ptr(get_prev_blk_ptr(bp)));
         set_word_val(get_footer_ptr(get_next_blk_ptr(bp)), \
                      pack_size(size, 0));
         bp = get_prev_blk_ptr(bp);
-        set_word_val(get_header_ptr(bp), pack_size(size, 0));
+        set_word_val(get_header_ptr(bp), pack_size(size, 0) | PREV_ALLOC);
     }
 
-    list_push_front(bp);
+    // next block follows a free one now
+    set_prev_alloc(get_next_blk_ptr(bp), 0);
+    list_push_front(ar, bp);
     return bp;
 }
 
 /**
  * @brief
- *      Find next free & big enough space's ptr 
+ *      Find first non-empty list from list_index by bitmaps
+ * @ret
+ *      NO_OF_LIST if all lists from list_index are empty
+ *      index of the list
+ */
+static size_t find_list_from(arena_t *ar, size_t list_index) {
+    unsigned int fl, fl_map, sl_map;
+
+    if (list_index >= NO_OF_LIST) {
+        return NO_OF_LIST;
+    }
+    fl = list_index / SL_COUNT;
+    sl_map = ar->sl_bitmap[fl] & (~0u << (list_index % SL_COUNT));
+    if (0 == sl_map) {
+        fl_map = ar->fl_bitmap & (~0u << (fl + 1));
+        if (0 == fl_map) {
+            return NO_OF_LIST;
+        }
+        fl = __builtin_ctz(fl_map);
+        sl_map = ar->sl_bitmap[fl];
+    }
+    return fl * SL_COUNT + __builtin_ctz(sl_map);
+}
+
+/**
+ * @brief
+ *      Find first or smallest block which fits by walking lists
  * @note
- *      1. according to its size, get a minimum list_index to 
- *         start with 
- *      2. if finding on current list is failed, find it on
- *         next list until no other list remainded
+ *      walk non-empty lists from list of asize, stop at first list
+ *      having a block which fits
  * @param
+ *      ar: the arena
  *      asize: a minimum size of be allocated 
+ *      best: 1 for smallest block in the list, 0 for first block
  * @ret
  *      NULL if not found 
  *      valid pointer if found 
  */
-static void *find_fit(size_t asize) {
-    char *bp;
-    size_t i = get_list_index_by_size(asize);
-
-    for (; i < NO_OF_SIZE_TYPE; i++) {
-        bp = find_fit_from_list(asize, i);
-        if ( NULL != bp ){
-            return bp;
-        } 
-    } 
+static void *find_fit_in_lists(arena_t *ar, size_t asize, int best) {
+    char *bp, *fit = NULL;
+    size_t i, size;
+
+    for (i = find_list_from(ar, get_list_index_by_size(asize)); 
+         i < NO_OF_LIST; i = find_list_from(ar, i + 1)) {
+        for (bp = get_list_head_by_index(ar, i); bp != NULL; 
+             bp = get_succ_ptr(bp)) {
+            size = get_size(get_header_ptr(bp));
+            if (asize <= size && 
+                (NULL == fit || size < get_size(get_header_ptr(fit)))) {
+                fit = bp;
+                if (!best || size == asize) {
+                    return fit;
+                }
+            }
+        }
+        if (NULL != fit) {
+            return fit;
+        }
+    }
     return NULL;
 }
+
 /**
  * @brief
- *      Find a big enough block in target list 
+ *      Find next free & big enough space's ptr by placement policy
  * @note
- *      1. get target list by its list_index
- *      2. traverse from begin to end to find a big enough block
+ *      FIT_GOOD, also FIT_TREE for a block not in tree
+ *      1. head of list of its size, if it's big enough
+ *      2. otherwise, head of first non-empty list from list whose 
+ *         blocks all fit, by bitmaps
+ *      FIT_TREE
+ *      3. a block in tree of lowest address, for a large request or
+ *         if nothing in lists fits
+ *      FIT_FIRST/FIT_BEST, see find_fit_in_lists
  * @param
+ *      ar: the arena
  *      asize: a minimum size of be allocated 
  * @ret
  *      NULL if not found 
  *      valid pointer if found 
  */
-static void *find_fit_from_list(size_t asize, size_t list_index) {
-    void *bp = get_list_head_by_index(list_index);
+static void *find_fit(arena_t *ar, size_t asize) {
+    size_t i = get_list_index_by_size(asize);
+    char *bp = get_list_head_by_index(ar, i);
 
-    for(; bp != NULL; bp = get_succ_ptr(bp)) {
-        ENSURES(!get_alloc(get_header_ptr(bp)));
-        if (asize <= get_size(get_header_ptr(bp))) {
-            return bp; 
-        }
+    if (FIT_FIRST == fit_policy || FIT_BEST == fit_policy) {
+        return find_fit_in_lists(ar, asize, FIT_BEST == fit_policy);
     }
-    return NULL;
+    if (in_tree(asize)) {
+        return tree_find(ar->tree_root, asize);
+    }
+
+    if (NULL != bp && asize <= get_size(get_header_ptr(bp))) {
+        return bp;
+    }
+
+    if ((i = find_list_from(ar, get_fit_index_by_size(asize))) >= NO_OF_LIST) {
+        return tree_find(ar->tree_root, asize);
+    }
+    bp = get_list_head_by_index(ar, i);
+    ENSURES(!get_alloc(get_header_ptr(bp)));
+    return bp;
 }
 
 /**
@@ -941,27 +2397,30 @@ static void *find_fit_from_list(size_t asize, size_t list_index) {
  * @note 
  *      Also do liked-list node add/remove handeling
  * @param 
+ *      ar: arena of the block
  *      bp: pointer of memory block to be place 
  *      asize: size of target to be placed memory block
  */
-static void place(void *bp, size_t asize) {
+static void place(arena_t *ar, void *bp, size_t asize) {
     size_t free_size = get_size(get_header_ptr(bp));
 
-    remove_from_list(bp);
+    remove_from_list(ar, bp);
 
+    // previous block of a free block is allocated
     if ((free_size - asize) >= (MIN_BLK_SIZE)){ // can be split
         // allocate asize 
-        set_word_val(get_header_ptr(bp), pack_size(asize, 1));
-        set_word_val(get_footer_ptr(bp), pack_size(asize, 1));
+        set_word_val(get_header_ptr(bp), pack_alloc(ar, asize) | PREV_ALLOC);
         // split block 
         bp = get_next_blk_ptr(bp);
-        set_word_val(get_header_ptr(bp), pack_size(free_size - asize, 0));
+        set_word_val(get_header_ptr(bp), 
+                     pack_size(free_size - asize, 0) | PREV_ALLOC);
         set_word_val(get_footer_ptr(bp), pack_size(free_size - asize, 0));
         // add to list
-        list_push_front(bp);
+        list_push_front(ar, bp);
     } else {
-        set_word_val(get_header_ptr(bp), pack_size(free_size, 1));
-        set_word_val(get_footer_ptr(bp), pack_size(free_size, 1));
+        set_word_val(get_header_ptr(bp), 
+                     pack_alloc(ar, free_size) | PREV_ALLOC);
+        set_prev_alloc(get_next_blk_ptr(bp), PREV_ALLOC);
     }
 }
 
@@ -971,13 +2430,22 @@ static void place(void *bp, size_t asize) {
  *
  * 1. Find target list by its size 
  * 2. Insert at font of target list 
+ * 3. Set its bits in bitmaps
+ * or insert it to tree if it's in tree
  *
  * @param 
+ *      ar: arena of the block
  *      bp: pointer of memory block to be inserted  
 */
-static void list_push_front(char *bp) {
+static void list_push_front(arena_t *ar, char *bp) {
     int size = get_size(get_header_ptr(bp));
-    char **list_head = get_list_head_by_size(size);
+    size_t i = get_list_index_by_size(size);
+    char **list_head = get_list_head_by_size(ar, size);
+
+    if (in_tree(size)) {
+        ar->tree_root = tree_insert(ar->tree_root, bp);
+        return;
+    }
     // bp's pred should be NULL 
     set_pred_ptr(bp, NULL);
 
@@ -991,6 +2459,8 @@ static void list_push_front(char *bp) {
 
     // update list head
     *list_head = bp;
+    ar->sl_bitmap[i / SL_COUNT] |= 1 << (i % SL_COUNT);
+    ar->fl_bitmap |= 1u << (i / SL_COUNT);
 }
 
 /**
@@ -998,18 +2468,32 @@ static void list_push_front(char *bp) {
  *      remove one node from list
  * 1. Find target list by its size 
  * 2. Remove the node from target list
+ * 3. Clear its bits in bitmaps if it's empty now
+ * or remove it from tree if it's in tree
  * @param 
+ *      ar: arena of the block
  *      bp: pointer of memory block to be inserted  
  */ 
-static void remove_from_list(char *bp) {    
+static void remove_from_list(arena_t *ar, char *bp) {    
     int size = get_size(get_header_ptr(bp));
-    char **list_head = get_list_head_by_size(size);
+    size_t i;
+    char **list_head = get_list_head_by_size(ar, size);
     char *pred_ptr = get_pred_ptr(bp);
     char *succ_ptr = get_succ_ptr(bp);
 
+    if (in_tree(size)) {
+        ar->tree_root = tree_remove(ar->tree_root, bp);
+        return;
+    }
+
     // corner case, if there's only one remained 
     if ((NULL == pred_ptr) && (NULL == succ_ptr)){
         *list_head = NULL;
+        i = get_list_index_by_size(size);
+        ar->sl_bitmap[i / SL_COUNT] &= ~(1 << (i % SL_COUNT));
+        if (0 == ar->sl_bitmap[i / SL_COUNT]) {
+            ar->fl_bitmap &= ~(1u << (i / SL_COUNT));
+        }
         return;
     }
 
@@ -1033,3 +2517,137 @@ static void remove_from_list(char *bp) {
         set_succ_ptr(pred_ptr, succ_ptr);
     }
 }
+
+/**
+ * @brief
+ *      rotate a node of tree with its left or right child up
+ * @param
+ *      bp: the node
+ * @ret
+ *      the child, new root of subtree
+ */
+static char *tree_rotate_right(char *bp) {
+    char *left = get_left_ptr(bp);
+
+    set_left_ptr(bp, get_right_ptr(left));
+    set_right_ptr(left, bp);
+    update_tree_max(bp);
+    update_tree_max(left);
+    return left;
+}
+static char *tree_rotate_left(char *bp) {
+    char *right = get_right_ptr(bp);
+
+    set_right_ptr(bp, get_left_ptr(right));
+    set_left_ptr(right, bp);
+    update_tree_max(bp);
+    update_tree_max(right);
+    return right;
+}
+
+/**
+ * @brief
+ *      insert a free block to a subtree, rotate it up while its
+ *      priority is higher than its parent
+ * @param
+ *      root: root of subtree, may be NULL
+ *      bp: the block
+ * @ret
+ *      new root of subtree
+ */
+static char *tree_insert(char *root, char *bp) {
+    if (NULL == root) {
+        set_left_ptr(bp, NULL);
+        set_right_ptr(bp, NULL);
+        update_tree_max(bp);
+        return bp;
+    }
+
+    if (bp < root) {
+        set_left_ptr(root, tree_insert(get_left_ptr(root), bp));
+        if (get_tree_prio(get_left_ptr(root)) > get_tree_prio(root)) {
+            return tree_rotate_right(root);
+        }
+    } else {
+        set_right_ptr(root, tree_insert(get_right_ptr(root), bp));
+        if (get_tree_prio(get_right_ptr(root)) > get_tree_prio(root)) {
+            return tree_rotate_left(root);
+        }
+    }
+    update_tree_max(root);
+    return root;
+}
+
+/**
+ * @brief
+ *      merge two subtrees, all nodes of left are before ones of right
+ * @ret
+ *      root of merged subtree
+ */
+static char *tree_merge(char *left, char *right) {
+    if (NULL == left) {
+        return right;
+    }
+    if (NULL == right) {
+        return left;
+    }
+
+    if (get_tree_prio(left) > get_tree_prio(right)) {
+        set_right_ptr(left, tree_merge(get_right_ptr(left), right));
+        update_tree_max(left);
+        return left;
+    }
+    set_left_ptr(right, tree_merge(left, get_left_ptr(right)));
+    update_tree_max(right);
+    return right;
+}
+
+/**
+ * @brief
+ *      remove a block from a subtree, its children are merged to
+ *      take its place
+ * @param
+ *      root: root of subtree, bp should be in it
+ *      bp: the block
+ * @ret
+ *      new root of subtree
+ */
+static char *tree_remove(char *root, char *bp) {
+    REQUIRES(NULL != root);
+
+    if (root == bp) {
+        return tree_merge(get_left_ptr(bp), get_right_ptr(bp));
+    }
+
+    if (bp < root) {
+        set_left_ptr(root, tree_remove(get_left_ptr(root), bp));
+    } else {
+        set_right_ptr(root, tree_remove(get_right_ptr(root), bp));
+    }
+    update_tree_max(root);
+    return root;
+}
+
+/**
+ * @brief
+ *      find block of lowest address which fits in a subtree, by max
+ *      size of subtrees
+ * @param
+ *      root: root of subtree, may be NULL
+ *      asize: a minimum size of be allocated
+ * @ret
+ *      NULL if not found
+ *      valid pointer if found
+ */
+static char *tree_find(char *root, size_t asize) {
+    while (NULL != root && get_tree_max(root) >= asize) {
+        if (get_tree_max(get_left_ptr(root)) >= asize) {
+            root = get_left_ptr(root);
+        } else if (get_size(get_header_ptr(root)) >= asize) {
+            return root;
+        } else {
+            root = get_right_ptr(root);
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,200 @@
+#include "csapp.h"
+#include "admin.h"
+#include "netio.h"
+#include <stdarg.h>
+#include <sys/un.h>
+
+/**
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * @note
+ *      Admin endpoint on a UNIX socket, so operators can inspect and
+ *      fix cache without restarting. Only the owner can connect.
+ *      One command per line, each reply ends with an empty line:
+ *          PURGE <tag>               remove all variants of a tag
+ *          PURGE-PREFIX <prefix>     remove every tag of a prefix
+ *          TOP <n> [size|hits]       list the top n items
+ *          STATS                     dump counters
+ *      e.g. echo "TOP 10 hits" | nc -U /tmp/proxy.sock
+ *      It has its own thread, and cache is only locked as long as
+ *      one purge or one snapshot takes, so serving never stops.
+ **/
+
+#define ADMIN_IDLE_SECS 10   /// an idle admin client is dropped
+
+/** Static global variable */
+static cache_t *admin_cache;          /// the cache to manage
+static void (*admin_stats)(int fd);   /// writes counters of proxy
+
+/** Static helper function */
+
+/**
+ * @brief
+ *      write a formatted line to admin client
+ * @ret
+ *      0 if OK, -1 if error
+ */
+static int reply(int fd, const char *fmt, ...) {
+    char buf[MAXLINE];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(buf, MAXLINE, fmt, ap);
+    va_end(ap);
+    return nio_writen(fd, buf, strlen(buf));
+}
+
+/**
+ * @brief
+ *      list the top n items by size or hits
+ * @param
+ *      fd: admin client
+ *      n: number of items
+ *      key: "size" or "hits"
+ */
+static void do_top(int fd, int n, const char *key) {
+    cache_stat_t *top;
+    int i, cnt;
+
+    if (n <= 0 || n > ADMIN_MAX_TOP ||
+        (strcasecmp(key, "size") && strcasecmp(key, "hits"))) {
+        reply(fd, "ERR usage: TOP <1-%d> [size|hits]\n", ADMIN_MAX_TOP);
+        return;
+    }
+
+    top = Malloc(n * sizeof(cache_stat_t));
+    cnt = cache_top(admin_cache, n, !strcasecmp(key, "hits"), top);
+    reply(fd, "%-8s %-8s %-12s %s\n", "size", "hits", "priority", "tag");
+    for (i = 0; i < cnt; i++) {
+        if (reply(fd, "%-8d %-8u %-12g %s%s\n", top[i].size, top[i].hits,
+                  top[i].priority, top[i].tag, top[i].vary ? " (vary)" : "")) {
+            break;
+        }
+    }
+    Free(top);
+}
+
+/**
+ * @brief
+ *      dump counters of cache, then the ones of proxy
+ * @param
+ *      fd: admin client
+ */
+static void do_stats(int fd) {
+    cache_t *cp = admin_cache;
+
+    reply(fd, "cache.items %d\n", cp->cache_cnt);
+    reply(fd, "cache.bytes %d\n", cp->total_size);
+    reply(fd, "cache.capacity %d\n", cp->max_size);
+    reply(fd, "cache.policy %s\n", cp->policy->name);
+    reply(fd, "cache.admission %d\n", cp->admission);
+    reply(fd, "cache.evictions %u\n", cp->evict_cnt);
+    reply(fd, "cache.rejects %u\n", cp->reject_cnt);
+    if (NULL != admin_stats) {
+        admin_stats(fd);
+    }
+}
+
+/**
+ * @brief
+ *      run one command line
+ * @param
+ *      fd: admin client
+ *      line: the command
+ */
+static void do_command(int fd, char *line) {
+    char cmd[MAXLINE], arg[MAXLINE], key[MAXLINE];
+    int n;
+
+    strcpy(key, "size");
+    n = sscanf(line, "%s %s %s", cmd, arg, key);
+    if (n < 1) {
+        return;  // empty line
+    }
+
+    if (!strcasecmp(cmd, "PURGE") && n == 2) {
+        reply(fd, "OK %d purged\n", purge_cache(admin_cache, arg, 0));
+    } else if (!strcasecmp(cmd, "PURGE-PREFIX") && n == 2) {
+        reply(fd, "OK %d purged\n", purge_cache(admin_cache, arg, 1));
+    } else if (!strcasecmp(cmd, "TOP") && n >= 2) {
+        do_top(fd, atoi(arg), key);
+    } else if (!strcasecmp(cmd, "STATS")) {
+        do_stats(fd);
+    } else {
+        reply(fd, "ERR commands: PURGE <tag>, PURGE-PREFIX <prefix>, "
+                  "TOP <n> [size|hits], STATS\n");
+    }
+    reply(fd, "\n");
+}
+
+/**
+ * @brief
+ *      admin thread, serve admin clients one by one
+ */
+static void *admin_thread(void *vargp) {
+    int listenfd = (int)(long)vargp;
+    struct timeval tv = {ADMIN_IDLE_SECS, 0};
+    char line[MAXLINE];
+    rio_t rio;
+    int fd;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        if ((fd = nio_accept(listenfd, NULL, NULL)) < 0) {
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        Rio_readinitb(&rio, fd);
+        while (nio_readlineb(&rio, line, MAXLINE) > 0) {
+            do_command(fd, line);
+        }
+        nio_close(fd);
+    }
+    return NULL;
+}
+
+/** public function for other program to call */
+
+/**
+ * @brief
+ *      listen on a UNIX socket and start admin thread
+ * @param
+ *      path: path of socket, an old one is replaced
+ *      cp: the cache to manage
+ *      stats: writes counters of proxy to fd for STATS, may be NULL
+ * @ret
+ *      0 if OK, -1 with errno set if socket can't be made
+ */
+int admin_init(const char *path, cache_t *cp, void (*stats)(int fd)) {
+    struct sockaddr_un addr;
+    pthread_t tid;
+    mode_t mask;
+    int listenfd, rc;
+
+    admin_cache = cp;
+    admin_stats = stats;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+    unlink(path);
+    mask = umask(0177);   // operators only, no window before it's private
+    rc = bind(listenfd, (SA *)&addr, sizeof(addr));
+    umask(mask);
+    if (rc < 0 || listen(listenfd, LISTENQ) < 0) {
+        rc = errno;
+        close(listenfd);
+        errno = rc;
+        return -1;
+    }
+    Pthread_create(&tid, NULL, admin_thread, (void *)(long)listenfd);
+    return 0;
+}
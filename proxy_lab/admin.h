@@ -0,0 +1,13 @@
+#ifndef __ADMIN_H__
+#define __ADMIN_H__
+
+#include "csapp.h"
+#include "cache.h"
+
+#define ADMIN_MAX_TOP 100  /// most entries TOP lists
+
+/* start admin thread on a UNIX socket, stats writes STATS lines,
+ * return 0 if OK */
+int admin_init(const char *path, cache_t *cp, void (*stats)(int fd));
+
+#endif /* __ADMIN_H__ */
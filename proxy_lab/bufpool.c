@@ -0,0 +1,105 @@
+#include "csapp.h"
+#include "bufpool.h"
+
+/**
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * @note
+ *      Reusable buffers for workers, so a large buffer isn't on 
+ *      stack of every thread and pages are not touched fresh on 
+ *      every request.
+ *      1. all buffers are carved from one mapping, which may be on
+ *         huge pages to save TLB entries. If no hugetlb page is 
+ *         reserved, transparent huge page is asked by madvise
+ *      2. free buffers are a LIFO stack, so the one just released, 
+ *         still in cache, is reused first
+ *      3. bp_get waits when all buffers are in use, which bounds the
+ *         memory no matter how many threads there are
+ **/
+
+/** public function for other program to call */
+
+/**
+ * @brief
+ *      map the region and fill the free stack
+ * @param
+ *      bp: pointer to bufpool_t
+ *      n: number of buffers
+ *      size: size of each buffer, rounded up to cache line
+ *      huge: 1 to put region on huge pages
+ */
+void bp_init(bufpool_t *bp, int n, size_t size, int huge) {
+    int i;
+
+    bp->size = (size + 63) & ~(size_t)63;
+    bp->n = n;
+    bp->region_sz = bp->size * n;
+    bp->region = MAP_FAILED;
+    bp->huge = 0;
+
+    if (huge) {
+        bp->region_sz = (bp->region_sz + BP_HUGE_PAGE - 1) & \
+                        ~(size_t)(BP_HUGE_PAGE - 1);
+        bp->region = mmap(NULL, bp->region_sz, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        bp->huge = (bp->region != MAP_FAILED);
+    }
+    if (bp->region == MAP_FAILED) {
+        bp->region = Mmap(NULL, bp->region_sz, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (huge) {
+            madvise(bp->region, bp->region_sz, MADV_HUGEPAGE);
+        }
+    }
+
+    bp->free = Malloc(n * sizeof(void *));
+    for (i = 0; i < n; i++) {
+        bp->free[i] = bp->region + (size_t)(n - 1 - i) * bp->size;
+    }
+    bp->top = n;
+    Sem_init(&bp->mutex, 0, 1);
+    Sem_init(&bp->items, 0, n);
+}
+
+/**
+ * @brief
+ *      unmap the region, all buffers should be put back
+ * @param
+ *      bp: pointer to bufpool_t
+ */
+void bp_deinit(bufpool_t *bp) {
+    Munmap(bp->region, bp->region_sz);
+    Free(bp->free);
+}
+
+/**
+ * @brief
+ *      take a free buffer
+ * @param
+ *      bp: pointer to bufpool_t
+ * @ret
+ *      the buffer of bp->size bytes
+ */
+void *bp_get(bufpool_t *bp) {
+    void *buf;
+
+    P(&bp->items);
+    P(&bp->mutex);
+    buf = bp->free[--bp->top];
+    V(&bp->mutex);
+    return buf;
+}
+
+/**
+ * @brief
+ *      put a buffer back
+ * @param
+ *      bp: pointer to bufpool_t
+ *      buf: got by bp_get
+ */
+void bp_put(bufpool_t *bp, void *buf) {
+    P(&bp->mutex);
+    bp->free[bp->top++] = buf;
+    V(&bp->mutex);
+    V(&bp->items);
+}
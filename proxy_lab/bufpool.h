@@ -0,0 +1,27 @@
+#ifndef __BUFPOOL_H__
+#define __BUFPOOL_H__
+
+#include "csapp.h"
+
+#define BP_HUGE_PAGE (2 * 1024 * 1024)  /// size of a huge page
+
+/** a pool of fixed sized buffers carved from one mapping */
+typedef struct {
+    char *region;      /// the mapping
+    size_t region_sz;  /// size of the mapping
+    size_t size;       /// size of each buffer
+    int n;             /// number of buffers
+    void **free;       /// stack of free buffers, LIFO keeps them warm
+    int top;           /// number of free buffers
+    int huge;          /// 1 if region is on hugetlb pages
+    sem_t mutex;       /// protects free and top
+    sem_t items;       /// counts free buffers
+} bufpool_t;
+
+void bp_init(bufpool_t *bp, int n, size_t size, int huge);
+void bp_deinit(bufpool_t *bp);
+/* take a buffer, wait if none is free */
+void *bp_get(bufpool_t *bp);
+void bp_put(bufpool_t *bp, void *buf);
+
+#endif /* __BUFPOOL_H__ */
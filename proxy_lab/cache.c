@@ -1,5 +1,6 @@
 #include "csapp.h"
 #include "cache.h"
+#include "http.h"
 #include <string.h>
 
 /**  
@@ -9,8 +10,29 @@
  *      1. Use reader/writer approach to implement cache 
  *      The same concept as text-book present 
  *      2. Use link-list for dynamic sized cache 
+ *      3. An item is matched by its tag and, if the response has
+ *         Vary header, by the request headers it varies on. Each item
+ *         keeps a 64-bit hash of its tag, a lookup hashes its tag once
+ *         and only compares strings of items with same hash
+ *      4. Optional TinyLFU admission: every read records the tag in
+ *         a count-min sketch, a new item which needs eviction is 
+ *         admitted only if it's more frequent than each victim, so
+ *         one-hit-wonder scans can't flush popular items
+ *      5. Pluggable eviction policy. A policy gives each item a 
+ *         priority on insert and on hit, the victim is the item of
+ *         lowest priority
+ *         a. lru: priority is the time of last access
+ *         b. gdsf: GreedyDual-Size-Frequency, L + hits / size, 
+ *            favors small hot items, maximizes object hit ratio
+ *         c. lfuda: LFU with dynamic aging, L + hits, size doesn't 
+ *            matter so it's better on byte hit ratio
+ *         L is the priority of last victim, so items not accessed 
+ *         for a long time age out
  **/
 
+/** counters per row of sketch, about 10x of items in a full cache */
+#define SKETCH_WIDTH 1024
+
 /** Static global variable */
 static int read_cnt;            /// number of current reader 
 static sem_t r_mutex, w_mutex;  /// mutex for read/writer permission
@@ -18,19 +40,125 @@ static sem_t r_mutex, w_mutex;  /// mutex for read/writer permission
 /** Static helper function */
 
 /* @brief 
- *      increase all item's age
- * @note 
+ *      lru policy, priority is the time of last access
+ * @param 
+ *      cp: pointer to cache_t
+ *      item: the item being inserted or hit
+ */
+static double lru_priority(cache_t *cp, cache_item *item) {
+    return ++cp->clock;
+}
+
+/* @brief 
+ *      gdsf policy, priority is L + frequency * cost / size with 
+ *      cost = 1
+ * @param 
+ *      cp: pointer to cache_t
+ *      item: the item being inserted or hit
+ */
+static double gdsf_priority(cache_t *cp, cache_item *item) {
+    return cp->inflation + (double)item->hits / item->size;
+}
+
+/* @brief 
+ *      lfuda policy, priority is L + frequency, it's gdsf with 
+ *      cost = size
+ * @param 
+ *      cp: pointer to cache_t
+ *      item: the item being inserted or hit
+ */
+static double lfuda_priority(cache_t *cp, cache_item *item) {
+    return cp->inflation + item->hits;
+}
+
+/* @brief 
+ *      inflate L to the priority of victim, used by gdsf and lfuda
+ * @param 
+ *      cp: pointer to cache_t
+ *      victim: the item being evicted
+ */
+static void inflate_on_evict(cache_t *cp, cache_item *victim) {
+    cp->inflation = victim->priority;
+}
+
+/** all supported policies, the first one is the default */
+static const cache_policy_t policies[] = {
+    {"lru",   lru_priority,   NULL},
+    {"gdsf",  gdsf_priority,  inflate_on_evict},
+    {"lfuda", lfuda_priority, inflate_on_evict},
+};
+#define NO_OF_POLICY (sizeof(policies) / sizeof(policies[0]))
+
+/**
+ * @brief
+ *      check if a cache_item is the one requested
+ * @param 
+ *      ptr: pointer to cache_item
+ *      hash: fnv_hash of tag
+ *      tag: to be macthed tag
+ *      req_hdrs: request headers to match vary signature
+ * @ret 1 if matched, 0 otherwise
+ */
+static int match_item(cache_item *ptr, uint64_t hash, const char *tag, 
+                      const char *req_hdrs) {
+    return ptr->hash == hash && !strcmp(ptr->tag, tag) && 
+           http_vary_match(ptr->vary, req_hdrs);
+}
+
+/**
+ * @brief
+ *      find the item stored with exactly this tag and vary signature
+ * @note
  *      it's not thread safe, so the semaphore lock/unlock 
  *      must be controlled by its caller
  * @param 
  *      cp: pointer to cache_t
+ *      tag: the tag
+ *      vary: vary signature, NULL or "" if no vary
+ * @ret
+ *      pointer to the cache_item, NULL if not found
  */
-static void ages(cache_t *cp) {
-    cache_item *ptr = cp->head;
-    while (ptr) {
-        ptr->age ++;
-        ptr = ptr->next;
+static cache_item *find_same(cache_t *cp, const char *tag, const char *vary) {
+    uint64_t hash = fnv_hash(tag);
+    cache_item *ptr;
+
+    if (NULL != vary && '\0' == vary[0]) {
+        vary = NULL;
+    }
+    for (ptr = cp->head; ptr; ptr = ptr->next) {
+        if (ptr->hash == hash && !strcmp(ptr->tag, tag) &&
+            (NULL == vary ? NULL == ptr->vary : 
+                            NULL != ptr->vary && !strcmp(ptr->vary, vary))) {
+            return ptr;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief
+ *      enter as a reader, the first one locks out writers
+ */
+static void reader_lock(void) {
+    P(&r_mutex);  
+    read_cnt++;
+    if (read_cnt == 1) { // first read 
+        P(&w_mutex); // lock write
     }
+    V(&r_mutex);  
+}
+
+/**
+ * @brief
+ *      leave as a reader, the last one lets writers in
+ */
+static void reader_unlock(void) {
+    P(&r_mutex);  
+    read_cnt--;
+    if (read_cnt == 0) { // last read 
+        V(&w_mutex); // unlock write
+    }
+    V(&r_mutex); 
 }
 
 /**
@@ -42,35 +170,24 @@ static void ages(cache_t *cp) {
  * @param 
  *      cp: pointer to cache_t
  *      tag: to be macthed tag
+ *      req_hdrs: request headers to match vary signature
  */
-static int find_hit(cache_t *cp, const char *tag) {
-    cache_item *ptr = cp->head;
+static int find_hit(cache_t *cp, const char *tag, const char *req_hdrs) {
+    uint64_t hash = fnv_hash(tag);
+    cache_item *ptr;
     int find = 0;
 
-    // update read_cnt
-    P(&r_mutex);  
-    read_cnt++;
-    if (read_cnt == 1) { // first read 
-        P(&w_mutex); // lock write
-    }
-    V(&r_mutex);  
+    reader_lock();
 
     // begin finding
-    while (ptr){
-        if (!strcmp(ptr->tag, tag)){
+    for (ptr = cp->head; ptr; ptr = ptr->next) {
+        if (match_item(ptr, hash, tag, req_hdrs)){
             find = 1;
             break;
         } 
-        ptr = ptr->next;
     }
 
-    // update read_cnt
-    P(&r_mutex);  
-    read_cnt--;
-    if (read_cnt == 0) { // last read 
-        V(&w_mutex); // unlock write
-    }
-    V(&r_mutex); 
+    reader_unlock();
 
     return find;
 }
@@ -81,19 +198,20 @@ static int find_hit(cache_t *cp, const char *tag) {
  *      cache_item whose tag is tag in whole cache
  *
  * @note: 
- *      eventhough get failed, all cache's age 
- *      will increase by one, it's ok because it's fair
+ *      the hit item gets a new priority from policy
  * @param 
  *      cp: pointer to cache_t
  *      tag: to be macthed tag
+ *      req_hdrs: request headers to match vary signature
  *      out_data: the data will be stored here and return 
  *      out_size: the size will be stored here and return
  * @ret 
  *      1 if get, 0 otherwise
  */
-static int get_hit(cache_t *cp, const char *tag, char *out_data, \
-            int *out_size){
+static int get_hit(cache_t *cp, const char *tag, const char *req_hdrs, \
+            char *out_data, int *out_size){
 
+    uint64_t hash = fnv_hash(tag);
     cache_item *ptr = cp->head;
     int get = 0;
     
@@ -101,13 +219,13 @@ static int get_hit(cache_t *cp, const char *tag, char *out_data, \
 
     // begin get 
     while (ptr){
-        if (!strcmp(ptr->tag, tag)){
+        if (!get && match_item(ptr, hash, tag, req_hdrs)){
             get = 1;
             memcpy(out_data, ptr->data, ptr->size);
             *out_size = ptr->size;
-            ptr->age = 1;
-        } else {
-            (ptr->age)++;
+            ptr->hits++;
+            ptr->priority = cp->policy->priority(cp, ptr);
+            break;
         } 
         ptr = ptr->next;
     }
@@ -118,54 +236,69 @@ static int get_hit(cache_t *cp, const char *tag, char *out_data, \
 }
 
 /* @brief 
- *      remove oldest one from cache's link-list
+ *      find the victim, i.e., item of lowest priority, except the ones
+ *      already picked by write_cache
  * @note 
  *      it's not thread safe, so the semaphore lock/unlock 
  *      must be controlled by its caller
  * @param 
  *      cp: pointer to cache_t
+ * @ret
+ *      pointer to the victim cache_item, NULL if cache is empty
  */
-static void remove_oldest (cache_t *cp) {
+static cache_item *find_victim(cache_t *cp) {
     cache_item *ptr = cp->head;
-    cache_item *pre_ptr = NULL;
-    cache_item *oldest_ptr = NULL;
-    cache_item *pre_oldest_prt = NULL;
-    unsigned int oldest_age = 0;
-
-    if ( NULL == ptr) {
-        return;
-    }
+    cache_item *victim = NULL;
 
-    // find oldest one
     while (ptr) {
-        if (ptr->age > oldest_age) {
-            pre_oldest_prt = pre_ptr;
-            oldest_ptr = ptr;
-            oldest_age = ptr->age;
+        if (!ptr->picked && 
+            (NULL == victim || ptr->priority < victim->priority)) {
+            victim = ptr;
         }
+        ptr = ptr->next;
+    }
+    return victim;
+}
+
+/* @brief 
+ *      remove one item from cache's link-list and free it
+ * @note 
+ *      it's not thread safe, so the semaphore lock/unlock 
+ *      must be controlled by its caller
+ * @param 
+ *      cp: pointer to cache_t
+ *      item: the item to be removed
+ */
+static void remove_item(cache_t *cp, cache_item *item) {
+    cache_item *ptr = cp->head;
+    cache_item *pre_ptr = NULL;
+
+    // find its previous one
+    while (ptr && ptr != item) {
         pre_ptr = ptr;
         ptr = ptr->next;
     }
-    if ( NULL == oldest_ptr ){
+    if ( NULL == ptr ){
         return;  // safty purpose
     }
 
     /* remove */
     // relink 
-    if ( cp->head == oldest_ptr ){ // it's head 
-        cp->head = oldest_ptr->next;
+    if ( NULL == pre_ptr ){ // it's head 
+        cp->head = item->next;
     } else {
-        pre_oldest_prt->next = oldest_ptr->next;
+        pre_ptr->next = item->next;
     }
 
     // update 
-    cp->total_size -= oldest_ptr->size;
+    cp->total_size -= item->size;
     (cp->cache_cnt)--;
 
     // free 
-    Free(oldest_ptr->tag);
-    Free(oldest_ptr->data);
-    Free(oldest_ptr);
+    Free(item->tag);
+    Free(item->vary);
+    Free(item->data);
+    Free(item);
 }
 
 /**
@@ -173,25 +306,28 @@ static void remove_oldest (cache_t *cp) {
  *      add a new cache-item into head of link-list with
  *      given tag and data
  *
- * @note
- *      The default age is 1 because we use unsign int 
- *      to store age so we need compare starting from 0
- *
  * @param 
  *      cp: pointer to cache_t
  *      tag: given tag to store
+ *      vary: given vary signature to store, NULL or "" if no vary
  *      data: given data to store
  *      size: given size to store
  */
 static void add_to_cache_head(cache_t *cp, const char *tag,\
-        const char *data, int size) {
+        const char *vary, const char *data, int size) {
 
     // creat 
     cache_item *item = Malloc(sizeof(cache_item));
     item->tag = Malloc(strlen(tag)+1);
+    item->vary = NULL;
     item->data = Malloc(size);
     // copy
     strcpy(item->tag, tag);
+    item->hash = fnv_hash(tag);
+    if (NULL != vary && '\0' != vary[0]) {
+        item->vary = Malloc(strlen(vary)+1);
+        strcpy(item->vary, vary);
+    }
     memcpy(item->data, data, size);
     item->size = size;
     // update link
@@ -199,8 +335,9 @@ static void add_to_cache_head(cache_t *cp, const char *tag,\
     cp->head = item;
     cp->total_size += size;
     cp->cache_cnt ++;
-    ages(cp);
-    item->age = 1;
+    item->hits = 1;
+    item->picked = 0;
+    item->priority = cp->policy->priority(cp, item);
 }
 
 /** public function for other program to call */
@@ -210,14 +347,44 @@ static void add_to_cache_head(cache_t *cp, const char *tag,\
  *
  * @param 
  *      cp: pointer to cache_t
+ *      policy: name of eviction policy, NULL for default (lru)
+ *      admission: 1 to enable TinyLFU admission filter
+ * @ret
+ *      0 if OK, -1 if policy is unknown
  */
-void cache_init(cache_t *cp) {
+int cache_init(cache_t *cp, const char *policy, int admission) {
+    int i;
+
+    // choose policy
+    cp->policy = &policies[0];
+    if (NULL != policy) {
+        for (i = 0; i < NO_OF_POLICY; i++) {
+            if (!strcasecmp(policies[i].name, policy)) {
+                break;
+            }
+        }
+        if (i == NO_OF_POLICY) {
+            return -1;
+        }
+        cp->policy = &policies[i];
+    }
+    cp->clock = 0;
+    cp->inflation = 0;
+
     read_cnt = 0;
     Sem_init(&r_mutex, 0, 1);
     Sem_init(&w_mutex, 0, 1);
     cp->total_size = 0;
+    cp->max_size = MAX_CACHE_SIZE;
     cp->cache_cnt = 0;
     cp->head = NULL;
+    cp->admission = admission;
+    if (admission) {
+        sketch_init(&cp->sketch, SKETCH_WIDTH);
+    }
+    cp->evict_cnt = 0;
+    cp->reject_cnt = 0;
+    return 0;
 }
 
 /**
@@ -233,10 +400,14 @@ void cache_deinit(cache_t *cp) {
     while(cur_ptr){
         next_ptr = cur_ptr->next;
         Free(cur_ptr->tag);
+        Free(cur_ptr->vary);
         Free(cur_ptr->data);
         Free(cur_ptr);
         cur_ptr = next_ptr;
     }
+    if (cp->admission) {
+        sketch_deinit(&cp->sketch);
+    }
 }
 
 /**
@@ -246,44 +417,260 @@ void cache_deinit(cache_t *cp) {
  * @param 
  *      cp: pointer to cache_t
  *      tag: to be macthed tag
+ *      req_hdrs: request headers to be sent to real host, used to 
+ *                match the vary signature of cached response
  *      out_data: the data will be stored here and return 
  *      out_size: the size will be stored here and return
  * @ret 
  *      1 if get, 0 otherwise
  */
-int read_cache(cache_t *cp, const char *tag, char *out_data, int *out_size) {
-    if (find_hit(cp, tag)){
-        return (get_hit(cp, tag, out_data, out_size));
+int read_cache(cache_t *cp, const char *tag, const char *req_hdrs,
+               char *out_data, int *out_size) {
+    if (cp->admission) {
+        sketch_increment(&cp->sketch, tag);  // record every access
+    }
+    if (find_hit(cp, tag, req_hdrs)){
+        return (get_hit(cp, tag, req_hdrs, out_data, out_size));
     }
     return 0;
 }
 
+/**
+ * @brief
+ *      check if a request is cached, the item's priority and the
+ *      sketch are not touched, so it's not counted as an access
+ *
+ * @param 
+ *      cp: pointer to cache_t
+ *      tag: to be macthed tag
+ *      req_hdrs: request headers to match vary signature
+ * @ret 
+ *      1 if cached, 0 otherwise
+ */
+int probe_cache(cache_t *cp, const char *tag, const char *req_hdrs) {
+    return find_hit(cp, tag, req_hdrs);
+}
+
 /**
  * @brief
  *      write data to cache by given tag/data/info
  *
+ * An item of same tag and vary is replaced. Victims chosen by policy
+ * are picked until there's enough space. With admission, each victim
+ * is compared with the new item by estimated frequency, and the new
+ * item is rejected if it's not more frequent than any of them.
+ * Victims, and the item replaced, are only removed if it's admitted
+ *
  * @param 
  *      cp: pointer to cache_t
  *      tag: given tag to store 
+ *      vary: vary signature built by http_vary_sig, NULL if no vary
  *      data: given data to store  
  *      size: given size to store
  * @ret 
  *      1 if get, 0 otherwise
  */
-void write_cache(cache_t *cp, const char *tag, const char *data, int size) {
+void write_cache(cache_t *cp, const char *tag, const char *vary,
+                 const char *data, int size) {
+    cache_item *victim, *old, *victims = NULL, **last = &victims;
+    int freq = 0, need, admit = 1;
+
     if ( size > MAX_OBJECT_SIZE) {  // error proof
         return;   
     }
 
     P(&w_mutex);  // lock w
 
-    // remove oldest one if space is not enough
-    while ( size + cp->total_size > MAX_CACHE_SIZE) {
-        remove_oldest(cp);
+    if (cp->admission) {
+        freq = sketch_estimate(&cp->sketch, tag);
     }
 
-    add_to_cache_head(cp, tag, data, size);
+    // a newer copy replaces the stored one, its space is free then
+    need = size + cp->total_size - cp->max_size;
+    if (NULL != (old = find_same(cp, tag, vary))) {
+        old->picked = 1;
+        need -= old->size;
+    }
+
+    // pick victims until there's enough space
+    while (need > 0 && NULL != (victim = find_victim(cp))) {
+        victim->picked = 1;
+        victim->next_victim = NULL;
+        *last = victim;
+        last = &victim->next_victim;
+        need -= victim->size;
+        if (cp->admission && \
+            freq <= sketch_estimate(&cp->sketch, victim->tag)) {
+            admit = 0;   // victim is more popular, keep them all
+            break;
+        }
+    }
+
+    // evict all of them or none
+    for (victim = victims; victim; victim = victims) {
+        victims = victim->next_victim;
+        victim->picked = 0;
+        if (admit) {
+            if (NULL != cp->policy->evicted) {
+                cp->policy->evicted(cp, victim);
+            }
+            remove_item(cp, victim);
+            cp->evict_cnt++;
+        }
+    }
+    if (NULL != old) {
+        old->picked = 0;
+        if (admit) {
+            remove_item(cp, old);
+        }
+    }
+
+    if (admit) {
+        add_to_cache_head(cp, tag, vary, data, size);
+    } else {
+        cp->reject_cnt++;
+    }
     
     V(&w_mutex);  // unlock w 
 }
 
+/**
+ * @brief
+ *      write a raw response got from real host to cache
+ *
+ * A partial(206) response must not be stored under the tag of full 
+ * object, and a response with "Vary: *" can't be cached. Otherwise
+ * it's stored with the vary signature of the request
+ *
+ * @param 
+ *      cp: pointer to cache_t
+ *      tag: given tag to store 
+ *      req_hdrs: request headers sent to real host
+ *      data: the raw response
+ *      size: size of response
+ */
+void cache_response(cache_t *cp, const char *tag, const char *req_hdrs,
+                    const char *data, int size) {
+    char vary_hdr[MAXLINE];
+    char vary[MAXLINE];
+    int body_off;
+
+    if (size > MAX_OBJECT_SIZE || http_get_status(data, size) == 206) {
+        return;
+    }
+    body_off = http_body_offset(data, size);
+    if (body_off < 0 ||
+        !http_get_header(data, body_off, "Vary", vary_hdr, MAXLINE)) {
+        write_cache(cp, tag, NULL, data, size);
+    } else if (!http_vary_sig(vary_hdr, req_hdrs, vary, MAXLINE)) {
+        write_cache(cp, tag, vary, data, size);
+    }
+}
+
+/**
+ * @brief
+ *      change capacity of cache, items are evicted by policy until 
+ *      they fit, admission doesn't apply
+ *
+ * @param 
+ *      cp: pointer to cache_t
+ *      max_size: new capacity in bytes
+ */
+void cache_resize(cache_t *cp, int max_size) {
+    cache_item *victim;
+
+    P(&w_mutex);  // lock w
+    cp->max_size = max_size;
+    while (cp->total_size > max_size && NULL != (victim = find_victim(cp))) {
+        if (NULL != cp->policy->evicted) {
+            cp->policy->evicted(cp, victim);
+        }
+        remove_item(cp, victim);
+        cp->evict_cnt++;
+    }
+    V(&w_mutex);  // unlock w 
+}
+
+/**
+ * @brief
+ *      remove items by tag, all variants of a Vary'd tag are removed
+ *
+ * @param 
+ *      cp: pointer to cache_t
+ *      tag: the tag, or prefix of tags
+ *      prefix: 1 if tag is a prefix
+ * @ret 
+ *      number of items removed
+ */
+int purge_cache(cache_t *cp, const char *tag, int prefix) {
+    cache_item *ptr, *next;
+    uint64_t hash = fnv_hash(tag);
+    int len = strlen(tag);
+    int cnt = 0;
+
+    P(&w_mutex);  // lock w
+    for (ptr = cp->head; ptr; ptr = next) {
+        next = ptr->next;
+        if (prefix ? !strncmp(ptr->tag, tag, len) : 
+                     (ptr->hash == hash && !strcmp(ptr->tag, tag))) {
+            remove_item(cp, ptr);
+            cnt++;
+        }
+    }
+    V(&w_mutex);  // unlock w 
+    return cnt;
+}
+
+/**
+ * @brief
+ *      compare two cache_stat_t for qsort, larger key first
+ */
+static int by_size(const void *a, const void *b) {
+    return ((cache_stat_t *)b)->size - ((cache_stat_t *)a)->size;
+}
+static int by_hits(const void *a, const void *b) {
+    unsigned ha = ((cache_stat_t *)a)->hits, hb = ((cache_stat_t *)b)->hits;
+    return (ha < hb) - (ha > hb);
+}
+
+/**
+ * @brief
+ *      get the top n items by size or hits
+ *
+ * A snapshot is taken as a reader, so readers are not blocked, then
+ * it's sorted without any lock
+ *
+ * @param 
+ *      cp: pointer to cache_t
+ *      n: number of items wanted
+ *      by_hit: 1 to sort by hits, 0 by size
+ *      out: array of n entries, filled with the top ones
+ * @ret 
+ *      number of entries filled
+ */
+int cache_top(cache_t *cp, int n, int by_hit, cache_stat_t *out) {
+    cache_item *ptr;
+    cache_stat_t *all;
+    int cnt = 0, max;
+
+    reader_lock();
+    max = cp->cache_cnt;
+    all = Malloc((max + 1) * sizeof(cache_stat_t));
+    for (ptr = cp->head; ptr && cnt < max; ptr = ptr->next, cnt++) {
+        strncpy(all[cnt].tag, ptr->tag, MAXLINE - 1);
+        all[cnt].tag[MAXLINE - 1] = '\0';
+        all[cnt].vary = (NULL != ptr->vary);
+        all[cnt].size = ptr->size;
+        all[cnt].hits = ptr->hits;
+        all[cnt].priority = ptr->priority;
+    }
+    reader_unlock();
+
+    qsort(all, cnt, sizeof(cache_stat_t), by_hit ? by_hits : by_size);
+    if (n > cnt) {
+        n = cnt;
+    }
+    memcpy(out, all, n * sizeof(cache_stat_t));
+    Free(all);
+    return n;
+}
@@ -4,30 +4,79 @@
 #define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
 
+#include <stdint.h>
+#include "sketch.h"
+
 struct cache_item {
-    char *tag;         /// will be host:port/path
+    char *tag;         /// canonical host[:port]/path, see http_canonical_tag
+    uint64_t hash;     /// hash of tag, compared before tag
+    char *vary;        /// vary signature, NULL if response not varies
     char *data;
     int size;
-    unsigned int age;  /// may be overflow, but don't care 
-                       /// because it's not strict LRU
+    unsigned int hits; /// number of accesses, including insertion
+    double priority;   /// given by policy, lowest one is evicted
     struct cache_item *next;
+    int picked;        /// 1 while write_cache holds it as a victim
+    struct cache_item *next_victim;  /// victims picked by write_cache
 };
 
 typedef struct cache_item cache_item;
 
+typedef struct cache_t cache_t;
+
+/** eviction policy, see cache.c for supported ones */
+typedef struct {
+    const char *name;
+    /* return new priority of item, called on insert and on hit */
+    double (*priority)(cache_t *cp, cache_item *item);
+    /* called before victim is removed, NULL if not needed */
+    void (*evicted)(cache_t *cp, cache_item *victim);
+} cache_policy_t;
+
+/** snapshot of an item, for inspection */
 typedef struct {
+    char tag[MAXLINE];
+    int vary;          /// 1 if it's one variant of a Vary'd tag
+    int size;
+    unsigned int hits;
+    double priority;
+} cache_stat_t;
+
+struct cache_t {
     int total_size;    /// current usd cache size 
+    int max_size;      /// capacity, MAX_CACHE_SIZE by default
     int cache_cnt;     /// number of current caches
     struct cache_item *head; /// it's a linked list 
-} cache_t;
+    const cache_policy_t *policy; /// eviction policy
+    double clock;      /// logical time, used by lru
+    double inflation;  /// value L, used by gdsf and lfuda
+    int admission;     /// 1 to use TinyLFU admission filter
+    sketch_t sketch;   /// access frequency of tags, for admission
+    unsigned int evict_cnt;  /// number of evicted items
+    unsigned int reject_cnt; /// number of items rejected by admission
+};
 
 
-void cache_init(cache_t *cp);
+int cache_init(cache_t *cp, const char *policy, int admission);
 void cache_deinit(cache_t *cp);
 
 /* return 1 if cache hit */
-int read_cache(cache_t *cp, const char *tag, char *out_data, int *out_size);
+int read_cache(cache_t *cp, const char *tag, const char *req_hdrs,
+               char *out_data, int *out_size);
+/* return 1 if cached, without counting it as an access */
+int probe_cache(cache_t *cp, const char *tag, const char *req_hdrs);
 /* write the target data to cache */
-void write_cache(cache_t *cp, const char *tag, const char *data, int size);
+void write_cache(cache_t *cp, const char *tag, const char *vary,
+                 const char *data, int size);
+/* write a raw response to cache if it's cacheable */
+void cache_response(cache_t *cp, const char *tag, const char *req_hdrs,
+                    const char *data, int size);
+
+/* change capacity, evicting items if it shrinks */
+void cache_resize(cache_t *cp, int max_size);
+/* remove items of tag or tags of prefix, return number removed */
+int purge_cache(cache_t *cp, const char *tag, int prefix);
+/* fill out with top n items by size or hits, return number filled */
+int cache_top(cache_t *cp, int n, int by_hit, cache_stat_t *out);
 
 #endif 
@@ -0,0 +1,309 @@
+#include "csapp.h"
+#include "config.h"
+#include "cache.h"
+
+/**
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * @note
+ *      Parse command line options into conf_t.
+ *      The last argument is always the port to listen.
+ *      With -c, options are also read from a file, written the same
+ *      way as on command line, e.g.
+ *          # 20 per second, 50 at once
+ *          -r 20:50
+ *          -t idle=60
+ *      Options on command line win over the ones in file
+ **/
+
+#define CONF_MAX_ARGS 256   /// words in config file at most
+
+/**
+ * @brief
+ *      set default configuration
+ * @param
+ *      cf: pointer to conf_t
+ */
+void conf_init(conf_t *cf) {
+    cf->port = 0;
+    cf->config = NULL;
+    cf->file_buf = NULL;
+    cf->inflate = 0;
+    cf->admission = 0;
+    cf->policy = NULL;
+    cf->engine = NULL;
+    cf->workers = 32;
+    cf->huge_pages = 0;
+    cf->prefetch = 0;
+    cf->admin = NULL;
+    cf->trace = NULL;
+    cf->rate = 0;
+    cf->burst = 0;
+    cf->client_queue = 100;
+    cf->cache_size = MAX_CACHE_SIZE;
+    cf->header_timeout = 10 * 1000;
+    cf->connect_timeout = 5 * 1000;
+    cf->attempt_timeout = 2 * 1000;
+    cf->idle_timeout = 30 * 1000;
+    cf->total_timeout = 120 * 1000;
+    cf->drain_timeout = 30 * 1000;
+}
+
+/**
+ * @brief
+ *      set one timeout by "name=seconds"
+ * @param
+ *      cf: pointer to conf_t
+ *      arg: e.g. "header=10", name is header/connect/attempt/idle/
+ *           total/drain
+ * @ret
+ *      0 if OK, -1 if error
+ */
+static int set_timeout(conf_t *cf, const char *arg) {
+    const char *eq = strchr(arg, '=');
+    int ms;
+
+    if (NULL == eq) {
+        return -1;
+    }
+    ms = (int)(atof(eq + 1) * 1000);
+    if (ms < 0) {
+        return -1;
+    }
+
+    if (!strncmp(arg, "header=", 7)) {
+        cf->header_timeout = ms;
+    } else if (!strncmp(arg, "connect=", 8)) {
+        cf->connect_timeout = ms;
+    } else if (!strncmp(arg, "attempt=", 8)) {
+        cf->attempt_timeout = ms;
+    } else if (!strncmp(arg, "idle=", 5)) {
+        cf->idle_timeout = ms;
+    } else if (!strncmp(arg, "total=", 6)) {
+        cf->total_timeout = ms;
+    } else if (!strncmp(arg, "drain=", 6)) {
+        cf->drain_timeout = ms;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      set rate limit by "rate[:burst]"
+ * @param
+ *      cf: pointer to conf_t
+ *      arg: e.g. "20:50", 20 per second and 50 at once
+ * @ret
+ *      0 if OK, -1 if error
+ */
+static int set_rate(conf_t *cf, const char *arg) {
+    const char *colon = strchr(arg, ':');
+
+    cf->rate = atof(arg);
+    cf->burst = (NULL == colon) ? 0 : atof(colon + 1);
+    return (cf->rate < 0 || cf->burst < 0) ? -1 : 0;
+}
+
+/**
+ * @brief
+ *      parse options, from command line or config file
+ * @param
+ *      cf: pointer to conf_t
+ *      argc/argv: options begin at argv[1]
+ * @ret
+ *      0 if OK, -1 if error
+ */
+static int parse_opts(conf_t *cf, int argc, char **argv) {
+    int opt;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "aC:c:e:f:Hp:q:r:s:T:t:w:z")) != -1) {
+        switch (opt) {
+            case 'a':
+                cf->admission = 1;
+                break;
+            case 'C':
+                if ((cf->cache_size = atoi(optarg)) <= 0) {
+                    return -1;
+                }
+                break;
+            case 'c':
+                cf->config = optarg;
+                break;
+            case 'e':
+                if (strcmp(optarg, "blocking") && strcmp(optarg, "uring")) {
+                    return -1;
+                }
+                cf->engine = optarg;
+                break;
+            case 'f':
+                if ((cf->prefetch = atoi(optarg)) < 0) {
+                    return -1;
+                }
+                break;
+            case 'H':
+                cf->huge_pages = 1;
+                break;
+            case 'p':
+                cf->policy = optarg;
+                break;
+            case 'q':
+                if ((cf->client_queue = atoi(optarg)) <= 0) {
+                    return -1;
+                }
+                break;
+            case 'r':
+                if (set_rate(cf, optarg)) {
+                    return -1;
+                }
+                break;
+            case 's':
+                cf->admin = optarg;
+                break;
+            case 'T':
+                cf->trace = optarg;
+                break;
+            case 't':
+                if (set_timeout(cf, optarg)) {
+                    return -1;
+                }
+                break;
+            case 'w':
+                if ((cf->workers = atoi(optarg)) <= 0) {
+                    return -1;
+                }
+                break;
+            case 'z':
+                cf->inflate = 1;
+                break;
+            default:
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      read options of config file cf->config into cf
+ * @note
+ *      the content is kept in cf->file_buf, as string options point 
+ *      to it, the caller frees it if cf is discarded
+ * @param
+ *      cf: pointer to conf_t, cf->config is set
+ * @ret
+ *      0 if OK, -1 if error
+ */
+int conf_load(conf_t *cf) {
+    char *words[CONF_MAX_ARGS];
+    char *p, *line, *next;
+    FILE *fp;
+    long size;
+    int n = 1;
+
+    if (NULL == (fp = fopen(cf->config, "r"))) {
+        fprintf(stderr, "can't open config file %s: %s\n", 
+                cf->config, strerror(errno));
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    cf->file_buf = Malloc(size + 1);
+    size = fread(cf->file_buf, 1, size, fp);
+    cf->file_buf[size] = '\0';
+    fclose(fp);
+
+    // split into words like a shell, a '#' comments out the line
+    words[0] = cf->config;
+    for (line = cf->file_buf; NULL != line; line = next) {
+        if (NULL != (next = strchr(line, '\n'))) {
+            *next++ = '\0';
+        }
+        if (NULL != (p = strchr(line, '#'))) {
+            *p = '\0';
+        }
+        for (p = strtok(line, " \t\r"); p; p = strtok(NULL, " \t\r")) {
+            if (n == CONF_MAX_ARGS - 1) {
+                return -1;
+            }
+            words[n++] = p;
+        }
+    }
+    words[n] = NULL;
+
+    if (parse_opts(cf, n, words)) {
+        fprintf(stderr, "bad option in config file %s\n", cf->config);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      parse command line options, and config file if -c is given
+ * @param
+ *      cf: pointer to conf_t, should be initialized by conf_init
+ *      argc/argv: from main
+ * @ret
+ *      0 if OK, -1 if error
+ */
+int conf_parse_args(conf_t *cf, int argc, char **argv) {
+    if (parse_opts(cf, argc, argv)) {
+        return -1;
+    }
+    // port is the only positional argument
+    if (optind != argc - 1) {
+        return -1;
+    }
+    cf->port = atoi(argv[optind]);
+
+    // read file, then command line again so it wins
+    if (NULL != cf->config && 
+        (conf_load(cf) || parse_opts(cf, argc, argv))) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      print usage
+ * @param
+ *      prog: name of program
+ */
+void conf_usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-a] [-C bytes] [-c file] [-e engine] "
+                    "[-f budget] [-H] "
+                    "[-p policy] [-q n] [-r rate[:burst]] [-s path] "
+                    "[-T file] [-t name=secs]... [-w workers] [-z] "
+                    "<port>\n", prog);
+    fprintf(stderr, "  -a  use TinyLFU admission filter for cache\n");
+    fprintf(stderr, "  -C  capacity of cache in bytes, %d by default\n",
+            MAX_CACHE_SIZE);
+    fprintf(stderr, "  -c  read options from file too, it's read again "
+                    "on SIGHUP\n");
+    fprintf(stderr, "  -e  client I/O engine: blocking(default), or "
+                    "uring to batch syscalls with io_uring\n");
+    fprintf(stderr, "  -f  prefetch up to budget links on same origin "
+                    "of each html page\n");
+    fprintf(stderr, "  -H  put work buffers on huge pages\n");
+    fprintf(stderr, "  -p  cache eviction policy: lru(default), gdsf "
+                    "for object hit ratio, lfuda for byte hit ratio\n");
+    fprintf(stderr, "  -q  requests of a client queued at most, 100 by "
+                    "default\n");
+    fprintf(stderr, "  -r  new connections per second of a client and "
+                    "burst, no limit by default\n");
+    fprintf(stderr, "  -s  serve admin commands on UNIX socket path\n");
+    fprintf(stderr, "  -T  record requests to a binary trace file, "
+                    "see replay\n");
+    fprintf(stderr, "  -t  timeout, name is header(10), connect(5), "
+                    "attempt(2) for each address, idle(30), "
+                    "total(120) or drain(30) on shutdown, 0 to "
+                    "disable\n");
+    fprintf(stderr, "  -w  number of worker threads, 32 by default\n");
+    fprintf(stderr, "  -z  decompress gzip responses for clients "
+                    "not accepting it\n");
+}
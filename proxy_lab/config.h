@@ -0,0 +1,42 @@
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+/** 
+ * run time configuration of proxy, set at startup. Options can also
+ * be put in a config file, the ones marked "reload" are applied again
+ * when it's reloaded on SIGHUP
+ */
+typedef struct {
+    int port;          /// port to listen
+    char *config;      /// path of config file, NULL if not used
+    char *file_buf;    /// content of config file, strings may point to it
+    int inflate;       /// 1 to decompress gzip for clients not accept it, reload
+    int admission;     /// 1 to use TinyLFU admission for cache
+    char *policy;      /// cache eviction policy, NULL for default
+    char *engine;      /// "blocking"(default) or "uring" for client I/O
+    int workers;       /// number of worker threads, reload
+    int huge_pages;    /// 1 to put work buffers on huge pages
+    int prefetch;      /// links prefetched per html page, 0 to disable
+    char *admin;       /// path of admin UNIX socket, NULL to disable
+    char *trace;       /// path of trace file, NULL to disable
+    double rate;       /// new connections per second of a client, 0 no limit, reload
+    double burst;      /// connections of a client allowed at once, reload
+    int client_queue;  /// requests of a client queued at most, reload
+    int cache_size;    /// capacity of cache in bytes, reload
+    /** deadlines in ms, 0 to disable, all reload */
+    int header_timeout;   /// read whole request header from client
+    int connect_timeout;  /// connect to real host
+    int attempt_timeout;  /// connect to one address of real host
+    int idle_timeout;     /// no progress while relaying
+    int total_timeout;    /// whole request
+    int drain_timeout;    /// finishing in-flight requests on shutdown
+} conf_t;
+
+void conf_init(conf_t *cf);
+/* return 0 if OK, -1 if error */
+int conf_parse_args(conf_t *cf, int argc, char **argv);
+/* read options of config file cf->config, return 0 if OK, -1 if error */
+int conf_load(conf_t *cf);
+void conf_usage(const char *prog);
+
+#endif /* __CONFIG_H__ */
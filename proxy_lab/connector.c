@@ -0,0 +1,444 @@
+#include "csapp.h"
+#include "connector.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+
+/**
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * @note
+ *      Asynchronous connects to real hosts, so a worker doesn't 
+ *      wait for a dead host. A single thread drives all jobs with 
+ *      epoll, in Happy Eyeballs style (RFC 8305):
+ *      1. addresses are ordered by interleaving IPv6 and IPv4, 
+ *         starting with the family getaddrinfo prefers
+ *      2. first address is tried at once, if it's neither connected
+ *         nor failed in CONN_ATTEMPT_DELAY ms, the next one is 
+ *         started while keeping the first, and so on. A failed 
+ *         attempt starts the next one immediately
+ *      3. first connected attempt wins and the others are closed
+ *      4. each attempt has its own deadline, and the job has one
+ *      The job's done callback is called from connector thread, after
+ *      all events and timers of the round it finished in, as done may
+ *      free the job while a later event of the round points to it.
+ **/
+
+#define CONN_MAX_WAIT 1000          /// ms, longest sleep of epoll_wait
+#define CONN_NO_DEADLINE (1LL << 40) /// ms, for timeout_ms of 0
+
+/** Static global variable */
+static int epfd;                    /// epoll of all attempts
+static int wakefd;                  /// eventfd to wake up the thread
+static conn_job_t *incoming;        /// jobs submitted, not taken yet
+static conn_job_t *jobs;            /// jobs in progress
+static conn_job_t *finished;        /// jobs finished in this round
+static sem_t mutex;                 /// protects incoming
+
+/** Static helper function */
+
+/**
+ * @brief
+ *      current time of monotonic clock in ms
+ */
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief
+ *      order addresses by interleaving families
+ * @param
+ *      job: job whose addrs is resolved
+ */
+static void order_addrs(conn_job_t *job) {
+    struct addrinfo *p;
+    struct addrinfo *v6[CONN_MAX_ATTEMPTS], *v4[CONN_MAX_ATTEMPTS];
+    int n6 = 0, n4 = 0, i6 = 0, i4 = 0;
+    int v6_first = (NULL != job->addrs && job->addrs->ai_family == AF_INET6);
+
+    for (p = job->addrs; p; p = p->ai_next) {
+        if (p->ai_family == AF_INET6 && n6 < CONN_MAX_ATTEMPTS) {
+            v6[n6++] = p;
+        } else if (p->ai_family == AF_INET && n4 < CONN_MAX_ATTEMPTS) {
+            v4[n4++] = p;
+        }
+    }
+
+    job->n_addr = 0;
+    while (job->n_addr < CONN_MAX_ATTEMPTS && (i6 < n6 || i4 < n4)) {
+        if (v6_first ? (i6 < n6) : (i4 >= n4)) {
+            job->order[job->n_addr++] = v6[i6++];
+            if (i4 < n4 && job->n_addr < CONN_MAX_ATTEMPTS) {
+                job->order[job->n_addr++] = v4[i4++];
+            }
+        } else {
+            job->order[job->n_addr++] = v4[i4++];
+            if (i6 < n6 && job->n_addr < CONN_MAX_ATTEMPTS) {
+                job->order[job->n_addr++] = v6[i6++];
+            }
+        }
+    }
+}
+
+/**
+ * @brief
+ *      close an attempt
+ * @param
+ *      at: attempt to close
+ */
+static void close_attempt(conn_attempt_t *at) {
+    if (at->fd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, at->fd, NULL);
+        close(at->fd);
+        at->fd = -1;
+        at->job->active--;
+    }
+}
+
+/**
+ * @brief
+ *      finish a job, close all attempts other than the winner, 
+ *      and queue it to call its done callback after this round
+ * @param
+ *      job: job to finish
+ *      fd: connected fd, -1 if failed
+ *      err: errno if failed
+ */
+static void finish_job(conn_job_t *job, int fd, int err) {
+    int i;
+
+    for (i = 0; i < job->next; i++) {
+        if (job->attempts[i].fd != fd) {
+            close_attempt(&job->attempts[i]);
+        } else {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+        }
+    }
+    if (fd >= 0) {  // back to blocking mode for the worker
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+    }
+
+    // unlink from jobs
+    if (NULL == job->prev) {
+        jobs = job->next_job;
+    } else {
+        job->prev->next_job = job->next_job;
+    }
+    if (NULL != job->next_job) {
+        job->next_job->prev = job->prev;
+    }
+
+    freeaddrinfo(job->addrs);
+    job->addrs = NULL;
+    job->fd = fd;
+    job->err = err;
+    job->next_job = finished;
+    finished = job;
+}
+
+/**
+ * @brief
+ *      call done callbacks of jobs finished in this round
+ */
+static void call_done(void) {
+    conn_job_t *job;
+
+    while (finished) {
+        job = finished;
+        finished = job->next_job;
+        job->done(job);
+    }
+}
+
+/**
+ * @brief
+ *      start connecting to next address of a job
+ * @param
+ *      job: the job
+ * @ret
+ *      1 if job is finished by this attempt, 0 otherwise
+ */
+static int start_attempt(conn_job_t *job) {
+    conn_attempt_t *at;
+    struct addrinfo *ai;
+    struct epoll_event ev;
+    int fd;
+
+    while (job->next < job->n_addr) {
+        at = &job->attempts[job->next];
+        ai = job->order[job->next];
+        job->next++;
+        job->last_start = now_ms();
+
+        at->job = job;
+        at->fd = -1;
+        at->start = job->last_start;
+        fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd < 0) {
+            job->err = errno;
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            at->fd = fd;
+            job->active++;
+            finish_job(job, fd, 0);   // connected at once, e.g. loopback
+            return 1;
+        }
+        if (errno != EINPROGRESS) {
+            job->err = errno;
+            close(fd);
+            continue;               // try next one immediately
+        }
+
+        at->fd = fd;
+        job->active++;
+        ev.events = EPOLLOUT;
+        ev.data.ptr = at;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        return 0;
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      check timers of a job: start next attempt, expire attempts
+ *      and the job itself
+ * @param
+ *      job: the job
+ *      now: current time
+ * @ret
+ *      1 if job is finished, 0 otherwise
+ */
+static int check_job(conn_job_t *job, long long now) {
+    int i;
+
+    if (now >= job->deadline) {
+        finish_job(job, -1, ETIMEDOUT);
+        return 1;
+    }
+    for (i = 0; i < job->next; i++) {
+        if (job->attempts[i].fd >= 0 && job->attempt_ms > 0 &&
+            now >= job->attempts[i].start + job->attempt_ms) {
+            close_attempt(&job->attempts[i]);
+            job->err = ETIMEDOUT;
+        }
+    }
+    if (job->next < job->n_addr && 
+        (job->active == 0 || now >= job->last_start + CONN_ATTEMPT_DELAY)) {
+        if (start_attempt(job)) {
+            return 1;
+        }
+    }
+    if (job->active == 0 && job->next >= job->n_addr) {
+        finish_job(job, -1, job->err ? job->err : ECONNREFUSED);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      ms to wait until next timer of any job
+ * @param
+ *      now: current time
+ * @ret
+ *      ms to wait, -1 if no job
+ */
+static int next_wait(long long now) {
+    conn_job_t *job;
+    long long when = -1, t;
+    int i;
+
+    for (job = jobs; job; job = job->next_job) {
+        t = job->deadline;
+        if (job->next < job->n_addr && 
+            job->last_start + CONN_ATTEMPT_DELAY < t) {
+            t = job->last_start + CONN_ATTEMPT_DELAY;
+        }
+        for (i = 0; i < job->next; i++) {
+            if (job->attempts[i].fd >= 0 && job->attempt_ms > 0 &&
+                job->attempts[i].start + job->attempt_ms < t) {
+                t = job->attempts[i].start + job->attempt_ms;
+            }
+        }
+        if (when < 0 || t < when) {
+            when = t;
+        }
+    }
+    if (when < 0) {
+        return -1;
+    }
+    if (when > now + CONN_MAX_WAIT) {
+        return CONN_MAX_WAIT;   // e.g. job without deadline
+    }
+    return (when > now) ? (int)(when - now) : 0;
+}
+
+/**
+ * @brief
+ *      take submitted jobs into jobs list and start them
+ */
+static void take_incoming(void) {
+    conn_job_t *list, *job;
+    uint64_t cnt;
+
+    if (read(wakefd, &cnt, sizeof(cnt)) < 0) {
+        ;  // nothing to read, fine
+    }
+    P(&mutex);
+    list = incoming;
+    incoming = NULL;
+    V(&mutex);
+
+    while (list) {
+        job = list;
+        list = list->next_job;
+
+        job->prev = NULL;
+        job->next_job = jobs;
+        if (NULL != jobs) {
+            jobs->prev = job;
+        }
+        jobs = job;
+
+        if (!start_attempt(job)) {
+            check_job(job, now_ms());  // all addresses may fail at once
+        }
+    }
+}
+
+/**
+ * @brief
+ *      connector thread, wait for attempts and timers
+ */
+static void *connector_thread(void *vargp) {
+    struct epoll_event evs[64];
+    conn_attempt_t *at;
+    conn_job_t *job, *next;
+    int i, n, err;
+    socklen_t len;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        n = epoll_wait(epfd, evs, 64, next_wait(now_ms()));
+        for (i = 0; i < n; i++) {
+            if (NULL == evs[i].data.ptr) {
+                take_incoming();
+                continue;
+            }
+            at = evs[i].data.ptr;
+            if (at->fd < 0) {
+                continue;  // closed by an earlier event of this round
+            }
+            len = sizeof(err);
+            if (getsockopt(at->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+                err = errno;
+            }
+            if (err == 0) {
+                finish_job(at->job, at->fd, 0);
+            } else {
+                at->job->err = err;
+                close_attempt(at);
+                check_job(at->job, now_ms());  // start next one at once
+            }
+        }
+
+        // timers
+        for (job = jobs; job; job = next) {
+            next = job->next_job;
+            check_job(job, now_ms());
+        }
+
+        // no event of this round points to a job any more
+        call_done();
+    }
+    return NULL;
+}
+
+/** public function for other program to call */
+
+/**
+ * @brief
+ *      initialize connector and start its thread
+ */
+void connector_init(void) {
+    struct epoll_event ev;
+    pthread_t tid;
+
+    incoming = NULL;
+    jobs = NULL;
+    finished = NULL;
+    Sem_init(&mutex, 0, 1);
+    if ((epfd = epoll_create1(0)) < 0) {
+        unix_error("epoll_create1 error");
+        exit(1);
+    }
+    if ((wakefd = eventfd(0, EFD_NONBLOCK)) < 0) {
+        unix_error("eventfd error");
+        exit(1);
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+    Pthread_create(&tid, NULL, connector_thread, NULL);
+}
+
+/**
+ * @brief
+ *      resolve hostname:port for a job
+ * @note
+ *      name resolution is still blocking, it's done by caller's 
+ *      thread before submitting
+ * @param
+ *      job: the job
+ *      hostname/port: the real host
+ * @ret
+ *      0 if OK, -1 if error
+ */
+int connector_resolve(conn_job_t *job, const char *hostname, int port) {
+    struct addrinfo hints;
+    char port_str[MAXPORTLEN];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    sprintf(port_str, "%d", port);
+    if (getaddrinfo(hostname, port_str, &hints, &job->addrs) != 0) {
+        job->addrs = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      hand a resolved job to connector thread
+ * @param
+ *      job: the job, addrs/timeout_ms/attempt_ms/done/arg are set
+ */
+void connector_submit(conn_job_t *job) {
+    uint64_t one = 1;
+
+    order_addrs(job);
+    job->fd = -1;
+    job->err = 0;
+    job->next = 0;
+    job->active = 0;
+    job->deadline = now_ms() + \
+                    ((job->timeout_ms > 0) ? job->timeout_ms : CONN_NO_DEADLINE);
+    job->last_start = 0;
+
+    P(&mutex);
+    job->next_job = incoming;
+    incoming = job;
+    V(&mutex);
+
+    if (write(wakefd, &one, sizeof(one)) < 0) {
+        unix_error("connector_submit error");
+    }
+}
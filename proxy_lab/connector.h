@@ -0,0 +1,47 @@
+#ifndef __CONNECTOR_H__
+#define __CONNECTOR_H__
+
+#include "csapp.h"
+
+#define CONN_MAX_ATTEMPTS 8      /// addresses tried per job at most
+#define CONN_ATTEMPT_DELAY 250   /// ms to wait before racing next address
+
+struct conn_job;
+
+/** one connect attempt to one address */
+typedef struct {
+    struct conn_job *job;  /// owner
+    int fd;                /// -1 if not started or finished
+    long long start;       /// ms when it's started
+} conn_attempt_t;
+
+/** a request to connect to any of the resolved addresses */
+typedef struct conn_job {
+    /** set by submitter */
+    struct addrinfo *addrs;    /// resolved addresses, freed by connector
+    int timeout_ms;            /// deadline of whole job, 0 for none
+    int attempt_ms;            /// deadline of each attempt, 0 for none
+    void (*done)(struct conn_job *job);  /// called when finished
+    void *arg;                 /// submitter's context
+    /** result */
+    int fd;                    /// connected fd, -1 if failed
+    int err;                   /// errno if failed
+    /** internal state */
+    struct addrinfo *order[CONN_MAX_ATTEMPTS];  /// addresses to try
+    int n_addr;                /// number of addresses in order
+    int next;                  /// next address to try
+    int active;                /// number of attempts in flight
+    conn_attempt_t attempts[CONN_MAX_ATTEMPTS];
+    long long deadline;        /// ms
+    long long last_start;      /// ms when last attempt was started
+    struct conn_job *prev;
+    struct conn_job *next_job;
+} conn_job_t;
+
+void connector_init(void);
+/* resolve hostname:port into job->addrs, return 0 if OK */
+int connector_resolve(conn_job_t *job, const char *hostname, int port);
+/* hand a job to connector thread, job->done is called later */
+void connector_submit(conn_job_t *job);
+
+#endif /* __CONNECTOR_H__ */
@@ -5,15 +5,16 @@
  * Hacked note:
  *      1. xxx_error functions
  *         comment exit()
- *      2. rio_read()
- *         close fd whenever ECONNRESET encountered
- *      3. Rio_writen()
- *         a. change return from void to int 
- *         b. close fd on broken pipe
+ *      2. Rio_writen()
+ *         change return from void to int, it never closes fd,
+ *         closing is always the caller's job
+ *      3. open_clientfd_timeout()
+ *         connect with a timeout by non-blocking connect and poll
  */
 
 /* $begin csapp.c */
 #include "csapp.h"
+#include <poll.h>
 
 /* Updated with a reentrant open_clientfd_r function */
 
@@ -606,11 +607,6 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
 			   sizeof(rp->rio_buf));
 	if (rp->rio_cnt < 0) {
-            if (errno == ECONNRESET){ // hacked here
-                Close(rp->rio_fd);
-                return -1;
-            }
-
 	    if (errno != EINTR) /* interrupted by sig handler return */
 		return -1;      
 	}
@@ -710,18 +706,12 @@ ssize_t Rio_readn(int fd, void *ptr, size_t nbytes)
 
 /* Hacked
  *
- * @note 
- *      close fd on broken pipe
- *   
  * @ret 0 on success
  *      -1 on error
  * */ 
 int Rio_writen(int fd, void *usrbuf, size_t n) 
 {
     if (rio_writen(fd, usrbuf, n) != n) {
-        if ( errno == EPIPE){
-            Close(fd);  // close fd on broken pipe         
-        }
 	unix_error("Rio_writen error");
         return -1;
     }
@@ -829,6 +819,85 @@ int open_clientfd_r(char *hostname, int port) {
     }
 }
 
+/*
+ * open_clientfd_timeout - open_clientfd_r with a timeout
+ *   Each address is tried by a non-blocking connect and poll, the 
+ *   timeout covers all attempts. Returns -1 and sets errno on error,
+ *   errno is ETIMEDOUT if timeout. timeout_ms <= 0 means no limit.
+ *   Note that name resolution is not covered by timeout.
+ */
+int open_clientfd_timeout(char *hostname, int port, int timeout_ms) {
+    int clientfd = -1;
+    struct addrinfo hints, *addlist, *p;
+    struct pollfd pfd;
+    char port_str[MAXPORTLEN];
+    int flags, err, rv;
+    socklen_t len = sizeof(err);
+    struct timeval start, cur;
+    int remain;
+
+    gettimeofday(&start, NULL);
+
+    /* Get a list of addrinfo structs */
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    sprintf(port_str, "%d", port);
+    if ((rv = getaddrinfo(hostname, port_str, &hints, &addlist)) != 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    /* Walk the list, using each addrinfo to try to connect */
+    for (p = addlist; p; p = p->ai_next) {
+        remain = -1;
+        if (timeout_ms > 0) {
+            gettimeofday(&cur, NULL);
+            remain = timeout_ms - ((cur.tv_sec - start.tv_sec) * 1000 + 
+                                   (cur.tv_usec - start.tv_usec) / 1000);
+            if (remain <= 0) {
+                errno = ETIMEDOUT;
+                break;
+            }
+        }
+
+        if ((clientfd = socket(p->ai_family, SOCK_STREAM, 0)) < 0) {
+            break;
+        }
+        flags = fcntl(clientfd, F_GETFL, 0);
+        fcntl(clientfd, F_SETFL, flags | O_NONBLOCK);
+
+        if (connect(clientfd, p->ai_addr, p->ai_addrlen) == 0) {
+            fcntl(clientfd, F_SETFL, flags);
+            break; /* success */
+        }
+        if (errno == EINPROGRESS) {
+            pfd.fd = clientfd;
+            pfd.events = POLLOUT;
+            while ((rv = poll(&pfd, 1, remain)) < 0 && errno == EINTR)
+                ;
+            if (rv == 0) {
+                errno = ETIMEDOUT;
+            } else if (rv > 0 && 
+                getsockopt(clientfd, SOL_SOCKET, SO_ERROR, &err, &len) == 0) {
+                if (err == 0) {
+                    fcntl(clientfd, F_SETFL, flags);
+                    break; /* success */
+                }
+                errno = err;
+            }
+        }
+        err = errno;
+        close(clientfd);
+        clientfd = -1;
+        errno = err;
+    } 
+
+    /* Clean up */
+    freeaddrinfo(addlist);
+    return clientfd;
+}
+
 /*  
  * open_listenfd - open and return a listening socket on port
  *     Returns -1 and sets errno on Unix error.
@@ -890,6 +959,16 @@ int Open_clientfd_r(char *hostname, int port)
     return rc;
 }
 
+int Open_clientfd_timeout(char *hostname, int port, int timeout_ms) 
+{
+    int rc;
+
+    if ((rc = open_clientfd_timeout(hostname, port, timeout_ms)) < 0) {
+        unix_error("Open_clientfd_timeout error");
+    }
+    return rc;
+}
+
 int Open_listenfd(int port) 
 {
     int rc;
@@ -4,6 +4,7 @@
  * Hacked note 
  *      1. constant define MAXPORTLEN
  *      2. Change return type of Rio_writen() from void to int
+ *      3. Add open_clientfd_timeout()
  * */
 
 /* $begin csapp.h */
@@ -168,11 +169,13 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
 /* Client/server helper functions */
 int open_clientfd(char *hostname, int portno);
 int open_clientfd_r(char *hostname, int portno);
+int open_clientfd_timeout(char *hostname, int portno, int timeout_ms);
 int open_listenfd(int portno);
 
 /* Wrappers for client/server helper functions */
 int Open_clientfd(char *hostname, int port);
 int Open_clientfd_r(char *hostname, int port);
+int Open_clientfd_timeout(char *hostname, int port, int timeout_ms);
 int Open_listenfd(int port); 
 
 #endif /* __CSAPP_H__ */
@@ -0,0 +1,263 @@
+#include "csapp.h"
+#include "fairq.h"
+
+/**
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * @note
+ *      Fair queue in front of workers, replacing the single FIFO so
+ *      one aggressive client can't starve others.
+ *      1. each client address has a sub-queue, clients with items
+ *         are in a ring and served round robin, one item per turn
+ *      2. a client can queue client_max items at most, and all
+ *         clients max items, a new request over them is rejected.
+ *         A request coming back from connector is always accepted,
+ *         it's already counted
+ *      3. each client has a token bucket of burst tokens refilled
+ *         at rate per second, a new connection takes one token
+ *      4. clients with nothing queued and a full bucket are swept
+ *         when there are too many of them
+ **/
+
+/** Static helper function */
+
+/**
+ * @brief
+ *      current time of monotonic clock in ms
+ */
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief
+ *      refill token bucket of a client
+ * @note
+ *      not thread safe, the caller should hold mutex
+ */
+static void refill(fairq_t *fq, fq_client_t *c, long long now) {
+    c->tokens += (now - c->last_ms) * fq->rate / 1000;
+    if (c->tokens > fq->burst) {
+        c->tokens = fq->burst;
+    }
+    c->last_ms = now;
+}
+
+/**
+ * @brief
+ *      free idle clients, i.e., nothing queued and bucket is full
+ * @note
+ *      not thread safe, the caller should hold mutex
+ */
+static void sweep(fairq_t *fq) {
+    fq_client_t **pp, *c;
+    long long now = now_ms();
+    int i;
+
+    for (i = 0; i < FQ_BUCKETS; i++) {
+        for (pp = &fq->buckets[i]; NULL != (c = *pp); ) {
+            refill(fq, c, now);
+            if (c->len == 0 && c->tokens >= fq->burst) {
+                *pp = c->next;
+                Free(c);
+                fq->nclients--;
+            } else {
+                pp = &c->next;
+            }
+        }
+    }
+}
+
+/**
+ * @brief
+ *      find a client by key, create it if not found
+ * @note
+ *      not thread safe, the caller should hold mutex
+ */
+static fq_client_t *get_client(fairq_t *fq, unsigned int key) {
+    fq_client_t *c;
+    unsigned int b = (key * 2654435761u) % FQ_BUCKETS;
+
+    for (c = fq->buckets[b]; c; c = c->next) {
+        if (c->key == key) {
+            return c;
+        }
+    }
+
+    if (fq->nclients >= FQ_MAX_CLIENTS) {
+        sweep(fq);
+    }
+    c = Malloc(sizeof(fq_client_t));
+    c->key = key;
+    c->tokens = fq->burst;
+    c->last_ms = now_ms();
+    c->head = c->tail = NULL;
+    c->len = 0;
+    c->rr_next = NULL;
+    c->next = fq->buckets[b];
+    fq->buckets[b] = c;
+    fq->nclients++;
+    return c;
+}
+
+/** public function for other program to call */
+
+/**
+ * @brief
+ *      initialize fair queue
+ * @param
+ *      fq: pointer to fairq_t
+ *      max: items queued at most
+ *      client_max: items of one client at most
+ *      rate: new connections per second of one client, 0 for no limit
+ *      burst: connections allowed at once, rate is used if it's less
+ */
+void fq_init(fairq_t *fq, int max, int client_max, double rate, double burst) {
+    memset(fq->buckets, 0, sizeof(fq->buckets));
+    fq->rr = NULL;
+    fq->nclients = 0;
+    fq->len = 0;
+    fq->max = max;
+    Sem_init(&fq->mutex, 0, 1);
+    fq_set_limits(fq, client_max, rate, burst);
+    Sem_init(&fq->items, 0, 0);
+    fq->rate_reject_cnt = 0;
+    fq->full_reject_cnt = 0;
+}
+
+/**
+ * @brief
+ *      change limits of clients, queued items are kept even if they're
+ *      over the new limit, buckets are capped by new burst on refill
+ * @param
+ *      fq: pointer to fairq_t
+ *      client_max/rate/burst: see fq_init
+ */
+void fq_set_limits(fairq_t *fq, int client_max, double rate, double burst) {
+    P(&fq->mutex);
+    fq->client_max = client_max;
+    fq->rate = rate;
+    fq->burst = (burst < rate) ? rate : burst;
+    if (fq->burst < 1) {
+        fq->burst = 1;
+    }
+    V(&fq->mutex);
+}
+
+/**
+ * @brief
+ *      take a token for a new connection of client
+ * @param
+ *      fq: pointer to fairq_t
+ *      key: address of client
+ * @ret
+ *      0 if OK, -1 if client is over rate
+ */
+int fq_admit(fairq_t *fq, unsigned int key) {
+    fq_client_t *c;
+    int rc = 0;
+
+    if (fq->rate <= 0) {
+        return 0;
+    }
+
+    P(&fq->mutex);
+    c = get_client(fq, key);
+    refill(fq, c, now_ms());
+    if (c->tokens >= 1) {
+        c->tokens -= 1;
+    } else {
+        fq->rate_reject_cnt++;
+        rc = -1;
+    }
+    V(&fq->mutex);
+    return rc;
+}
+
+/**
+ * @brief
+ *      queue an item of client
+ * @param
+ *      fq: pointer to fairq_t
+ *      key: address of client
+ *      item: the item
+ *      force: 1 to ignore the limits, for an item already admitted
+ * @ret
+ *      0 if OK, -1 if queue of client or whole queue is full
+ */
+int fq_insert(fairq_t *fq, unsigned int key, void *item, int force) {
+    fq_client_t *c;
+    fq_node_t *node;
+
+    P(&fq->mutex);
+    c = get_client(fq, key);
+    if (!force && (fq->len >= fq->max || c->len >= fq->client_max)) {
+        fq->full_reject_cnt++;
+        V(&fq->mutex);
+        return -1;
+    }
+
+    node = Malloc(sizeof(fq_node_t));
+    node->item = item;
+    node->next = NULL;
+    if (NULL == c->tail) {
+        c->head = node;
+    } else {
+        c->tail->next = node;
+    }
+    c->tail = node;
+
+    // a client getting its first item joins ring as the last one
+    if (c->len++ == 0) {
+        if (NULL == fq->rr) {
+            c->rr_next = c;
+        } else {
+            c->rr_next = fq->rr->rr_next;
+            fq->rr->rr_next = c;
+        }
+        fq->rr = c;
+    }
+    fq->len++;
+    V(&fq->mutex);
+    V(&fq->items);
+    return 0;
+}
+
+/**
+ * @brief
+ *      take first item of next client in ring
+ * @param
+ *      fq: pointer to fairq_t
+ * @ret
+ *      the item
+ */
+void *fq_remove(fairq_t *fq) {
+    fq_client_t *c;
+    fq_node_t *node;
+    void *item;
+
+    P(&fq->items);
+    P(&fq->mutex);
+    c = fq->rr->rr_next;      // first client of ring
+    node = c->head;
+    c->head = node->next;
+    if (NULL == c->head) {
+        c->tail = NULL;
+    }
+
+    if (--c->len > 0) {
+        fq->rr = c;           // it's the last one now
+    } else if (c == fq->rr) {
+        fq->rr = NULL;        // it was the only one
+    } else {
+        fq->rr->rr_next = c->rr_next;
+    }
+    fq->len--;
+    V(&fq->mutex);
+
+    item = node->item;
+    Free(node);
+    return item;
+}
@@ -0,0 +1,53 @@
+#ifndef __FAIRQ_H__
+#define __FAIRQ_H__
+
+#include "csapp.h"
+
+#define FQ_BUCKETS     1024   /// hash buckets of clients
+#define FQ_MAX_CLIENTS 4096   /// idle clients are swept beyond it
+
+/** one queued item */
+typedef struct fq_node {
+    void *item;
+    struct fq_node *next;
+} fq_node_t;
+
+/** a client, by its address */
+typedef struct fq_client {
+    unsigned int key;            /// address of client
+    double tokens;               /// token bucket
+    long long last_ms;           /// when tokens were refilled
+    fq_node_t *head;             /// sub-queue of this client
+    fq_node_t *tail;
+    int len;                     /// items in sub-queue
+    struct fq_client *next;      /// next in hash bucket
+    struct fq_client *rr_next;   /// next in round robin ring
+} fq_client_t;
+
+/** fair queue, clients with items are served round robin */
+typedef struct {
+    fq_client_t *buckets[FQ_BUCKETS];
+    fq_client_t *rr;             /// last client of ring, NULL if empty
+    int nclients;                /// clients known
+    int len;                     /// items queued
+    int max;                     /// items queued at most
+    int client_max;              /// items of one client at most
+    double rate;                 /// tokens per second, 0 for no limit
+    double burst;                /// size of token bucket
+    sem_t mutex;                 /// protects everything above
+    sem_t items;                 /// counts items
+    unsigned int rate_reject_cnt;  /// requests over rate
+    unsigned int full_reject_cnt;  /// requests over queue limits
+} fairq_t;
+
+void fq_init(fairq_t *fq, int max, int client_max, double rate, double burst);
+/* change limits, queued items are kept */
+void fq_set_limits(fairq_t *fq, int client_max, double rate, double burst);
+/* take a token of client, return 0 if OK, -1 if over rate */
+int fq_admit(fairq_t *fq, unsigned int key);
+/* queue item of client, return 0 if OK, -1 if full unless force */
+int fq_insert(fairq_t *fq, unsigned int key, void *item, int force);
+/* take next item round robin, wait if empty */
+void *fq_remove(fairq_t *fq);
+
+#endif /* __FAIRQ_H__ */
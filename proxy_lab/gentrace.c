@@ -0,0 +1,152 @@
+/**
+ * gentrace.c
+ *
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * Generate a synthetic trace in the format of proxy -T, for replay.
+ *      usage: gentrace [-n requests] [-o objects] [-z skew] [-s] [-r seed]
+ *                      out
+ * The trace is made as follows:
+ *      1. object i (from 0) has popularity proportional to 1/(i+1)^skew,
+ *         and a size of 1-16 KB picked by its id, so a run is repeatable
+ *      2. with -s, every SCAN_EVERY requests a burst of SCAN_LEN
+ *         one-hit-wonders is interleaved, e.g., a crawler
+ *      3. every request is a 200, 1 us after the previous one
+ **/
+#include <math.h>
+#include "csapp.h"
+#include "trace.h"
+
+#define SCAN_EVERY 1000   /// requests between two scans
+#define SCAN_LEN   200    /// one-hit-wonders in a scan
+
+/**
+ * @brief
+ *      size of an object, 1-16 KB, fixed by its id
+ */
+static unsigned int object_size(unsigned int id) {
+    unsigned int h = id * 2654435761u;
+
+    return 1024 + (h >> 8) % (15 * 1024);
+}
+
+/**
+ * @brief
+ *      draw an object from cumulative popularity by binary search
+ * @param
+ *      cdf: cumulative popularity of n objects, cdf[n-1] is 1
+ */
+static unsigned int draw(const double *cdf, unsigned int n) {
+    double u = (double)rand() / ((double)RAND_MAX + 1);
+    unsigned int lo = 0, hi = n - 1, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (cdf[mid] <= u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief
+ *      write one request to trace
+ */
+static void put(FILE *fp, unsigned long long ts, unsigned int size,
+                const char *tag) {
+    trace_rec_t rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.ts_us = ts;
+    rec.size = size;
+    rec.status = 200;
+    rec.tag_len = strlen(tag);
+    fwrite(&rec, sizeof(rec), 1, fp);
+    fwrite(tag, 1, rec.tag_len, fp);
+}
+
+/**
+ * @brief
+ *      print usage
+ */
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-n requests] [-o objects] [-z skew] [-s] "
+                    "[-r seed] out\n", prog);
+    fprintf(stderr, "  -n  requests, 400000 by default\n");
+    fprintf(stderr, "  -o  distinct objects, 2000 by default\n");
+    fprintf(stderr, "  -z  zipf skew, 0.8 by default\n");
+    fprintf(stderr, "  -s  interleave scans of one-hit-wonders\n");
+    fprintf(stderr, "  -r  seed of rand, 1 by default\n");
+}
+
+int main(int argc, char **argv) {
+    unsigned int n_req = 400000, n_obj = 2000, seed = 1, i, id;
+    unsigned int scanned = 0, k;
+    unsigned long long ts = 0;
+    double skew = 0.8, sum = 0;
+    char tag[MAXLINE];
+    int scan = 0, opt;
+    double *cdf;
+    FILE *fp;
+
+    while ((opt = getopt(argc, argv, "n:o:z:sr:")) != -1) {
+        switch (opt) {
+            case 'n':
+                n_req = atoi(optarg);
+                break;
+            case 'o':
+                n_obj = atoi(optarg);
+                break;
+            case 'z':
+                skew = atof(optarg);
+                break;
+            case 's':
+                scan = 1;
+                break;
+            case 'r':
+                seed = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    if (optind + 1 != argc || 0 == n_obj) {
+        usage(argv[0]);
+        exit(1);
+    }
+    if (NULL == (fp = fopen(argv[optind], "w"))) {
+        fprintf(stderr, "can't open %s\n", argv[optind]);
+        exit(1);
+    }
+
+    cdf = Malloc(n_obj * sizeof(double));
+    for (i = 0; i < n_obj; i++) {
+        sum += 1.0 / pow(i + 1, skew);
+        cdf[i] = sum;
+    }
+    for (i = 0; i < n_obj; i++) {
+        cdf[i] /= sum;
+    }
+    srand(seed);
+
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), fp);
+    for (i = 0; i < n_req; i++) {
+        if (scan && i && 0 == i % SCAN_EVERY) {
+            for (k = 0; k < SCAN_LEN; k++, scanned++) {
+                sprintf(tag, "http://gen/scan/%u", scanned);
+                put(fp, ++ts, object_size(n_obj + scanned), tag);
+            }
+        }
+        id = draw(cdf, n_obj);
+        sprintf(tag, "http://gen/obj/%u", id);
+        put(fp, ++ts, object_size(id), tag);
+    }
+
+    Free(cdf);
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "csapp.h"
+#include "gunzip.h"
+#include "netio.h"
+
+/**
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * @note
+ *      Streaming decoder for gzip/deflate encoded body.
+ *      Body can be fed chunk by chunk as it arrives, so we don't
+ *      need to hold a whole decoded object in memory.
+ *      zlib detects gzip or zlib wrapper by itself (windowBits+32)
+ **/
+
+/**
+ * @brief
+ *      initialize a decoder
+ * @param
+ *      gz: pointer to gunzip_t
+ *      fd: fd to write decoded data
+ * @ret
+ *      0 if OK, -1 if error
+ */
+int gunzip_init(gunzip_t *gz, int fd) {
+    memset(&gz->zs, 0, sizeof(gz->zs));
+    gz->fd = fd;
+    gz->error = 0;
+    if (inflateInit2(&gz->zs, 15 + 32) != Z_OK) {  // auto detect header
+        gz->error = 1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      decode a chunk of encoded body and write to fd
+ * @note
+ *      a gzip body may have multiple members, so reset the stream
+ *      whenever one member ends and there are still data remained
+ * @param
+ *      gz: pointer to gunzip_t
+ *      data: encoded data
+ *      size: size of data
+ * @ret
+ *      0 if OK, -1 if error
+ */
+int gunzip_write(gunzip_t *gz, const char *data, int size) {
+    char out[MAXBUF];
+    int rc, have;
+
+    if (gz->error) {
+        return -1;
+    }
+
+    gz->zs.next_in = (Bytef *)data;
+    gz->zs.avail_in = size;
+
+    // keep going while there are input or output is not drained
+    do {
+        gz->zs.next_out = (Bytef *)out;
+        gz->zs.avail_out = sizeof(out);
+
+        rc = inflate(&gz->zs, Z_NO_FLUSH);
+        if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+            gz->error = 1;
+            return -1;
+        }
+
+        have = sizeof(out) - gz->zs.avail_out;
+        if (have > 0 && nio_writen(gz->fd, out, have)) {
+            gz->error = 1;
+            return -1;
+        }
+
+        if (rc == Z_STREAM_END) {
+            if (gz->zs.avail_in == 0) {
+                break;
+            }
+            inflateReset(&gz->zs);  // next member
+        } else if (rc == Z_BUF_ERROR) {
+            break;  // no progress, wait for more input
+        }
+    } while (gz->zs.avail_in > 0 || gz->zs.avail_out == 0);
+    return 0;
+}
+
+/**
+ * @brief
+ *      free a decoder
+ * @param
+ *      gz: pointer to gunzip_t
+ */
+void gunzip_end(gunzip_t *gz) {
+    inflateEnd(&gz->zs);
+}
@@ -0,0 +1,19 @@
+#ifndef __GUNZIP_H__
+#define __GUNZIP_H__
+
+#include <zlib.h>
+
+/** a streaming decoder which writes decoded data to fd */
+typedef struct {
+    z_stream zs;       /// zlib state
+    int fd;            /// fd to write decoded data
+    int error;         /// 1 if stream is corrupted or fd is broken
+} gunzip_t;
+
+/* return 0 if OK, -1 if error */
+int gunzip_init(gunzip_t *gz, int fd);
+/* decode data and write to fd, return 0 if OK, -1 if error */
+int gunzip_write(gunzip_t *gz, const char *data, int size);
+void gunzip_end(gunzip_t *gz);
+
+#endif /* __GUNZIP_H__ */
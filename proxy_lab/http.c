@@ -0,0 +1,537 @@
+#include "csapp.h"
+#include "http.h"
+
+/**
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * @note
+ *      Small helpers to look into raw HTTP messages.
+ *      A raw response is what we store in cache: status line,
+ *      headers and body, not null-terminated.
+ *      A cache tag is built by http_canonical_tag, so URLs differ
+ *      only in spelling share one item
+ **/
+
+/** Static helper function */
+
+/**
+ * @brief
+ *      find end of current line in a raw message
+ * @param
+ *      p: begin of line
+ *      end: end of raw message
+ * @ret
+ *      pointer to the '\n' of current line, NULL if not found
+ */
+static const char *find_eol(const char *p, const char *end) {
+    while (p < end) {
+        if (*p == '\n') {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief
+ *      copy part of a path or query, normalizing percent-encoding: an
+ *      escaped unreserved char is decoded, other escapes get upper 
+ *      case hex digits
+ * @param
+ *      in/len: the part
+ *      out: written here, never longer than input
+ * @ret
+ *      length written
+ */
+static int copy_escaped(const char *in, int len, char *out) {
+    int i, n = 0, c;
+    char hex[3];
+
+    for (i = 0; i < len; i++) {
+        if (in[i] != '%' || i + 2 >= len || 
+            !isxdigit((unsigned char)in[i + 1]) || 
+            !isxdigit((unsigned char)in[i + 2])) {
+            out[n++] = in[i];
+            continue;
+        }
+        hex[0] = in[i + 1];
+        hex[1] = in[i + 2];
+        hex[2] = '\0';
+        c = strtol(hex, NULL, 16);
+        if (isalnum(c) || (c && strchr("-._~", c))) {
+            out[n++] = c;
+        } else {
+            out[n++] = '%';
+            out[n++] = toupper((unsigned char)hex[0]);
+            out[n++] = toupper((unsigned char)hex[1]);
+        }
+        i += 2;
+    }
+    return n;
+}
+
+/**
+ * @brief
+ *      compare query parameters by name for qsort, parameters of same
+ *      name keep their order as they're pointers into one string
+ */
+static int by_param_name(const void *a, const void *b) {
+    const char *x = *(const char **)a, *y = *(const char **)b;
+    int lx = strcspn(x, "="), ly = strcspn(y, "=");
+    int rc = strncmp(x, y, lx < ly ? lx : ly);
+
+    if (rc == 0 && lx != ly) {
+        rc = lx - ly;
+    }
+    if (rc == 0) {
+        rc = (x > y) - (x < y);
+    }
+    return rc;
+}
+
+/** public function for other program to call */
+
+/**
+ * @brief
+ *      parse status code from status line, e.g. "HTTP/1.0 200 OK"
+ * @param
+ *      data: raw response
+ *      size: size of raw response
+ * @ret
+ *      status code, -1 if malformed
+ */
+int http_get_status(const char *data, int size) {
+    const char *end = data + size;
+    const char *p = data;
+    int status = 0;
+    int digits = 0;
+
+    // skip version
+    while (p < end && *p != ' ') {
+        p++;
+    }
+    while (p < end && *p == ' ') {
+        p++;
+    }
+
+    // read 3 digits
+    while (p < end && isdigit((unsigned char)*p) && digits < 3) {
+        status = status * 10 + (*p - '0');
+        digits++;
+        p++;
+    }
+    return (digits == 3) ? status : -1;
+}
+
+/**
+ * @brief
+ *      find the offset of body by looking for the empty line
+ * @param
+ *      data: raw response
+ *      size: size of raw response
+ * @ret
+ *      offset of body, -1 if header not ended
+ */
+int http_body_offset(const char *data, int size) {
+    const char *end = data + size;
+    const char *p = data;
+    const char *eol;
+
+    while (NULL != (eol = find_eol(p, end))) {
+        // an empty line is "\r\n" or "\n"
+        if (eol == p || (eol == p + 1 && *p == '\r')) {
+            return eol + 1 - data;
+        }
+        p = eol + 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief
+ *      look for header "name" and copy its value without leading
+ *      space and trailing CRLF
+ * @note
+ *      stop at the end of header, so a raw response is acceptable
+ * @param
+ *      hdrs: begin of header lines
+ *      size: size of hdrs
+ *      name: header name without ':', case insensitive
+ *      out: the value will be stored here
+ *      maxlen: size of out
+ * @ret
+ *      1 if found, 0 otherwise
+ */
+int http_get_header(const char *hdrs, int size, const char *name,
+                    char *out, int maxlen) {
+    const char *end = hdrs + size;
+    const char *p = hdrs;
+    const char *eol, *val;
+    int name_len = strlen(name);
+    int len;
+
+    while (NULL != (eol = find_eol(p, end))) {
+        if (eol == p || (eol == p + 1 && *p == '\r')) {
+            break;  // end of header
+        }
+        if (eol - p > name_len && p[name_len] == ':' &&
+            !strncasecmp(p, name, name_len)) {
+            // trim value
+            val = p + name_len + 1;
+            while (val < eol && (*val == ' ' || *val == '\t')) {
+                val++;
+            }
+            len = eol - val;
+            while (len > 0 && (val[len-1] == '\r' || val[len-1] == ' ')) {
+                len--;
+            }
+            if (len >= maxlen) {
+                len = maxlen - 1;
+            }
+            memcpy(out, val, len);
+            out[len] = '\0';
+            return 1;
+        }
+        p = eol + 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      remove every line of header "name" from header lines in place
+ * @param
+ *      hdrs: header lines, a null-terminated string
+ *      name: header name without ':', case insensitive
+ * @ret
+ *      number of lines removed
+ */
+int http_remove_header(char *hdrs, const char *name) {
+    int name_len = strlen(name);
+    char *p = hdrs, *eol;
+    int cnt = 0;
+
+    while (*p) {
+        if (NULL == (eol = strchr(p, '\n'))) {
+            eol = p + strlen(p) - 1;
+        }
+        if (!strncasecmp(p, name, name_len) && p[name_len] == ':') {
+            memmove(p, eol + 1, strlen(eol + 1) + 1);
+            cnt++;
+        } else {
+            p = eol + 1;
+        }
+    }
+    return cnt;
+}
+
+/**
+ * @brief
+ *      build signature of a request for given Vary header value
+ *
+ * Signature is lines of "name:value\n", one for each header listed
+ * in Vary, name is lowercased and value is the one in request 
+ * (empty if absent). The name is kept so a signature can be matched
+ * against another request by http_vary_match.
+ *
+ * @param
+ *      vary: value of Vary header of response, e.g. "Accept-Language"
+ *      req_hdrs: the request headers sent to the real host
+ *      out: the signature will be stored here, "" if nothing varies
+ *      maxlen: size of out
+ * @ret
+ *      0 if OK, -1 if response can't be cached ("Vary: *" or too long)
+ */
+int http_vary_sig(const char *vary, const char *req_hdrs,
+                  char *out, int maxlen) {
+    char name[MAXLINE];
+    char value[MAXLINE];
+    const char *p = vary;
+    int name_len, len;
+    int out_len = 0;
+
+    out[0] = '\0';
+    while (*p) {
+        // skip separators
+        while (*p == ',' || *p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+
+        // get one lowercased name
+        name_len = 0;
+        while (*p && *p != ',' && *p != ' ' && *p != '\t' && \
+               name_len < MAXLINE - 1) {
+            name[name_len++] = tolower((unsigned char)*p);
+            p++;
+        }
+        name[name_len] = '\0';
+        if (!strcmp(name, "*")) {
+            return -1;  // varies on things we don't know
+        }
+
+        if (!http_get_header(req_hdrs, strlen(req_hdrs), name, value, MAXLINE)) {
+            value[0] = '\0';
+        }
+        len = name_len + strlen(value) + 2;
+        if (out_len + len >= maxlen) {
+            return -1;
+        }
+        out_len += sprintf(out + out_len, "%s:%s\n", name, value);
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      check if a request matches a vary signature built by
+ *      http_vary_sig
+ * @param
+ *      sig: the signature, NULL or "" matches everything
+ *      req_hdrs: the request headers to be sent to real host
+ * @ret
+ *      1 if matched, 0 otherwise
+ */
+int http_vary_match(const char *sig, const char *req_hdrs) {
+    char name[MAXLINE];
+    char value[MAXLINE];
+    const char *p = sig;
+    const char *colon, *eol;
+    int len;
+
+    if (NULL == sig) {
+        return 1;
+    }
+
+    while (*p) {
+        colon = strchr(p, ':');
+        eol = strchr(p, '\n');
+        if (NULL == colon || NULL == eol || colon > eol) {
+            return 0;  // broken signature
+        }
+        len = colon - p;
+        memcpy(name, p, len);
+        name[len] = '\0';
+
+        if (!http_get_header(req_hdrs, strlen(req_hdrs), name, value, MAXLINE)) {
+            value[0] = '\0';
+        }
+        len = eol - colon - 1;
+        if (strlen(value) != len || strncmp(value, colon + 1, len)) {
+            return 0;
+        }
+        p = eol + 1;
+    }
+    return 1;
+}
+
+/**
+ * @brief
+ *      check if a coding is acceptable by value of Accept-Encoding
+ * @note
+ *      "gzip;q=0" means not acceptable. "*" accepts everything
+ * @param
+ *      value: value of Accept-Encoding, e.g. "gzip, deflate"
+ *      coding: the coding to check, e.g. "gzip"
+ * @ret
+ *      1 if acceptable, 0 otherwise
+ */
+int http_accepts_coding(const char *value, const char *coding) {
+    const char *p = value;
+    const char *tok, *q;
+    int len = strlen(coding);
+    int tok_len;
+
+    while (*p) {
+        while (*p == ',' || *p == ' ' || *p == '\t') {
+            p++;
+        }
+        tok = p;
+        while (*p && *p != ',' && *p != ';' && *p != ' ') {
+            p++;
+        }
+        tok_len = p - tok;
+
+        // parameters of this token, only q matters
+        q = NULL;
+        while (*p && *p != ',') {
+            if (!strncasecmp(p, "q=", 2)) {
+                q = p + 2;
+            }
+            p++;
+        }
+
+        if ((tok_len == len && !strncasecmp(tok, coding, len)) || \
+            (tok_len == 1 && *tok == '*')) {
+            return (NULL == q) || (atof(q) > 0);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      parse value of a Range header
+ * @note
+ *      only single range of bytes unit is supported, e.g.
+ *      "bytes=0-99", "bytes=100-", "bytes=-100".
+ *      multiple ranges are treated as error so caller can ignore
+ *      the header and return the full object, which RFC allows
+ * @param
+ *      value: value of Range header
+ *      out: parsed range
+ * @ret
+ *      0 if OK, -1 otherwise
+ */
+int http_parse_range(const char *value, http_range_t *out) {
+    const char *p = value;
+    char *endp;
+
+    if (strncasecmp(p, "bytes=", 6)) {
+        return -1;
+    }
+    p += 6;
+
+    out->first = -1;
+    out->last = -1;
+
+    // first position, absent on suffix range
+    if (isdigit((unsigned char)*p)) {
+        out->first = strtol(p, &endp, 10);
+        p = endp;
+    }
+    if (*p != '-') {
+        return -1;
+    }
+    p++;
+
+    // last position, absent on open-ended range
+    if (isdigit((unsigned char)*p)) {
+        out->last = strtol(p, &endp, 10);
+        p = endp;
+    }
+    while (*p == ' ') {
+        p++;
+    }
+    if (*p != '\0') {
+        return -1;  // multiple ranges or garbage
+    }
+
+    if (out->first < 0 && out->last < 0) {
+        return -1;  // "bytes=-"
+    }
+    if (out->first >= 0 && out->last >= 0 && out->last < out->first) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      resolve a parsed range to absolute positions of an object
+ * @param
+ *      range: parsed range
+ *      len: length of whole object
+ *      out_first: first byte position will be stored here
+ *      out_last: last byte position will be stored here
+ * @ret
+ *      0 if OK, -1 if unsatisfiable
+ */
+int http_resolve_range(const http_range_t *range, long len,
+                       long *out_first, long *out_last) {
+    if (len <= 0) {
+        return -1;
+    }
+
+    if (range->first < 0) {  // suffix range, last N bytes
+        if (range->last == 0) {
+            return -1;
+        }
+        *out_first = (range->last >= len) ? 0 : len - range->last;
+        *out_last = len - 1;
+        return 0;
+    }
+
+    if (range->first >= len) {
+        return -1;
+    }
+    *out_first = range->first;
+    *out_last = (range->last < 0 || range->last >= len) ? \
+                len - 1 : range->last;
+    return 0;
+}
+
+/**
+ * @brief
+ *      build cache tag of a request in canonical form, 
+ *      host[:port]/path[?query]
+ * @note
+ *      1. host is in lower case without trailing dot
+ *      2. default port 80 is omitted
+ *      3. percent-encoding is normalized, see copy_escaped
+ *      4. parameters of query are sorted by name, empty ones are
+ *         dropped, a fragment is dropped
+ * @param
+ *      host/port/path: from request line, path begins with '/'
+ *      out: tag is stored here
+ *      maxlen: size of out
+ * @ret
+ *      0 if OK, -1 if it's too long or port is out of range
+ */
+int http_canonical_tag(const char *host, int port, const char *path,
+                       char *out, int maxlen) {
+    const char *end, *query;
+    char *p = out, *buf, *param, **params, *query_save;
+    int i, n = 0, len;
+
+    // normalizing never makes it longer, ":65535" and '\0' take 7 more
+    if (port < 1 || port > 65535 ||
+        strlen(host) + strlen(path) + 8 > maxlen) {
+        return -1;
+    }
+
+    for (i = 0; host[i]; i++) {
+        *p++ = tolower((unsigned char)host[i]);
+    }
+    if (p > out && p[-1] == '.') {
+        p--;
+    }
+    if (port != 80) {
+        p += sprintf(p, ":%d", port);
+    }
+
+    if (NULL == (end = strchr(path, '#'))) {
+        end = path + strlen(path);
+    }
+    if (NULL == (query = memchr(path, '?', end - path))) {
+        query = end;
+    }
+    if (path[0] != '/') {
+        *p++ = '/';
+    }
+    p += copy_escaped(path, query - path, p);
+    *p = '\0';
+    if (query == end) {
+        return 0;
+    }
+
+    // split normalized query by '&' and join it sorted
+    buf = Malloc(end - query);
+    len = copy_escaped(query + 1, end - query - 1, buf);
+    buf[len] = '\0';
+    params = Malloc((len / 2 + 1) * sizeof(char *));
+    for (param = strtok_r(buf, "&", &query_save); param; 
+         param = strtok_r(NULL, "&", &query_save)) {
+        params[n++] = param;
+    }
+    qsort(params, n, sizeof(char *), by_param_name);
+    for (i = 0; i < n; i++) {
+        p += sprintf(p, "%c%s", i ? '&' : '?', params[i]);
+    }
+    Free(params);
+    Free(buf);
+    return 0;
+}
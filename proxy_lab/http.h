@@ -0,0 +1,38 @@
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+/** a single byte range of "Range: bytes=first-last" */
+typedef struct {
+    long first;        /// -1 if it's a suffix range "bytes=-N"
+    long last;         /// -1 if it's open-ended "bytes=N-"
+} http_range_t;
+
+/* return status code of a raw response, -1 if malformed */
+int http_get_status(const char *data, int size);
+/* return offset of body in a raw response, -1 if header not ended */
+int http_body_offset(const char *data, int size);
+/* copy value of header name into out, return 1 if found */
+int http_get_header(const char *hdrs, int size, const char *name,
+                    char *out, int maxlen);
+/* remove header name from null-terminated lines, return lines removed */
+int http_remove_header(char *hdrs, const char *name);
+
+/* build vary signature of a request, return 0 if OK, -1 if uncacheable */
+int http_vary_sig(const char *vary, const char *req_hdrs,
+                  char *out, int maxlen);
+/* return 1 if request matches the vary signature */
+int http_vary_match(const char *sig, const char *req_hdrs);
+/* return 1 if value of Accept-Encoding accepts the coding */
+int http_accepts_coding(const char *value, const char *coding);
+
+/* build canonical cache tag, return 0 if OK, -1 if it's too long */
+int http_canonical_tag(const char *host, int port, const char *path,
+                       char *out, int maxlen);
+
+/* parse value of Range header, return 0 if OK, -1 otherwise */
+int http_parse_range(const char *value, http_range_t *out);
+/* resolve range against a length, return 0 if OK, -1 if unsatisfiable */
+int http_resolve_range(const http_range_t *range, long len,
+                       long *out_first, long *out_last);
+
+#endif /* __HTTP_H__ */
@@ -0,0 +1,152 @@
+#include "csapp.h"
+#include "netio.h"
+
+/**
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * @note
+ *      Error returning I/O layer for proxy.
+ *      Unlike the csapp wrappers these functions never close a fd 
+ *      behind the caller and never exit, they return -1 with errno
+ *      kept, and count the error by its class:
+ *      1. NIO_PEER: the peer reset, closed or is unreachable. It's 
+ *         normal under load, only counted
+ *      2. NIO_RESOURCE: we are out of fds or buffers, counted and
+ *         logged, the caller may retry later
+ *      3. NIO_BUG: bad fd or address, counted and logged, it means
+ *         something is wrong in proxy itself
+ **/
+
+unsigned int nio_err_cnt[NO_OF_NIO_CLASS];
+
+/**
+ * @brief
+ *      classify an errno
+ * @param
+ *      err: errno to classify
+ * @ret
+ *      one of NIO_PEER, NIO_RESOURCE, NIO_BUG
+ */
+int nio_classify(int err) {
+    switch (err) {
+        case EMFILE:
+        case ENFILE:
+        case ENOBUFS:
+        case ENOMEM:
+        case EAGAIN:
+            return NIO_RESOURCE;
+        case EBADF:
+        case EFAULT:
+        case EINVAL:
+        case ENOTSOCK:
+            return NIO_BUG;
+        default:    // ECONNRESET, EPIPE, ETIMEDOUT, ECONNREFUSED, ...
+            return NIO_PEER;
+    }
+}
+
+/**
+ * @brief
+ *      count an error, and log it if it's not the peer's fault
+ * @param
+ *      msg: message to log
+ *      err: errno of the error
+ */
+void nio_error(const char *msg, int err) {
+    int cls = nio_classify(err);
+
+    __sync_fetch_and_add(&nio_err_cnt[cls], 1);
+    if (cls != NIO_PEER) {
+        fprintf(stderr, "%s: %s\n", msg, strerror(err));
+    }
+    errno = err;  // keep it for caller
+}
+
+/**
+ * @brief
+ *      read a text line, see rio_readlineb
+ * @ret
+ *      number of bytes read, 0 on EOF, -1 on error
+ */
+ssize_t nio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
+    ssize_t rc;
+
+    if ((rc = rio_readlineb(rp, usrbuf, maxlen)) < 0) {
+        nio_error("nio_readlineb error", errno);
+    }
+    return rc;
+}
+
+/**
+ * @brief
+ *      write n bytes to a socket
+ * @note
+ *      use send with MSG_NOSIGNAL so a closed peer gives EPIPE 
+ *      instead of SIGPIPE
+ * @ret
+ *      0 on success, -1 on error
+ */
+int nio_writen(int fd, const void *usrbuf, size_t n) {
+    size_t nleft = n;
+    ssize_t nwritten;
+    const char *bufp = usrbuf;
+
+    while (nleft > 0) {
+        if ((nwritten = send(fd, bufp, nleft, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            nio_error("nio_writen error", errno);
+            return -1;
+        }
+        nleft -= nwritten;
+        bufp += nwritten;
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      accept a connection
+ * @note
+ *      not retried if interrupted, so the caller can check what the
+ *      signal asks for
+ * @ret
+ *      connected fd, -1 on error or EINTR
+ */
+int nio_accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
+    int rc;
+
+    if ((rc = accept(s, addr, addrlen)) < 0 && errno != EINTR) {
+        nio_error("nio_accept error", errno);
+    }
+    return rc;
+}
+
+/**
+ * @brief
+ *      connect to hostname:port within timeout_ms
+ * @ret
+ *      connected fd, -1 on error, errno is ETIMEDOUT if timed out
+ */
+int nio_connect(char *hostname, int port, int timeout_ms) {
+    int rc;
+
+    if ((rc = open_clientfd_timeout(hostname, port, timeout_ms)) < 0) {
+        nio_error("nio_connect error", errno);
+    }
+    return rc;
+}
+
+/**
+ * @brief
+ *      close a fd
+ * @note
+ *      never retry on EINTR, on Linux the fd is released already 
+ *      and may be reused by another thread
+ */
+void nio_close(int fd) {
+    if (close(fd) < 0 && errno != EINTR) {
+        nio_error("nio_close error", errno);
+    }
+}
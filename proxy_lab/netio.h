@@ -0,0 +1,24 @@
+#ifndef __NETIO_H__
+#define __NETIO_H__
+
+#include "csapp.h"
+
+/** classes of I/O error, by errno */
+#define NIO_PEER      0    /// peer reset/gone/timed out, expected
+#define NIO_RESOURCE  1    /// out of fds/buffers/memory, transient
+#define NIO_BUG       2    /// bad fd, bad address, our own fault
+#define NO_OF_NIO_CLASS 3
+
+extern unsigned int nio_err_cnt[NO_OF_NIO_CLASS];
+
+int nio_classify(int err);
+void nio_error(const char *msg, int err);
+
+/* Error returning I/O, never close fd and never exit */
+ssize_t nio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+int nio_writen(int fd, const void *usrbuf, size_t n);
+int nio_accept(int s, struct sockaddr *addr, socklen_t *addrlen);
+int nio_connect(char *hostname, int port, int timeout_ms);
+void nio_close(int fd);
+
+#endif /* __NETIO_H__ */
@@ -0,0 +1,421 @@
+#include "csapp.h"
+#include "prefetch.h"
+#include "http.h"
+#include "netio.h"
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+/**
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * @note
+ *      Warm cache with resources linked by a html page, so they are
+ *      hits when browser asks for them right after the page.
+ *      1. a worker relaying a html page queues a copy of its body, 
+ *         the queue is short and a page is dropped if it's full, so
+ *         prefetching never slows down serving
+ *      2. one background thread of lowest cpu priority scans the 
+ *         page for src= attributes and href= of <link> tags, i.e., 
+ *         resources the page loads, never <a> links which may act
+ *         on a GET. It keeps links of the same origin and fetches 
+ *         up to budget of them one by one
+ *      3. a link already cached is skipped, without counting it as
+ *         an access, and a fetched one goes through cache_response,
+ *         so admission and eviction policy decide as usual
+ *      4. headers of the page request are reused, so a response 
+ *         with Vary is matched by later requests of same client, 
+ *         but not credentials and conditionals, see private_hdrs
+ **/
+
+/** request headers of a page never sent for its links */
+static const char *private_hdrs[] = {
+    "Range", "If-Range",                    // only for the page
+    "Cookie", "Authorization",              // a link is fetched for all
+    "If-Modified-Since", "If-None-Match",   // only 200 is cached
+    "If-Match", "If-Unmodified-Since",
+};
+#define NO_OF_PRIVATE_HDR (sizeof(private_hdrs) / sizeof(private_hdrs[0]))
+
+/** Static helper function */
+
+/**
+ * @brief
+ *      check if s begins with prefix, case insensitive, bounded by end
+ */
+static int has_prefix(const char *s, const char *end, const char *prefix) {
+    int len = strlen(prefix);
+    return (end - s >= len) && !strncasecmp(s, prefix, len);
+}
+
+/**
+ * @brief
+ *      check if an attribute is in a <link> tag
+ * @param
+ *      begin: begin of body
+ *      p: the space before attribute
+ */
+static int in_link_tag(const char *begin, const char *p) {
+    while (p > begin && *p != '<' && *p != '>') {
+        p--;
+    }
+    return *p == '<' && !strncasecmp(p + 1, "link", 4) && 
+           isspace((unsigned char)p[5]);
+}
+
+/**
+ * @brief
+ *      find next value of src= attribute, or href= of a <link> tag
+ * @param
+ *      begin: begin of body
+ *      p: where to begin scanning
+ *      end: end of body
+ *      out: the value will be stored here
+ *      maxlen: size of out, a longer value is skipped
+ * @ret
+ *      where to continue scanning, NULL if no more link
+ */
+static const char *next_link(const char *begin, const char *p, 
+                             const char *end, char *out, int maxlen) {
+    const char *val, *val_end;
+    char quote;
+
+    for (; p < end; p++) {
+        // attribute name follows a space, so "data-src=" isn't matched
+        if (!isspace((unsigned char)*p)) {
+            continue;
+        }
+        if (has_prefix(p + 1, end, "src=")) {
+            val = p + 5;
+        } else if (has_prefix(p + 1, end, "href=") && in_link_tag(begin, p)) {
+            val = p + 6;
+        } else {
+            continue;
+        }
+
+        quote = (val < end && (*val == '"' || *val == '\'')) ? *val++ : 0;
+        for (val_end = val; val_end < end; val_end++) {
+            if (quote ? (*val_end == quote) : 
+                (isspace((unsigned char)*val_end) || *val_end == '>')) {
+                break;
+            }
+        }
+        if (val_end - val > 0 && val_end - val < maxlen) {
+            memcpy(out, val, val_end - val);
+            out[val_end - val] = '\0';
+            return val_end;
+        }
+        p = val_end - 1;
+    }
+    return NULL;
+}
+
+/**
+ * @brief
+ *      remove "." and ".." segments of a path in place, the query
+ *      is kept as is
+ * @param
+ *      path: begins with '/', MAXLINE at most
+ */
+static void remove_dot_segments(char *path) {
+    char copy[MAXLINE];
+    char *segs[MAXLINE / 2];
+    char *query, *p, *seg;
+    int n = 0, i, trailing = 0;
+
+    strcpy(copy, path);
+    if (NULL != (query = strchr(copy, '?'))) {
+        *query++ = '\0';
+    }
+
+    // split by '/', an empty last segment keeps the trailing '/'
+    for (p = copy + 1; p; ) {
+        seg = p;
+        if (NULL != (p = strchr(p, '/'))) {
+            *p++ = '\0';
+        }
+        trailing = 0;
+        if (!strcmp(seg, ".")) {
+            trailing = 1;
+        } else if (!strcmp(seg, "..")) {
+            n -= (n > 0);
+            trailing = 1;
+        } else {
+            segs[n++] = seg;
+        }
+    }
+
+    p = path;
+    for (i = 0; i < n; i++) {
+        p += sprintf(p, "/%s", segs[i]);
+    }
+    if (n == 0 || trailing) {
+        *p++ = '/';
+    }
+    *p = '\0';
+    if (NULL != query) {
+        sprintf(p, "?%s", query);
+    }
+}
+
+/**
+ * @brief
+ *      resolve a link against its page, only links on same origin 
+ *      are kept
+ * @param
+ *      pg: the page
+ *      link: value of src= or href=
+ *      out_path: the path on real host will be stored here, MAXLINE
+ * @ret
+ *      1 if it's on same origin, 0 otherwise
+ */
+static int resolve_link(pf_page_t *pg, char *link, char *out_path) {
+    char *p, *host, *slash, *colon;
+    int port = 80;
+    int len;
+
+    if (NULL != (p = strchr(link, '#'))) {
+        *p = '\0';              // fragment is never sent
+    }
+    if (link[0] == '\0') {
+        return 0;
+    }
+
+    if (!strncasecmp(link, "http://", 7) || !strncmp(link, "//", 2)) {
+        host = link + ((link[0] == '/') ? 2 : 7);
+        slash = strchr(host, '/');
+        len = (NULL == slash) ? strlen(host) : slash - host;
+        colon = memchr(host, ':', len);
+        if (NULL != colon) {
+            port = atoi(colon + 1);
+            len = colon - host;
+        }
+        if (port != pg->port || len != strlen(pg->hostname) ||
+            strncasecmp(host, pg->hostname, len)) {
+            return 0;           // other origin
+        }
+        strcpy(out_path, (NULL == slash) ? "/" : slash);
+    } else if (link[0] == '/') {
+        strcpy(out_path, link);
+    } else {
+        // a scheme like https:, mailto: or javascript: is not for us
+        for (p = link; *p && *p != '/' && *p != '?'; p++) {
+            if (*p == ':') {
+                return 0;
+            }
+        }
+        // relative to directory of page, or to page itself for query
+        strcpy(out_path, pg->path);
+        if (NULL != (p = strchr(out_path, '?'))) {
+            *p = '\0';
+        }
+        if (link[0] != '?') {
+            *(strrchr(out_path, '/') + 1) = '\0';
+        }
+        if (strlen(out_path) + strlen(link) >= MAXLINE) {
+            return 0;
+        }
+        strcat(out_path, link);
+    }
+    remove_dot_segments(out_path);
+    return 1;
+}
+
+
+/**
+ * @brief
+ *      fetch one link of a page into cache
+ * @param
+ *      pf: pointer to prefetch_t
+ *      pg: the page
+ *      path: path of link on same host
+ */
+static void fetch_link(prefetch_t *pf, pf_page_t *pg, const char *path) {
+    char tag[MAXLINE];
+    char line[MAXLINE];
+    timer_entry_t te;
+    rio_t rio;
+    int fd, size;
+
+    if (http_canonical_tag(pg->hostname, pg->port, path, tag, MAXLINE)) {
+        return;
+    }
+    if (probe_cache(pf->cp, tag, pg->req_hdrs)) {
+        pf->skip_cnt++;
+        return;
+    }
+
+    if ((fd = nio_connect(pg->hostname, pg->port, pf->connect_timeout)) < 0) {
+        return;
+    }
+    // a stalled host is shut down by timer wheel
+    tw_entry_init(&te, 0);
+    tw_arm(pf->tw, &te, fd, -1, pf->idle_timeout);
+
+    sprintf(line, "GET %s HTTP/1.0\r\n", path);
+    if (!nio_writen(fd, line, strlen(line)) &&
+        !nio_writen(fd, pg->req_hdrs, strlen(pg->req_hdrs))) {
+        // read one byte more to know if it's too big to cache
+        Rio_readinitb(&rio, fd);
+        size = rio_readnb(&rio, pf->buf, MAX_OBJECT_SIZE + 1);
+        if (size > 0 && size <= MAX_OBJECT_SIZE && !te.fired &&
+            http_get_status(pf->buf, size) == 200) {
+            cache_response(pf->cp, tag, pg->req_hdrs, pf->buf, size);
+            pf->fetch_cnt++;
+        }
+    }
+    tw_disarm(pf->tw, &te);
+    nio_close(fd);
+}
+
+/**
+ * @brief
+ *      scan a page and fetch its links on same origin, up to budget
+ * @param
+ *      pf: pointer to prefetch_t
+ *      pg: the page
+ */
+static void scan_page(prefetch_t *pf, pf_page_t *pg) {
+    const char *p = pg->body;
+    const char *end = pg->body + pg->size;
+    char link[MAXLINE];
+    char path[MAXLINE];
+    char (*done)[MAXLINE] = Malloc(pf->budget * sizeof(*done));
+    int n = 0, i;
+
+    while (n < pf->budget && NULL != (p = next_link(pg->body, p, end, \
+                                                 link, MAXLINE))) {
+        if (!resolve_link(pg, link, path) || !strcmp(path, pg->path)) {
+            continue;
+        }
+        for (i = 0; i < n && strcmp(done[i], path); i++) {
+            ;   // a link may appear many times in a page
+        }
+        if (i < n) {
+            continue;
+        }
+        strcpy(done[n++], path);
+        fetch_link(pf, pg, path);
+    }
+    Free(done);
+    pf->page_cnt++;
+}
+
+/**
+ * @brief
+ *      the prefetch thread, take pages from queue and scan them
+ */
+static void *pf_thread(void *vargp) {
+    prefetch_t *pf = vargp;
+    pf_page_t *pg;
+
+    Pthread_detach(pthread_self());
+    // lowest priority, it only uses cpu nobody else wants
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+
+    while (1) {
+        P(&pf->items);
+        P(&pf->mutex);
+        pg = pf->head;
+        pf->head = pg->next;
+        if (NULL == pf->head) {
+            pf->tail = NULL;
+        }
+        pf->queued--;
+        V(&pf->mutex);
+
+        scan_page(pf, pg);
+        Free(pg->body);
+        Free(pg->req_hdrs);
+        Free(pg);
+    }
+    return NULL;
+}
+
+/** public function for other program to call */
+
+/**
+ * @brief
+ *      initialize prefetcher and start its thread
+ * @param
+ *      pf: pointer to prefetch_t
+ *      cp: the cache to warm
+ *      tw: timer wheel to enforce idle timeout
+ *      budget: links fetched per page at most
+ *      connect_timeout/idle_timeout: in ms
+ */
+void pf_init(prefetch_t *pf, cache_t *cp, timer_wheel_t *tw, int budget,
+             int connect_timeout, int idle_timeout) {
+    pthread_t tid;
+
+    pf->cp = cp;
+    pf->tw = tw;
+    pf->budget = budget;
+    pf->connect_timeout = connect_timeout;
+    pf->idle_timeout = idle_timeout;
+    pf->head = pf->tail = NULL;
+    pf->queued = 0;
+    Sem_init(&pf->mutex, 0, 1);
+    Sem_init(&pf->items, 0, 0);
+    pf->buf = Malloc(MAX_OBJECT_SIZE + 1);
+    pf->page_cnt = pf->drop_cnt = pf->fetch_cnt = pf->skip_cnt = 0;
+    Pthread_create(&tid, NULL, pf_thread, pf);
+}
+
+/**
+ * @brief
+ *      queue a response for scanning if it's a complete html page
+ * @note
+ *      encoded body can't be scanned, it's skipped
+ * @param
+ *      pf: pointer to prefetch_t
+ *      data/size: the raw response
+ *      hostname/port/path: where the page is from
+ *      req_hdrs: request headers sent for the page
+ */
+void pf_page(prefetch_t *pf, const char *data, int size,
+             const char *hostname, int port, const char *path,
+             const char *req_hdrs) {
+    char value[MAXLINE];
+    pf_page_t *pg;
+    int body_off;
+    size_t i;
+
+    if (size > MAX_OBJECT_SIZE || http_get_status(data, size) != 200 ||
+        (body_off = http_body_offset(data, size)) < 0 ||
+        !http_get_header(data, body_off, "Content-Type", value, MAXLINE) ||
+        strncasecmp(value, "text/html", 9) ||
+        http_get_header(data, body_off, "Content-Encoding", value, MAXLINE)) {
+        return;
+    }
+    if (pf->queued >= PF_MAX_PAGES) {   // racy read is fine, it's a hint
+        __sync_fetch_and_add(&pf->drop_cnt, 1);
+        return;
+    }
+
+    pg = Malloc(sizeof(pf_page_t));
+    pg->size = size - body_off;
+    pg->body = Malloc(pg->size);
+    memcpy(pg->body, data + body_off, pg->size);
+    strcpy(pg->hostname, hostname);
+    pg->port = port;
+    strcpy(pg->path, path);
+
+    // same headers as the page, without the private ones
+    pg->req_hdrs = Malloc(strlen(req_hdrs) + 1);
+    strcpy(pg->req_hdrs, req_hdrs);
+    for (i = 0; i < NO_OF_PRIVATE_HDR; i++) {
+        http_remove_header(pg->req_hdrs, private_hdrs[i]);
+    }
+
+    pg->next = NULL;
+    P(&pf->mutex);
+    if (NULL == pf->tail) {
+        pf->head = pg;
+    } else {
+        pf->tail->next = pg;
+    }
+    pf->tail = pg;
+    pf->queued++;
+    V(&pf->mutex);
+    V(&pf->items);
+}
@@ -0,0 +1,48 @@
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include "csapp.h"
+#include "cache.h"
+#include "timer.h"
+
+#define PF_MAX_PAGES 16    /// pages waiting to be scanned, more are dropped
+
+/** a html page waiting to be scanned */
+typedef struct pf_page {
+    char *body;            /// copy of body
+    int size;
+    char hostname[MAXLINE];
+    int port;
+    char path[MAXLINE];    /// path of page, to resolve relative links
+    char *req_hdrs;        /// headers to send, from request of page
+    struct pf_page *next;
+} pf_page_t;
+
+/** prefetcher, a background thread warming cache with links */
+typedef struct {
+    cache_t *cp;
+    timer_wheel_t *tw;
+    int budget;            /// links fetched per page at most
+    int connect_timeout;   /// ms
+    int idle_timeout;      /// ms
+    pf_page_t *head;       /// queue of pages
+    pf_page_t *tail;
+    int queued;            /// number of pages in queue
+    sem_t mutex;           /// protects queue
+    sem_t items;           /// counts pages in queue
+    char *buf;             /// response being fetched
+    /** statistics */
+    unsigned int page_cnt;     /// pages scanned
+    unsigned int drop_cnt;     /// pages dropped, queue is full
+    unsigned int fetch_cnt;    /// links fetched and cached
+    unsigned int skip_cnt;     /// links already cached
+} prefetch_t;
+
+void pf_init(prefetch_t *pf, cache_t *cp, timer_wheel_t *tw, int budget,
+             int connect_timeout, int idle_timeout);
+/* queue a response for scanning if it's a html page */
+void pf_page(prefetch_t *pf, const char *data, int size, 
+             const char *hostname, int port, const char *path,
+             const char *req_hdrs);
+
+#endif /* __PREFETCH_H__ */
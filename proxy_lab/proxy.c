@@ -6,42 +6,193 @@
  * Basic flow
  *      1. create a fd to listen
  *      2. create a pool of pthread to deal with connection
- *      3. whenever new connection is accepted, insert to sbuf 
- *      4. pthread of pool will continuosly remove a fd from 
- *         sbuf and do the proxy job
+ *      3. whenever new connection is accepted, insert to fair queue,
+ *         unless its client is over rate (429) or queue is full (503)
+ *      4. pthread of pool will continuosly remove a request from 
+ *         fair queue and do the proxy job
  *         a. parse header 
  *         b. check if cache hit, it so, return data from cache 
+ *            (a Range request is answered with 206 from the cached
+ *            full object)
  *         c. otherwise, establish connection to real host, get 
  *            data from host and send it back to client, also 
  *            write to cache it the size is less than MAX_OBJECT_SIZE
+ *            and it's not a partial(206) response
+ *         d. cached response is keyed by tag and the request headers
+ *            listed in its Vary header
+ *         e. with -p, eviction policy can be lru, gdsf or lfuda
+ *            to favor object or byte hit ratio, see cache.c
+ *         f. with -a, a TinyLFU filter decides whether a new object
+ *            is worth evicting others, see cache.c
+ *         g. with -z, a gzip encoded response is decoded on the fly for
+ *            client does not accept gzip, only the encoded copy is
+ *            cached
+ *      5. each request has deadlines for reading header, connecting,
+ *         making progress while relaying and the whole request. A
+ *         timer wheel shuts down the fds of a request whose deadline 
+ *         passed, so the blocked worker returns and closes them. 
+ *         Timed-out requests are counted by phase
+ *      6. connecting to real host doesn't hold a worker. A request 
+ *         on cache miss is handed to connector thread, which races 
+ *         the addresses of host (IPv6 and IPv4) with non-blocking 
+ *         connects, then puts the request back to queue for relaying
+ *      7. with -f, links of a html page on same origin are fetched 
+ *         into cache by a background thread, see prefetch.c
+ *      8. with -s path, operators can purge and inspect cache and dump 
+ *         counters on a UNIX socket, see admin.c
+ *      9. with -e uring, main thread serves connections on io_uring
+ *         instead of blocking accept: accept, reading header, sending
+ *         a plain cache hit and close are batched per loop iteration
+ *         with registered buffers, workers only see the other requests
+ *     10. with -T file, each request is recorded in a binary trace 
+ *         (tag, size, status, latency, hit), replay tool drives cache
+ *         with it to compare policies and sizes, see trace.c
+ *     11. signals, taken by main thread only:
+ *         SIGHUP: read config file (-c) again and apply limits, cache
+ *                 capacity, number of workers and timeouts, cache is 
+ *                 kept
+ *         SIGTERM: stop accepting, wait for in-flight requests until
+ *                  drain deadline, then exit
+ *         SIGUSR2: start a new process (same argv, maybe new binary)
+ *                  with listening socket in env PROXY_LISTEN_FD, then 
+ *                  drain as SIGTERM, so there's no downtime to upgrade
  * Used file:
  *      csapp.h/csapp.c: do a little hack for error handling
- *      sbuf.h/sbuf.c: from webside
+ *      netio.h/netio.c: error returning I/O, one bad peer only fails
+ *                       its own request
+ *      fairq.h/fairq.c: per client round robin queue and rate limit
  *      cache.h/cache.c: a reader/writer link-list based cache
+ *      http.h/http.c: helpers to look into raw HTTP messages
+ *      gunzip.h/gunzip.c: streaming decoder for gzip encoded body
+ *      config.h/config.c: command line options and config file
+ *      timer.h/timer.c: timer wheel to enforce deadlines
+ *      connector.h/connector.c: asynchronous connects to real host
+ *      uring.h/uring.c: a minimal io_uring by raw syscalls
+ *      bufpool.h/bufpool.c: reusable buffers, so workers' stacks are
+ *                           small
+ *      prefetch.h/prefetch.c: warm cache with links of html pages
+ *      admin.h/admin.c: admin endpoint on a UNIX socket
+ *      trace.h/trace.c: binary trace of requests, read by replay.c
  *
  * @note
  *      It's a basic pthread pool version as text presented 
  *
   */
 #include <stdio.h>
+#include <sys/resource.h>
 #include "csapp.h"
-#include "sbuf.h"
+#include "fairq.h"
 #include "cache.h"
+#include "http.h"
+#include "gunzip.h"
+#include "config.h"
+#include "timer.h"
+#include "netio.h"
+#include "connector.h"
+#include "uring.h"
+#include "bufpool.h"
+#include "prefetch.h"
+#include "admin.h"
+#include "trace.h"
 
 /* Recommended max cache and object sizes */
 #define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
 
-/* Thread pool size and buf size */
-#define POOL_SIZE 32
-#define SBUF_SIZE 400
+/* queue size, worker stack size and max number of work buffers */
+#define QUEUE_SIZE 400
+#define WORKER_STACK_SIZE (256 * 1024)  /// no large buffer on stack
+#define MAX_WORK_BUFS 256               /// 25MB, more workers share them
+
+/* Phases of a request, a timeout is counted by its phase */
+#define PHASE_HEADER  0    /// reading request header
+#define PHASE_CONNECT 1    /// connecting to real host
+#define PHASE_IDLE    2    /// sending/relaying response
+#define PHASE_TOTAL   3    /// deadline of whole request, any phase
+#define NO_OF_PHASE   4
+
+/* States of a request in queue */
+#define REQ_NEW       0    /// just accepted
+#define REQ_PARSED    1    /// header is read by uring loop, not looked up
+#define REQ_MISS      2    /// cache miss found by uring loop
+#define REQ_CONNECTED 3    /// connector is done, ready to relay
+
+/* uring engine, see uring_serve */
+#define UR_ENTRIES    256               /// size of submission queue
+#define UR_SLOTS      32                /// connections in flight
+#define UR_BUF_SIZE   MAX_OBJECT_SIZE   /// registered buffer per slot
+#define UR_ACCEPT     0                 /// ops in user_data
+#define UR_READ       1
+#define UR_WRITE      2
+#define UR_CLOSE      3
+
+/* listening socket handed from old process, see hand_off */
+#define LISTEN_FD_ENV "PROXY_LISTEN_FD"
+
+/* do_proxy returns it when request is handed to connector */
+#define PROXY_PENDING 2
+
+/** context of a request, lives across workers */
+typedef struct {
+    int fd;                    /// fd of client
+    unsigned int client;       /// address of client, key of fair queue
+    int state;                 /// REQ_NEW or REQ_CONNECTED
+    int phase;                 /// current phase for counting timeout
+    timer_entry_t te;          /// deadlines of this request
+    char hostname[MAXLINE];    /// real host
+    char path[MAXLINE];
+    int port;
+    char tag[MAXLINE];         /// cache tag, canonical form of URI
+    char hdr_buf[MAXBUF];      /// whole modified request header
+    int may_decode;            /// 1 if client needs a decoded body
+    char range[MAXLINE];       /// value of Range header
+    int has_range;             /// 1 if range is used
+    int hold;                  /// 1 if response is held to answer range
+    conn_job_t job;            /// connecting to real host
+    /* for trace */
+    long long start_us;        /// when it's accepted
+    int status;                /// status of response, 0 if none
+    int size;                  /// bytes of response
+    int hit;                   /// 1 if served from cache
+} req_t;
 
 /* Shared global variable */
-sbuf_t sbuf;
+fairq_t fq;
 cache_t cache;
+conf_t conf;
+timer_wheel_t timers;
+bufpool_t bufs;            /// copy of response for cache, one per request
+int inflight;              /// requests accepted and not finished
+int nworkers;              /// worker threads, only main thread changes it
+char **saved_argv;         /// to start new process by hand_off
+/* set by signal handler, main thread acts on them */
+volatile sig_atomic_t reloading;   /// SIGHUP
+volatile sig_atomic_t stopping;    /// SIGTERM
+volatile sig_atomic_t upgrading;   /// SIGUSR2
+sigset_t main_signals;     /// the ones above, blocked in other threads
+prefetch_t prefetcher;     /// warms cache with links of html pages
+unsigned int timeout_cnt[NO_OF_PHASE];   /// number of timeouts by phase
 
 /** Helper functions declarations */
-void do_proxy(int fd);
+req_t *new_req(int fd, unsigned int client);
+void end_req(req_t *req, int rc);
+void finish_req(req_t *req, int rc);
+void serve_req(req_t *req);
+void connect_done(conn_job_t *job);
+int do_proxy(req_t *req);
+int read_request(req_t *req, rio_t *rp);
+int do_lookup(req_t *req);
+int do_fetch(req_t *req);
+int do_relay(req_t *req);
+int uring_serve(int listenfd);
+void catch_signal(int signum);
+void on_signal(int signum);
+void set_workers(int n);
+void reload_conf(void);
+int hand_off(int listenfd);
+void check_signals(int listenfd);
+void drain(void);
+void dump_stats(int fd);
 void *thread(void *vargp);
 void clienterror(int fd, char *cause, char *errnum, 
 		 char *shortmsg, char *longmsg);
@@ -49,7 +200,15 @@ int parse_request(int fd, char *method, char *uri, char *version, \
                   char *out_host, char *out_path, int *out_port);
 int parse_uri(char *in_uri, char *out_host, char *out_path, int *out_port);
 int validate_version(const char *version);
-int read_and_refine_req_hdrs(rio_t *rp, char *out_buf, char *in_host);
+int read_and_refine_req_hdrs(rio_t *rp, char *out_buf, char *in_host, \
+                             char *out_accept_enc);
+int relay_response(int fd, rio_t *rp, char *out_data, int *out_size, \
+                   int may_decode, int hold, timer_entry_t *te);
+int flush_held(int fd, char *data, int size, int may_decode, \
+               int *out_decode, gunzip_t *gz);
+int send_cached(int fd, char *data, int size, char *range, int may_decode);
+int is_decodable(char *data, int body_off);
+int send_decoded_hdrs(int fd, char *data, int body_off);
 
 
 /* You won't lose style points for including these long lines in your code */
@@ -63,34 +222,105 @@ static const char *proxy_connection_hdr = "Proxy-Connection: close\r\n";
 
 int main(int argc, char **argv)
 {
-    int i, listenfd, connfd, port, clientlen;
+    int listenfd, connfd, clientlen;
     struct sockaddr_in clientaddr;
-    pthread_t tid;
+    char *env;
+    req_t *req;
 
     clientlen = sizeof(clientaddr);
+    saved_argv = argv;
 
-    if (argc != 2) {
-	fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    conf_init(&conf);
+    if (conf_parse_args(&conf, argc, argv)) {
+        conf_usage(argv[0]);
 	exit(1);
     }
 
     // Handle signal
     Signal(SIGPIPE, SIG_IGN);
+    // block them till all threads are created, so only main takes them
+    sigemptyset(&main_signals);
+    sigaddset(&main_signals, SIGHUP);
+    sigaddset(&main_signals, SIGTERM);
+    sigaddset(&main_signals, SIGUSR2);
+    Sigprocmask(SIG_BLOCK, &main_signals, NULL);
+    catch_signal(SIGHUP);
+    catch_signal(SIGTERM);
+    catch_signal(SIGUSR2);
+
+    fq_init(&fq, QUEUE_SIZE, conf.client_queue, conf.rate, conf.burst);
+    bp_init(&bufs, conf.workers < MAX_WORK_BUFS ? conf.workers : MAX_WORK_BUFS, 
+            MAX_OBJECT_SIZE, conf.huge_pages);
+    tw_init(&timers);
+    connector_init();
+    if (cache_init(&cache, conf.policy, conf.admission)) {
+        fprintf(stderr, "unknown cache policy: %s\n", conf.policy);
+        conf_usage(argv[0]);
+        exit(1);
+    }
+    cache_resize(&cache, conf.cache_size);
 
-    port = atoi(argv[1]);
-    sbuf_init(&sbuf, SBUF_SIZE);
-    cache_init(&cache);
+    if (conf.prefetch) {
+        pf_init(&prefetcher, &cache, &timers, conf.prefetch, 
+                conf.connect_timeout, conf.idle_timeout);
+    }
 
-    listenfd = Open_listenfd(port);
+    if (NULL != conf.admin && admin_init(conf.admin, &cache, dump_stats)) {
+        fprintf(stderr, "can't open admin socket %s: %s\n", conf.admin, 
+                strerror(errno));
+        exit(1);
+    }
 
-    // create worker thread 
-    for (i = 0; i < POOL_SIZE; i++){
-        Pthread_create(&tid, NULL, thread, NULL);
+    if (NULL != conf.trace && trace_open(conf.trace)) {
+        fprintf(stderr, "can't open trace file %s: %s\n", conf.trace, 
+                strerror(errno));
+        exit(1);
+    }
+
+    // socket of old process if it's an upgrade
+    if (NULL != (env = getenv(LISTEN_FD_ENV))) {
+        listenfd = atoi(env);
+        unsetenv(LISTEN_FD_ENV);
+    } else if ((listenfd = Open_listenfd(conf.port)) < 0) {
+        exit(1);
+    }
+
+    set_workers(conf.workers);
+    Sigprocmask(SIG_UNBLOCK, &main_signals, NULL);
+
+    if (NULL != conf.engine && !strcmp(conf.engine, "uring")) {
+        if (!uring_serve(listenfd)) {
+            drain();
+        }
+        fprintf(stderr, "io_uring is not available, use blocking engine\n");
     }
     
     while (1) {
-	connfd = Accept(listenfd, (SA *)&clientaddr, (socklen_t *)&clientlen);
-        sbuf_insert(&sbuf, connfd);
+        check_signals(listenfd);
+        if (stopping) {
+            drain();
+        }
+	connfd = nio_accept(listenfd, (SA *)&clientaddr, (socklen_t *)&clientlen);
+        if (connfd < 0) {
+            if (nio_classify(errno) == NIO_RESOURCE) {
+                usleep(10 * 1000);  // out of fds, let workers release some
+            }
+            continue;
+        }
+        if (fq_admit(&fq, clientaddr.sin_addr.s_addr)) {
+            clienterror(connfd, "", "429", "Too Many Requests",
+                    "Proxy server limits requests of each client");
+            nio_close(connfd);
+            continue;
+        }
+        req = new_req(connfd, clientaddr.sin_addr.s_addr);
+        if (fq_insert(&fq, req->client, req, 0)) {
+            clienterror(connfd, "", "503", "Service Unavailable",
+                    "Proxy server is too busy");
+            nio_close(connfd);
+            Free(req);
+            __sync_fetch_and_sub(&inflight, 1);
+        }
     }
 }
 
@@ -98,110 +328,1212 @@ int main(int argc, char **argv)
 
 /**
  * @brief
- *      do one proxy service
+ *      catch a signal without SA_RESTART, so the blocking accept of 
+ *      main thread returns and checks what to do
+ */
+void catch_signal(int signum) {
+    struct sigaction action;
+
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0;
+    if (sigaction(signum, &action, NULL) < 0) {
+        unix_error("Signal error");
+    }
+}
+
+/**
+ * @brief
+ *      signal handler, only set a flag
+ */
+void on_signal(int signum) {
+    if (signum == SIGHUP) {
+        reloading = 1;
+    } else if (signum == SIGTERM) {
+        stopping = 1;
+    } else if (signum == SIGUSR2) {
+        upgrading = 1;
+    }
+}
+
+/**
+ * @brief
+ *      start or retire workers to have n of them. A worker is retired
+ *      by a NULL request, after it finishes the one at hand
+ * @param 
+ *      n: number of workers wanted
+ */
+void set_workers(int n) {
+    pthread_attr_t attr;
+    pthread_t tid;
+    sigset_t old;
+
+    // small stack so there can be thousands, and new ones inherit the
+    // mask without signals of main thread, also when it's a reload
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+    pthread_sigmask(SIG_BLOCK, &main_signals, &old);
+    for (; nworkers < n; nworkers++) {
+        Pthread_create(&tid, &attr, thread, NULL);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+    for (; nworkers > n; nworkers--) {
+        fq_insert(&fq, 0, NULL, 1);
+    }
+}
+
+/**
+ * @brief
+ *      parse argv and config file again, apply the options which can
+ *      change at run time, see config.h. Old config is kept if it 
+ *      fails
+ */
+void reload_conf(void) {
+    conf_t next;
+    int argc;
+
+    if (NULL == conf.config) {
+        fprintf(stderr, "SIGHUP: no config file to reload\n");
+        return;
+    }
+    for (argc = 0; saved_argv[argc]; argc++) {
+        ;
+    }
+    conf_init(&next);
+    if (conf_parse_args(&next, argc, saved_argv)) {
+        fprintf(stderr, "SIGHUP: config is not reloaded\n");
+        Free(next.file_buf);
+        return;
+    }
+
+    conf.inflate = next.inflate;
+    conf.header_timeout = next.header_timeout;
+    conf.connect_timeout = next.connect_timeout;
+    conf.attempt_timeout = next.attempt_timeout;
+    conf.idle_timeout = next.idle_timeout;
+    conf.total_timeout = next.total_timeout;
+    conf.drain_timeout = next.drain_timeout;
+    conf.rate = next.rate;
+    conf.burst = next.burst;
+    conf.client_queue = next.client_queue;
+    fq_set_limits(&fq, conf.client_queue, conf.rate, conf.burst);
+    if (conf.cache_size != next.cache_size) {
+        conf.cache_size = next.cache_size;
+        cache_resize(&cache, conf.cache_size);
+    }
+    conf.workers = next.workers;
+    set_workers(conf.workers);
+    Free(next.file_buf);  // strings of next are not used
+    fprintf(stderr, "SIGHUP: config is reloaded\n");
+}
+
+/**
+ * @brief
+ *      start a new process by same argv, the listening socket is 
+ *      passed in env, any other fd is closed. A pipe closed by exec
+ *      tells whether exec succeeded
+ * @param 
+ *      listenfd: the listening socket
+ * @ret
+ *      0 if new process is running, -1 if error
+ */
+int hand_off(int listenfd) {
+    char buf[MAXLINE];
+    struct rlimit rl;
+    int pfd[2], fd, err = 0;
+    pid_t pid;
+
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (pipe(pfd) < 0) {
+        fprintf(stderr, "SIGUSR2: pipe error: %s\n", strerror(errno));
+        return -1;
+    }
+    fcntl(pfd[1], F_SETFD, FD_CLOEXEC);
+    sprintf(buf, "%d", listenfd);
+    setenv(LISTEN_FD_ENV, buf, 1);
+
+    if ((pid = fork()) == 0) {
+        // only async-signal-safe calls after fork of a threaded process
+        for (fd = 3; fd < (int)rl.rlim_cur; fd++) {
+            if (fd != listenfd && fd != pfd[1]) {
+                close(fd);
+            }
+        }
+        execvp(saved_argv[0], saved_argv);
+        err = errno;
+        if (write(pfd[1], &err, sizeof(err))) {
+            ;
+        }
+        _exit(1);
+    }
+    unsetenv(LISTEN_FD_ENV);
+    close(pfd[1]);
+    if (pid < 0) {
+        err = errno;
+    } else if (read(pfd[0], &err, sizeof(err)) <= 0) {
+        err = 0;  // closed by exec
+    } else {
+        waitpid(pid, NULL, 0);
+    }
+    close(pfd[0]);
+
+    if (err) {
+        fprintf(stderr, "SIGUSR2: can't start new process: %s\n", 
+                strerror(err));
+        return -1;
+    }
+    fprintf(stderr, "SIGUSR2: listening socket is handed to %d\n", pid);
+    return 0;
+}
+
+/**
+ * @brief
+ *      act on signals caught, called by main thread before accepting.
+ *      When it's stopping, listening socket is closed
+ * @param 
+ *      listenfd: the listening socket
+ */
+void check_signals(int listenfd) {
+    static int closed = 0;
+
+    if (reloading) {
+        reloading = 0;
+        reload_conf();
+    }
+    if (upgrading) {
+        upgrading = 0;
+        if (!hand_off(listenfd)) {
+            stopping = 1;
+        }
+    }
+    if (stopping && !closed) {
+        nio_close(listenfd);
+        closed = 1;
+    }
+}
+
+/**
+ * @brief
+ *      wait for in-flight requests until drain deadline, then exit.
+ *      Requests still there are cut off by exit
+ */
+void drain(void) {
+    long long deadline = tw_now_ms() + conf.drain_timeout;
+
+    while (inflight > 0 && 
+           (!conf.drain_timeout || tw_now_ms() < deadline)) {
+        usleep(50 * 1000);
+    }
+    if (inflight > 0) {
+        fprintf(stderr, "drain deadline passed, %d requests are cut off\n",
+                inflight);
+    }
+    exit(0);
+}
+
+/**
+ * @brief
+ *      create a request of an accepted connection, it's in-flight 
+ *      until finish_req
+ * @param 
+ *      fd: the connection
+ *      client: address of client
+ * @ret
+ *      the request
+ */
+req_t *new_req(int fd, unsigned int client) {
+    req_t *req = Malloc(sizeof(req_t));
+
+    req->fd = fd;
+    req->client = client;
+    req->state = REQ_NEW;
+    req->phase = PHASE_HEADER;
+    req->tag[0] = '\0';
+    req->start_us = trace_now_us();
+    req->status = 0;
+    req->size = 0;
+    req->hit = 0;
+    req->hold = 0;
+    __sync_fetch_and_add(&inflight, 1);
+    return req;
+}
+
+/**
+ * @brief
+ *      end a request before closing its fd, disarm its timer, count
+ *      it if it's timed out and record it in trace
+ * @param 
+ *      req: the request
+ *      rc: return code of do_proxy/do_relay
+ */
+void end_req(req_t *req, int rc) {
+    int phase = req->phase;
+    trace_rec_t rec;
+
+    tw_disarm(&timers, &req->te);  // must be done before closing fd
+
+    if (req->tag[0]) {   // a request not parsed is not worth it
+        rec.ts_us = req->start_us;
+        rec.latency_us = trace_now_us() - req->start_us;
+        rec.size = req->size;
+        rec.status = req->status > 0 ? req->status : 0;
+        rec.hit = req->hit;
+        rec.reserved = 0;
+        rec.reserved2 = 0;
+        trace_record(&rec, req->tag);
+    }
+
+    if (req->te.fired || rc > 0) {
+        if (req->te.deadline && tw_now_ms() >= req->te.deadline) {
+            phase = PHASE_TOTAL;
+        }
+        __sync_fetch_and_add(&timeout_cnt[phase], 1);
+    }
+}
+
+/**
+ * @brief
+ *      finish a request, close and free it
+ * @param 
+ *      req: the request
+ *      rc: return code of do_proxy/do_relay
+ */
+void finish_req(req_t *req, int rc) {
+    end_req(req, rc);
+    nio_close(req->fd);
+    Free(req);
+    __sync_fetch_and_sub(&inflight, 1);
+}
+
+/**
+ * @brief
+ *      serve one request taken from fair queue
+ *
+ * A new request is proxied until it needs to connect to real host,
+ * then the worker is released. When connector is done, the request 
+ * is queued again and the response is relayed by any worker. With
+ * uring engine, a request comes with its header read already.
+ *
+ * @param 
+ *      req: a request get from fq_remove
+ */
+void serve_req(req_t *req) {
+    int rc;
+
+    switch (req->state) {
+        case REQ_NEW:
+            tw_entry_init(&req->te, conf.total_timeout);
+            rc = do_proxy(req);
+            break;
+        case REQ_PARSED:
+            rc = do_lookup(req);
+            break;
+        case REQ_MISS:
+            rc = do_fetch(req);
+            break;
+        default:
+            rc = do_relay(req);
+            break;
+    }
+    if (rc == PROXY_PENDING) {
+        return;   // owned by connector now
+    }
+    finish_req(req, rc);
+}
+
+/**
+ * @brief
+ *      called by connector thread when connecting is done, queue
+ *      the request again for a worker
+ * @param 
+ *      job: the job embedded in req_t
+ */
+void connect_done(conn_job_t *job) {
+    req_t *req = job->arg;
+
+    req->state = REQ_CONNECTED;
+    fq_insert(&fq, req->client, req, 1);  // it's admitted already
+}
+
+/**
+ * @brief
+ *      return ms, capped by the remaining time to deadline of te
+ * @param 
+ *      te: timer entry of request
+ *      ms: timeout of current phase, 0 if none
+ * @ret
+ *      the capped ms, 1 at least if there's any deadline 
+ */
+static int cap_by_deadline(timer_entry_t *te, int ms) {
+    long long remain;
+
+    if (!te->deadline) {
+        return ms;
+    }
+    remain = te->deadline - tw_now_ms();
+    if (remain < 1) {
+        remain = 1;
+    }
+    return (ms > 0 && ms < remain) ? ms : (int)remain;
+}
+
+/**
+ * @brief
+ *      do one proxy service until it needs real host
  *
  * The concept is described at the header of this file
  *  
  * @note 
  *      1. only support http 1.0 GET method
+ *      2. on cache miss, connecting is handed to connector and 
+ *         do_relay continues the request
  * @param 
- *      fd: an newly accepted fd get from sbuf_remove
+ *      req: a new request, fd is set and te is initialized
+ * @ret
+ *      0 if OK, -1 if error, PROXY_PENDING if connecting
  */
-void do_proxy(int fd) {
+int do_proxy(req_t *req) {
     rio_t rio;             /// CSAPP defined io structure
+
+    /* Handle request part */
+    req->phase = PHASE_HEADER;
+    tw_arm(&timers, &req->te, req->fd, -1, conf.header_timeout);
+    Rio_readinitb(&rio, req->fd);
+    if (read_request(req, &rio)) {
+        return -1;
+    }
+    return do_lookup(req);
+}
+
+/**
+ * @brief
+ *      read and parse request line and headers
+ *
+ * @param 
+ *      req: the request, fd is set and te is initialized
+ *      rp: rio_t of client, may be filled with the header already
+ * @ret
+ *      0 if OK, -1 if error
+ */
+int read_request(req_t *req, rio_t *rp) {
+    int fd = req->fd;
     char buf[MAXLINE];     /// tmp buffer 
-    int tmp_len;           /// tmp len
-    char hdr_buf[MAXBUF];  /// store whole modified request header
     char method[MAXLINE];  /// http 1.0 method, should be "GET"
     char uri[MAXLINE];
     char version[MAXLINE];
-    /** uri can be http://hostname:port/path */ 
-    char hostname[MAXLINE];  
-    char path[MAXLINE];
-    int port;
-    /** created out going connection part */
-    int to_real_host_fd;
-    rio_t rio_to_real_host;
-    /* for cache*/
-    char tag[MAXLINE];
-    char cache_data[MAX_OBJECT_SIZE];
-    char *tmp_ptr = cache_data;
-    int cache_data_size = 0;
+    /* for decoding */
+    char accept_enc[MAXLINE];
 
-    /* Handle request part */
-    Rio_readinitb(&rio, fd);
-    if ( Rio_readlineb(&rio, buf, MAXLINE) < 0) { // read firs line of header
-        return;  // return on error
+    if ( nio_readlineb(rp, buf, MAXLINE) <= 0) { // read firs line of header
+        return -1;  // return on error or EOF
+    }
+    if (sscanf(buf, "%s %s %s", method, uri, version) != 3) {
+        clienterror(fd, buf, "400", "Bad Request",
+                "Incorrect request line");
+        return -1;
     }
-    sscanf(buf, "%s %s %s", method, uri, version); 
     // parse and check correctness of request
-    if (parse_request(fd, method, uri, version, hostname, path, &port)){
-        return;
+    if (parse_request(fd, method, uri, version, req->hostname, req->path, \
+                      &req->port)){
+        return -1;
     }
 
     /* Prerare for out going access */
-    if (read_and_refine_req_hdrs(&rio, hdr_buf, hostname)){
-        return;  // return on error
+    if (read_and_refine_req_hdrs(rp, req->hdr_buf, req->hostname, \
+                                 accept_enc)){
+        return -1;  // return on error
+    }
+
+    /* Header is done, now we only wait for sending */
+    req->phase = PHASE_IDLE;
+    tw_arm(&timers, &req->te, fd, -1, conf.idle_timeout);
+    req->may_decode = conf.inflate && !http_accepts_coding(accept_enc, "gzip");
+
+    /* A Range request can be served from a cached full object, 
+     * but with If-Range we can't validate so just ignore the range */
+    req->has_range = http_get_header(req->hdr_buf, strlen(req->hdr_buf), \
+                                     "Range", req->range, MAXLINE);
+    if (http_get_header(req->hdr_buf, strlen(req->hdr_buf), "If-Range", \
+                        buf, MAXLINE)){
+        req->has_range = 0;
+    }
+
+    if (http_canonical_tag(req->hostname, req->port, req->path, \
+                           req->tag, MAXLINE)) {
+        clienterror(fd, req->path, "414", "URI Too Long",
+                "Proxy server can't cache such a long URI");
+        return -1;
     }
+    return 0;
+}
+
+/**
+ * @brief
+ *      answer a parsed request from cache, or fetch it from real host
+ * @param 
+ *      req: a parsed request
+ * @ret
+ *      0 if OK, -1 if error, PROXY_PENDING if connecting
+ */
+int do_lookup(req_t *req) {
+    char *cache_data = bp_get(&bufs);
+    int cache_data_size = 0;
+    int rc;
 
     /* Check if cache hit */
-    sprintf(tag,"%s:%d%s", hostname, port, path);
-    if (read_cache(&cache, tag, cache_data, &cache_data_size)){
-        Rio_writen(fd, cache_data, cache_data_size);
-        return;
+    if (read_cache(&cache, req->tag, req->hdr_buf, cache_data, \
+                   &cache_data_size)){
+        req->hit = 1;
+        req->size = cache_data_size;
+        req->status = http_get_status(cache_data, cache_data_size);
+        rc = send_cached(req->fd, cache_data, cache_data_size, \
+                         req->has_range ? req->range : NULL, \
+                         req->may_decode);
+        bp_put(&bufs, cache_data);
+        return rc;
     } 
+    bp_put(&bufs, cache_data);
+    return do_fetch(req);
+}
+
+/**
+ * @brief
+ *      hand a cache miss to connector
+ * @param 
+ *      req: a parsed request missed in cache
+ * @ret
+ *      -1 if error, PROXY_PENDING if connecting
+ */
+int do_fetch(req_t *req) {
+    int fd = req->fd;
+    timer_entry_t *te = &req->te;
+
+    /* Fetch the full object for a range too, so it can be cached, 
+     * the range is served from it after it's all read */
+    req->hold = http_remove_header(req->hdr_buf, "Range") > 0;
+    http_remove_header(req->hdr_buf, "If-Range");
 
-    /* Now is cache miss */
-    /* Establish connection to the real host */
-    to_real_host_fd = Open_clientfd_r(hostname, port);
+    /* Establish connection to the real host by connector */
+    req->phase = PHASE_CONNECT;
+    if (connector_resolve(&req->job, req->hostname, req->port)) {
+        clienterror(fd, req->hostname, "502", "Bad Gateway",
+                "Proxy server can't resolve host");
+        return -1;
+    }
+    req->job.timeout_ms = cap_by_deadline(te, conf.connect_timeout);
+    req->job.attempt_ms = conf.attempt_timeout;
+    req->job.done = connect_done;
+    req->job.arg = req;
+    tw_arm(&timers, te, fd, -1, req->job.timeout_ms);
+    connector_submit(&req->job);
+    return PROXY_PENDING;
+}
+
+/**
+ * @brief
+ *      continue a request whose connecting is done, relay response
+ *      from real host and update cache
+ * @param 
+ *      req: a request in REQ_CONNECTED state
+ * @ret
+ *      0 if OK, -1 if error, 1 if connecting is timed out
+ */
+int do_relay(req_t *req) {
+    int fd = req->fd;
+    timer_entry_t *te = &req->te;
+    char buf[MAXLINE];     /// tmp buffer 
+    /** created out going connection part */
+    int to_real_host_fd = req->job.fd;
+    rio_t rio_to_real_host;
+    /* for cache*/
+    char *cache_data;      /// from bufs
+    int cache_data_size = 0;
+    int rc = 0;
+
+    if (to_real_host_fd < 0) {
+        if (req->job.err == ETIMEDOUT) {
+            clienterror(fd, req->hostname, "504", "Gateway Timeout",
+                    "Proxy server can't connect to host in time");
+            return 1;
+        }
+        clienterror(fd, req->hostname, "502", "Bad Gateway",
+                "Proxy server can't connect to host");
+        return -1;
+    }
+    if (te->fired) {   // client is shut down while we were connecting
+        nio_close(to_real_host_fd);
+        return 1;
+    }
     Rio_readinitb(&rio_to_real_host, to_real_host_fd);
+
+    req->phase = PHASE_IDLE;
+    tw_arm(&timers, te, fd, to_real_host_fd, conf.idle_timeout);
     
     /* Do the communication */ 
-    // send request to real host
-    sprintf(buf, "GET %s HTTP/1.0\r\n", path);
-    Rio_writen(to_real_host_fd, buf, strlen(buf));
-    Rio_writen(to_real_host_fd, hdr_buf, strlen(hdr_buf));
+    // send request to real host, a path may not fit a request line, or
+    // real host may be gone already
+    if (snprintf(buf, sizeof(buf), "GET %s HTTP/1.0\r\n", req->path) >= 
+        (int)sizeof(buf) ||
+        nio_writen(to_real_host_fd, buf, strlen(buf)) ||
+        nio_writen(to_real_host_fd, req->hdr_buf, strlen(req->hdr_buf))) {
+        tw_disarm(&timers, te);
+        nio_close(to_real_host_fd);
+        return -1;
+    }
     // do the communication
-    while ((tmp_len = Rio_readlineb(&rio_to_real_host, buf, MAXLINE)) > 0) {
-        if ( tmp_len < 0 ){
-            Close(to_real_host_fd);
-            return;        // return on read error
+    cache_data = bp_get(&bufs);
+    if (relay_response(fd, &rio_to_real_host, cache_data, &cache_data_size, \
+                       req->may_decode, req->hold, te) || te->fired) {
+        rc = -1;       // error, a timed out one is not complete
+    }
+    // a held response is sent now, with the range if it's still used
+    if (!rc && req->hold && cache_data_size <= MAX_OBJECT_SIZE) {
+        rc = send_cached(fd, cache_data, cache_data_size, \
+                         req->has_range ? req->range : NULL, \
+                         req->may_decode);
+    }
+    req->size = cache_data_size;
+    req->status = http_get_status(cache_data, (cache_data_size > \
+                      MAX_OBJECT_SIZE) ? MAX_OBJECT_SIZE : cache_data_size);
+
+    // now update cache, and warm cache with links of a html page
+    if (!rc) {
+        cache_response(&cache, req->tag, req->hdr_buf, cache_data, \
+                       cache_data_size);
+        if (conf.prefetch) {
+            pf_page(&prefetcher, cache_data, cache_data_size, \
+                    req->hostname, req->port, req->path, req->hdr_buf);
         }
-        cache_data_size += tmp_len;
-        if ( cache_data_size <= MAX_OBJECT_SIZE) {
-            memcpy(tmp_ptr, buf, tmp_len);
-            tmp_ptr += tmp_len;
+    }
+    bp_put(&bufs, cache_data);
+
+    tw_disarm(&timers, te);
+    nio_close(to_real_host_fd);
+    return rc;
+}
+
+/**
+ * @brief
+ *      relay response from real host to client, and keep a copy
+ *      for cache
+ *
+ * If the response may be decoded for client, header is buffered 
+ * until it ends so we can decide whether to decode, then the body 
+ * is decoded chunk by chunk. Otherwise everything is relayed as is.
+ * The copy for cache is always the original response.
+ * A held response is only copied, the caller sends it. If it turns 
+ * out too big to be held, it's relayed from then on.
+ *
+ * @param 
+ *      fd: fd of client
+ *      rp: rio_t of real host
+ *      out_data: copy of response, up to MAX_OBJECT_SIZE bytes
+ *      out_size: total size of response, may exceed MAX_OBJECT_SIZE
+ *      may_decode: 1 if client needs a decoded body
+ *      hold: 1 to hold response instead of relaying it
+ *      te: timer entry of request, re-armed whenever data arrives
+ * @ret
+ *      0 if OK, -1 if error
+ */
+int relay_response(int fd, rio_t *rp, char *out_data, int *out_size, \
+                   int may_decode, int hold, timer_entry_t *te) {
+    char buf[MAXLINE];
+    int tmp_len;
+    int size = 0;
+    int hdr_done = 0;
+    int decode = 0;
+    int rc = 0;
+    gunzip_t gz;
+
+    while ((tmp_len = nio_readlineb(rp, buf, MAXLINE)) > 0) {
+        tw_arm(&timers, te, fd, rp->rio_fd, conf.idle_timeout);
+        size += tmp_len;
+        if ( size <= MAX_OBJECT_SIZE) {
+            memcpy(out_data + size - tmp_len, buf, tmp_len);
         }
-        if ( Rio_writen(fd, buf, tmp_len)){
-            Close(to_real_host_fd);
-            return;        // return on write error
+
+        if (hold) {
+            if (size <= MAX_OBJECT_SIZE) {
+                continue;  // keep holding
+            }
+            // too big, send what's held and relay the rest
+            hold = 0;
+            hdr_done = 1;
+            if (flush_held(fd, out_data, size - tmp_len, may_decode, \
+                           &decode, &gz)) {
+                rc = -1;
+                break;
+            }
+            if (decode) {
+                if (gunzip_write(&gz, buf, tmp_len)) {
+                    rc = -1;
+                    break;
+                }
+                continue;
+            }
+        } else if (!hdr_done) {
+            hdr_done = !strcmp(buf, "\r\n") || !strcmp(buf, "\n");
+            if (may_decode) {
+                if (size > MAX_OBJECT_SIZE) {
+                    rc = -1;   // header is too big to be buffered
+                    break;
+                }
+                if (!hdr_done) {
+                    continue;  // keep buffering
+                }
+                // the whole header is buffered, decide now
+                if (is_decodable(out_data, size)) {
+                    decode = 1;
+                    if (send_decoded_hdrs(fd, out_data, size) ||
+                        gunzip_init(&gz, fd)) {
+                        rc = -1;
+                        break;
+                    }
+                } else if (nio_writen(fd, out_data, size)) {
+                    rc = -1;
+                    break;
+                }
+                continue;
+            }
+        } else if (decode) {
+            if (gunzip_write(&gz, buf, tmp_len)) {
+                rc = -1;
+                break;
+            }
+            continue;
+        }
+
+        if ( nio_writen(fd, buf, tmp_len)){
+            rc = -1;
+            break;     // return on write error
         }
     }
+    if (tmp_len < 0) {
+        rc = -1;       // return on read error
+    }
+
+    // header never ended, flush what we buffered
+    if (!rc && !hold && may_decode && !hdr_done && size > 0) {
+        rc = nio_writen(fd, out_data, size);
+    }
+
+    if (decode) {
+        gunzip_end(&gz);
+    }
+    *out_size = size;
+    return rc;
+}
 
-    // now update cache 
-    if (cache_data_size <= MAX_OBJECT_SIZE){
-        write_cache(&cache, tag, cache_data, cache_data_size);
+/**
+ * @brief
+ *      send the held part of a response which is too big to be held,
+ *      and start decoding if client needs it
+ * @param 
+ *      fd: fd of client
+ *      data: the held part
+ *      size: size of held part
+ *      may_decode: 1 if client needs a decoded body
+ *      out_decode: set to 1 if the rest is to be decoded by gz
+ *      gz: initialized if it's decoded
+ * @ret
+ *      0 if OK, -1 if error
+ */
+int flush_held(int fd, char *data, int size, int may_decode, \
+               int *out_decode, gunzip_t *gz) {
+    int body_off = http_body_offset(data, size);
+
+    if (body_off < 0) {
+        return -1;     // header is too big to be held
+    }
+    if (may_decode && is_decodable(data, body_off)) {
+        if (send_decoded_hdrs(fd, data, body_off) || gunzip_init(gz, fd)) {
+            return -1;
+        }
+        *out_decode = 1;
+        return gunzip_write(gz, data + body_off, size - body_off);
     }
+    return nio_writen(fd, data, size);
+}
+
+/**
+ * @brief
+ *      write counters of proxy for STATS of admin endpoint
+ * @param
+ *      fd: admin client
+ */
+void dump_stats(int fd) {
+    static const char *phases[NO_OF_PHASE] = \
+        {"header", "connect", "idle", "total"};
+    static const char *classes[NO_OF_NIO_CLASS] = \
+        {"peer", "resource", "bug"};
+    char buf[MAXLINE];
+    int i;
 
-    Close(to_real_host_fd);
-    return;
+    for (i = 0; i < NO_OF_PHASE; i++) {
+        sprintf(buf, "timeout.%s %u\n", phases[i], timeout_cnt[i]);
+        nio_writen(fd, buf, strlen(buf));
+    }
+    for (i = 0; i < NO_OF_NIO_CLASS; i++) {
+        sprintf(buf, "nio_error.%s %u\n", classes[i], nio_err_cnt[i]);
+        nio_writen(fd, buf, strlen(buf));
+    }
+    sprintf(buf, "proxy.workers %d\nproxy.inflight %d\n", nworkers, inflight);
+    nio_writen(fd, buf, strlen(buf));
+    if (NULL != conf.trace) {
+        sprintf(buf, "trace.records %u\ntrace.dropped %u\n",
+                trace_rec_cnt, trace_drop_cnt);
+        nio_writen(fd, buf, strlen(buf));
+    }
+    sprintf(buf, "queue.rate_rejects %u\nqueue.full_rejects %u\n",
+            fq.rate_reject_cnt, fq.full_reject_cnt);
+    nio_writen(fd, buf, strlen(buf));
+    if (conf.prefetch) {
+        sprintf(buf, "prefetch.pages %u\nprefetch.dropped %u\n"
+                     "prefetch.fetched %u\nprefetch.skipped %u\n",
+                prefetcher.page_cnt, prefetcher.drop_cnt, 
+                prefetcher.fetch_cnt, prefetcher.skip_cnt);
+        nio_writen(fd, buf, strlen(buf));
+    }
 }
 
 /**
  * @brief
  *      call with Pthread_create, detach from main thread
- *      then keep get fd from sbuf do the proxy service
+ *      then keep get request from fair queue do the proxy service,
+ *      until a NULL request retires it
  */
 void *thread(void *vargp){
-    int connfd;
+    req_t *req;
     Pthread_detach(pthread_self());
     while(1) {
-        connfd = sbuf_remove(&sbuf); // get a connfd from pool
-        do_proxy(connfd);            // do proxy service
-        Close(connfd);
+        req = fq_remove(&fq);        // get a request from pool
+        if (NULL == req) {
+            return NULL;
+        }
+        serve_req(req);              // do proxy service
+    }
+}
+
+/** address of connection being accepted by uring loop */
+static struct sockaddr_in accept_addr;
+static socklen_t accept_len;
+
+/** a connection served by uring loop */
+typedef struct {
+    req_t *req;            /// NULL if slot is free
+    char *buf;             /// registered buffer of this slot
+    int len;               /// bytes of header read, or response size
+    int sent;              /// bytes of response sent
+} ur_slot_t;
+
+/**
+ * @brief
+ *      queue an op on a slot, user_data is (slot << 2 | op)
+ * @param 
+ *      ur: the ring
+ *      op: UR_*
+ *      idx: index of slot, ignored for accept and close
+ *      fd: the fd
+ *      slot: the slot for read/write
+ */
+static void ur_queue(uring_t *ur, int op, int idx, int fd, ur_slot_t *slot) {
+    struct io_uring_sqe *sqe;
+    unsigned long long data = ((unsigned long long)idx << 2) | op;
+
+    while (NULL == (sqe = uring_get_sqe(ur))) {
+        usleep(1000);   // kernel is too busy to take sqes, rare
+    }
+    if (op == UR_ACCEPT) {
+        accept_len = sizeof(accept_addr);
+        uring_prep_accept(sqe, fd, (SA *)&accept_addr, &accept_len, data);
+    } else if (op == UR_READ) {
+        uring_prep_rw_fixed(sqe, IORING_OP_READ_FIXED, fd, \
+                            slot->buf + slot->len, RIO_BUFSIZE - slot->len, \
+                            idx, data);
+    } else if (op == UR_WRITE) {
+        uring_prep_rw_fixed(sqe, IORING_OP_WRITE_FIXED, fd, \
+                            slot->buf + slot->sent, slot->len - slot->sent, \
+                            idx, data);
+    } else {
+        uring_prep_close(sqe, fd, data);
     }
 }
 
+/**
+ * @brief
+ *      the header of a request is in slot buffer, parse it and send
+ *      a plain cache hit from the slot buffer. Anything else is 
+ *      handed to workers
+ * @param 
+ *      ur: the ring
+ *      idx: index of slot
+ *      slot: the slot
+ * @ret
+ *      0 if a write is queued, 1 if slot is released, -1 if error
+ */
+static int ur_dispatch(uring_t *ur, int idx, ur_slot_t *slot) {
+    req_t *req = slot->req;
+    rio_t rio;
+
+    // header is all buffered, so parsing it never blocks
+    Rio_readinitb(&rio, req->fd);
+    memcpy(rio.rio_buf, slot->buf, slot->len);
+    rio.rio_cnt = slot->len;
+    if (read_request(req, &rio)) {
+        return -1;
+    }
+
+    if (!req->has_range && !req->may_decode) {
+        if (read_cache(&cache, req->tag, req->hdr_buf, slot->buf, \
+                       &slot->len)) {
+            req->hit = 1;
+            req->size = slot->len;
+            req->status = http_get_status(slot->buf, slot->len);
+            slot->sent = 0;
+            ur_queue(ur, UR_WRITE, idx, req->fd, slot);
+            return 0;
+        }
+        req->state = REQ_MISS;
+    } else {
+        req->state = REQ_PARSED;  // a worker sends it with send_cached
+    }
+    slot->req = NULL;
+    if (fq_insert(&fq, req->client, req, 0)) {
+        slot->req = req;
+        clienterror(req->fd, "", "503", "Service Unavailable",
+                "Proxy server is too busy");
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * @brief
+ *      serve connections with io_uring on calling thread
+ *
+ * Accept, reading request header, sending cache hit and close are 
+ * submitted to a ring and all sqes queued while handling completions
+ * are submitted by one io_uring_enter, which also waits for the next
+ * completions. Each connection in flight owns a slot with registered
+ * buffer. Range requests, decoding and misses are handed to workers
+ * after header is parsed. Deadlines are still enforced by timer 
+ * wheel, shutdown completes the op in flight with an error.
+ *
+ * When it's stopping, the pending accept is cancelled and the loop
+ * returns once connections of its own are done.
+ *
+ * @param 
+ *      listenfd: the listening fd
+ * @ret
+ *      0 if it's stopping, -1 if io_uring can't be set up
+ */
+int uring_serve(int listenfd) {
+    uring_t ur;
+    struct iovec iov[UR_SLOTS];
+    ur_slot_t slots[UR_SLOTS];
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    ur_slot_t *slot;
+    int i, op, idx, res, rc;
+    int free_cnt = UR_SLOTS;
+    int accepting = 0;
+    int cancelling = 0;
+
+    if (uring_init(&ur, UR_ENTRIES)) {
+        return -1;
+    }
+    for (i = 0; i < UR_SLOTS; i++) {
+        slots[i].req = NULL;
+        slots[i].buf = Malloc(UR_BUF_SIZE);
+        iov[i].iov_base = slots[i].buf;
+        iov[i].iov_len = UR_BUF_SIZE;
+    }
+    if (uring_register_buffers(&ur, iov, UR_SLOTS)) {
+        for (i = 0; i < UR_SLOTS; i++) {
+            Free(slots[i].buf);
+        }
+        uring_deinit(&ur);
+        return -1;
+    }
+
+    while (1) {
+        check_signals(listenfd);
+        if (stopping && accepting && !cancelling) {
+            while (NULL == (sqe = uring_get_sqe(&ur))) {
+                usleep(1000);
+            }
+            uring_prep_cancel(sqe, UR_ACCEPT, UR_CLOSE);
+            cancelling = 1;
+        }
+        if (stopping && !accepting && free_cnt == UR_SLOTS) {
+            break;     // the rest are in workers
+        }
+        if (!stopping && !accepting && free_cnt > 0) {
+            ur_queue(&ur, UR_ACCEPT, 0, listenfd, NULL);
+            accepting = 1;
+        }
+        if (uring_submit_and_wait(&ur, 1)) {
+            continue;
+        }
+
+        while (NULL != (cqe = uring_peek_cqe(&ur))) {
+            op = cqe->user_data & 3;
+            idx = cqe->user_data >> 2;
+            res = cqe->res;
+            uring_cqe_seen(&ur);
+            slot = &slots[idx];
+            rc = 0;
+
+            switch (op) {
+                case UR_ACCEPT:
+                    accepting = 0;
+                    if (res == -ECANCELED) {
+                        break;      // stopping
+                    } else if (res < 0) {
+                        nio_error("uring accept", -res);
+                        if (nio_classify(-res) == NIO_RESOURCE) {
+                            usleep(10 * 1000);  // let workers release fds
+                        }
+                        break;
+                    }
+                    if (fq_admit(&fq, accept_addr.sin_addr.s_addr)) {
+                        clienterror(res, "", "429", "Too Many Requests",
+                                "Proxy server limits requests of each client");
+                        ur_queue(&ur, UR_CLOSE, 0, res, NULL);
+                        break;
+                    }
+                    for (idx = 0; slots[idx].req; idx++) {
+                        ;   // there's a free one as we only accept then
+                    }
+                    slot = &slots[idx];
+                    slot->req = new_req(res, accept_addr.sin_addr.s_addr);
+                    slot->len = 0;
+                    free_cnt--;
+                    tw_entry_init(&slot->req->te, conf.total_timeout);
+                    tw_arm(&timers, &slot->req->te, res, -1, \
+                           conf.header_timeout);
+                    ur_queue(&ur, UR_READ, idx, res, slot);
+                    break;
+                case UR_READ:
+                    if (res <= 0) {
+                        if (res < 0) {
+                            nio_error("uring read", -res);
+                        }
+                        rc = -1;
+                        break;
+                    }
+                    slot->len += res;
+                    if (http_body_offset(slot->buf, slot->len) >= 0) {
+                        rc = ur_dispatch(&ur, idx, slot);
+                    } else if (slot->len >= RIO_BUFSIZE) {
+                        clienterror(slot->req->fd, "", "400", "Bad Request",
+                                "Request header is too large");
+                        rc = -1;
+                    } else {
+                        ur_queue(&ur, UR_READ, idx, slot->req->fd, slot);
+                    }
+                    break;
+                case UR_WRITE:
+                    if (res <= 0) {
+                        if (res < 0) {
+                            nio_error("uring write", -res);
+                        }
+                        rc = -1;
+                        break;
+                    }
+                    slot->sent += res;
+                    if (slot->sent < slot->len) {
+                        tw_arm(&timers, &slot->req->te, slot->req->fd, -1, \
+                               conf.idle_timeout);
+                        ur_queue(&ur, UR_WRITE, idx, slot->req->fd, slot);
+                    } else {
+                        rc = 2;   // done
+                    }
+                    break;
+                default:          // UR_CLOSE, nothing to do
+                    break;
+            }
+
+            if (rc == 0) {
+                continue;
+            }
+            // release the slot, close the fd if it's still ours
+            if (NULL != slot->req) {
+                end_req(slot->req, rc > 0 ? 0 : -1);
+                ur_queue(&ur, UR_CLOSE, 0, slot->req->fd, NULL);
+                Free(slot->req);
+                __sync_fetch_and_sub(&inflight, 1);
+                slot->req = NULL;
+            }
+            free_cnt++;
+        }
+    }
+
+    uring_submit_and_wait(&ur, 0);   // closes queued last
+    uring_deinit(&ur);
+    for (i = 0; i < UR_SLOTS; i++) {
+        Free(slots[i].buf);
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      send a cached object back to client
+ *
+ * If client asks for a byte range and the cached object is a full
+ * 200 response, build a 206 response from it: copy the headers 
+ * except length related ones, then append Content-Range and 
+ * Content-Length and send only the requested slice of body.
+ * A range can't be satisfied gets a 416. Otherwise the whole cached
+ * object is sent, which is always a valid answer to a Range request.
+ * If client needs a decoded body, the range is ignored and the whole
+ * object is decoded.
+ *
+ * @param
+ *      fd: fd to send data to
+ *      data: the cached object, a raw response
+ *      size: size of cached object
+ *      range: value of Range header, NULL if not a Range request
+ *      may_decode: 1 if client needs a decoded body
+ * @ret
+ *      0 if OK, -1 if error
+ */
+int send_cached(int fd, char *data, int size, char *range, int may_decode) {
+    http_range_t rng;
+    char hdr[MAXBUF];
+    int hdr_len = 0;
+    int body_off;
+    long body_len, first, last;
+    char *p, *eol, *hdr_end;
+    gunzip_t gz;
+    int rc;
+
+    body_off = http_body_offset(data, size);
+    if (may_decode && body_off >= 0 && is_decodable(data, body_off)) {
+        if (send_decoded_hdrs(fd, data, body_off) || gunzip_init(&gz, fd)) {
+            return -1;
+        }
+        rc = gunzip_write(&gz, data + body_off, size - body_off);
+        gunzip_end(&gz);
+        return rc;
+    }
+
+    if (NULL == range || body_off < 0 ||
+        http_get_status(data, size) != 200 ||
+        http_get_header(data, body_off, "Transfer-Encoding", hdr, MAXLINE) ||
+        http_parse_range(range, &rng)) {
+        return nio_writen(fd, data, size);  // whole object
+    }
+
+    body_len = size - body_off;
+    if (http_resolve_range(&rng, body_len, &first, &last)) {
+        sprintf(hdr, "HTTP/1.0 416 Range Not Satisfiable\r\n"
+                     "Content-Range: bytes */%ld\r\n"
+                     "Content-Length: 0\r\n\r\n", body_len);
+        return nio_writen(fd, hdr, strlen(hdr));
+    }
+
+    // status line 
+    hdr_len = sprintf(hdr, "HTTP/1.0 206 Partial Content\r\n");
+
+    // copy headers, skip the original status line
+    hdr_end = data + body_off;
+    p = memchr(data, '\n', body_off) + 1;
+    for (; p < hdr_end; p = eol + 1) {
+        eol = memchr(p, '\n', hdr_end - p);
+        if (eol == p || (eol == p + 1 && *p == '\r')) {
+            break;  // end of header
+        }
+        if (!strncasecmp(p, "Content-Length:", 15) ||
+            !strncasecmp(p, "Content-Range:", 14)) {
+            continue;
+        }
+        // leave room for the Content-Range/Content-Length lines
+        if (hdr_len + (eol + 1 - p) + 128 > MAXBUF) {
+            return nio_writen(fd, data, size);  // too long, whole object
+        }
+        memcpy(hdr + hdr_len, p, eol + 1 - p);
+        hdr_len += eol + 1 - p;
+    }
+    hdr_len += sprintf(hdr + hdr_len, "Content-Range: bytes %ld-%ld/%ld\r\n"
+                       "Content-Length: %ld\r\n\r\n",
+                       first, last, body_len, last - first + 1);
+
+    if (nio_writen(fd, hdr, hdr_len)) {
+        return -1;
+    }
+    return nio_writen(fd, data + body_off + first, last - first + 1);
+}
+
+/**
+ * @brief
+ *      check if a response is a full one with gzip/deflate encoded 
+ *      body, which we know how to decode
+ * @param
+ *      data: raw response
+ *      body_off: offset of body, i.e., size of header
+ * @ret
+ *      1 if decodable, 0 otherwise
+ */
+int is_decodable(char *data, int body_off) {
+    char coding[MAXLINE];
+
+    if (http_get_status(data, body_off) != 200 ||
+        !http_get_header(data, body_off, "Content-Encoding", coding, MAXLINE)) {
+        return 0;
+    }
+    return !strcasecmp(coding, "gzip") || !strcasecmp(coding, "x-gzip") || 
+           !strcasecmp(coding, "deflate");
+}
+
+/**
+ * @brief
+ *      send header of a response whose body will be decoded
+ * @note
+ *      Content-Encoding and Content-Length are dropped, the decoded 
+ *      body is ended by closing connection as HTTP/1.0 does
+ * @param
+ *      fd: fd to send data to
+ *      data: raw response
+ *      body_off: offset of body, i.e., size of header
+ * @ret
+ *      0 if OK, -1 if error
+ */
+int send_decoded_hdrs(int fd, char *data, int body_off) {
+    char hdr[MAXBUF];
+    int hdr_len = 0;
+    char *p = data;
+    char *eol;
+    int len;
+
+    for (; p < data + body_off; p = eol + 1) {
+        eol = memchr(p, '\n', data + body_off - p);
+        len = eol + 1 - p;
+        if (!strncasecmp(p, "Content-Encoding:", 17) ||
+            !strncasecmp(p, "Content-Length:", 15)) {
+            continue;
+        }
+        // flush if buffer is full
+        if (hdr_len + len > MAXBUF) {
+            if (nio_writen(fd, hdr, hdr_len)) {
+                return -1;
+            }
+            hdr_len = 0;
+        }
+        if (len > MAXBUF) {
+            if (nio_writen(fd, p, len)) {
+                return -1;
+            }
+            continue;
+        }
+        memcpy(hdr + hdr_len, p, len);
+        hdr_len += len;
+    }
+    return nio_writen(fd, hdr, hdr_len);
+}
+
 /**
  * clienterror - returns an error message to the client
  * copy from tiny.c
@@ -220,12 +1552,12 @@ void clienterror(int fd, char *cause, char *errnum,
 
     /* Print the HTTP response */
     sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-    Rio_writen(fd, buf, strlen(buf));
+    nio_writen(fd, buf, strlen(buf));
     sprintf(buf, "Content-type: text/html\r\n");
-    Rio_writen(fd, buf, strlen(buf));
+    nio_writen(fd, buf, strlen(buf));
     sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-    Rio_writen(fd, buf, strlen(buf));
-    Rio_writen(fd, body, strlen(body));
+    nio_writen(fd, buf, strlen(buf));
+    nio_writen(fd, body, strlen(body));
 }
 
 /**
@@ -237,52 +1569,60 @@ void clienterror(int fd, char *cause, char *errnum,
  *      out_buf: the refined data to return for later use 
  *      in_host: the hostname to format a HOST header if client 
  *               not provide
+ *      out_accept_enc: value of client's Accept-Encoding, "" if not 
+ *                      provided. We replace it so keep it here
  *
  * @ret
  *      0 if OK, -1 if error
  */
-int read_and_refine_req_hdrs(rio_t *rp, char *out_buf, char *in_host) {
+int read_and_refine_req_hdrs(rio_t *rp, char *out_buf, char *in_host, \
+                             char *out_accept_enc) {
     char is_host_given = 0;
     char buf[MAXLINE];
 
+    out_buf[0] = '\0';
+    out_accept_enc[0] = '\0';
+
     /** reading headers */
     while (1) {
-        if ( Rio_readlineb(rp, buf, MAXLINE) < 0 ) {
-            return -1;  // return on error
+        if ( nio_readlineb(rp, buf, MAXLINE) <= 0 ) {
+            return -1;  // return on error or EOF
         }
-        if(!strcmp(buf, "\r\n")){    // end of reading 
+        // end of reading, on the same empty lines as http_body_offset
+        if(!strcmp(buf, "\r\n") || !strcmp(buf, "\n")){
             break;
         }
         if(!strncasecmp(buf,"Host:", 5)){
-            sprintf(out_buf, "%s", buf);
+            strcat(out_buf, buf);
             is_host_given = 1;
         } else if (!strncasecmp(buf,"User-Agent:", 11)){
             // do nothing 
         } else if (!strncasecmp(buf,"Accept:", 7)){
             // do nothing 
         } else if (!strncasecmp(buf,"Accept-Encoding:", 16)){
-            // do nothing
+            http_get_header(buf, strlen(buf), "Accept-Encoding", \
+                            out_accept_enc, MAXLINE);
         } else if (!strncasecmp(buf,"Connection:", 11)){
             // do nothing
         } else if (!strncasecmp(buf,"Proxy-Connection:", 117)){
             // do nothing
         }else {
-            sprintf(out_buf, "%s%s", out_buf, buf);
+            strcat(out_buf, buf);
         }
     }
 
     /** attached required headers as writeup request */
     if (!is_host_given) {
-        sprintf(out_buf, "%sHost: %s\r\n", out_buf, in_host);
+        sprintf(out_buf + strlen(out_buf), "Host: %s\r\n", in_host);
     }
     // User-Agent, Accept, Accept-Enconding, Conncetion, Proxy-Connection
-    sprintf(out_buf, "%s%s", out_buf, user_agent_hdr);
-    sprintf(out_buf, "%s%s", out_buf, accept_hdr);
-    sprintf(out_buf, "%s%s", out_buf, accept_encoding_hdr);
-    sprintf(out_buf, "%s%s", out_buf, connection_hdr);
-    sprintf(out_buf, "%s%s", out_buf, proxy_connection_hdr);
+    strcat(out_buf, user_agent_hdr);
+    strcat(out_buf, accept_hdr);
+    strcat(out_buf, accept_encoding_hdr);
+    strcat(out_buf, connection_hdr);
+    strcat(out_buf, proxy_connection_hdr);
 
-    sprintf(out_buf, "%s\r\n", out_buf);  // header terminator 
+    strcat(out_buf, "\r\n");  // header terminator 
 
     return 0;
 }
@@ -345,8 +1685,9 @@ int parse_request(int fd, char *method, char *uri, char *version,\
  *      0 if OK, -1 if error
  */
 int parse_uri(char *in_uri, char *out_host, char *out_path, int *out_port){
-    char *host_begin, *path_begin, *port_begin;
+    char *host_begin, *path_begin, *port_begin, *port_end;
     int len;        /// tmp len for hostname
+    long port;
 
     // support http only, does not support https
     if (strncasecmp(in_uri, "http://", 7) != 0) {
@@ -378,8 +1719,14 @@ int parse_uri(char *in_uri, char *out_host, char *out_path, int *out_port){
     if (NULL == port_begin) { 
         *out_port = 80;  // default
     } else {
-        // no need to check if atoi success because browser did it for us
-        *out_port = atoi(port_begin+1);
+        // port goes into cache tag and connect, so it must be a real one
+        errno = 0;
+        port = strtol(port_begin+1, &port_end, 10);
+        if (errno || port_end == port_begin+1 || *port_end != '\0' ||
+            port < 1 || port > 65535) {
+            return -1;
+        }
+        *out_port = (int)port;
         // also refine host to remove port 
         *port_begin = '\0';
     }
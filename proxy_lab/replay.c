@@ -0,0 +1,242 @@
+/**
+ * replay.c
+ *
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * Replay traces recorded by proxy -T against cache.c, to compare
+ * eviction policies, admission and cache sizes offline.
+ *      usage: replay [-a] [-p lru,gdsf,...] [-C bytes,...] trace...
+ * Every combination of policies and sizes is run on the same requests:
+ *      1. requests of all traces are sorted by the time they're
+ *         accepted, as a trace is written by chunks of each thread
+ *      2. each request is looked up by its tag, a miss whose response
+ *         is cacheable (200 and not too large) is written to cache
+ *         with a dummy body of its size, as proxy does
+ *      3. hit ratio, byte hit ratio and requests per second of cache
+ *         are printed, with the ones proxy had while recording
+ *
+ * @note
+ *      Vary and Range are not in trace, all variants of a tag are one
+ *      item and a range is counted as the full object
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "trace.h"
+
+#define MAX_RUNS 16   /// policies or sizes in one run at most
+
+/** one request of trace */
+typedef struct {
+    trace_rec_t rec;
+    char *tag;
+    unsigned int seq;   /// order in files, to keep sorting stable
+} replay_req_t;
+
+/** result of one run */
+typedef struct {
+    unsigned long hits;
+    unsigned long long hit_bytes;
+    double secs;
+} replay_result_t;
+
+/**
+ * @brief
+ *      compare requests by ts_us, then order in files
+ */
+static int by_time(const void *a, const void *b) {
+    const replay_req_t *x = a, *y = b;
+
+    if (x->rec.ts_us != y->rec.ts_us) {
+        return x->rec.ts_us < y->rec.ts_us ? -1 : 1;
+    }
+    return x->seq < y->seq ? -1 : 1;
+}
+
+/**
+ * @brief
+ *      append requests of a trace file
+ * @param
+ *      path: the trace file
+ *      reqs/n/cap: growing array of requests
+ * @ret
+ *      0 if OK, -1 if it's not a trace file
+ */
+static int load_trace(const char *path, replay_req_t **reqs,
+                      unsigned int *n, unsigned int *cap) {
+    char tag[MAXLINE];
+    trace_rec_t rec;
+    FILE *fp;
+
+    if (NULL == (fp = fopen(path, "r")) || trace_read_header(fp)) {
+        fprintf(stderr, "%s is not a trace file\n", path);
+        if (NULL != fp) {
+            fclose(fp);
+        }
+        return -1;
+    }
+    while (trace_read(fp, &rec, tag)) {
+        if (*n == *cap) {
+            *cap = *cap ? *cap * 2 : 1024;
+            *reqs = Realloc(*reqs, *cap * sizeof(replay_req_t));
+        }
+        (*reqs)[*n].rec = rec;
+        (*reqs)[*n].tag = Malloc(rec.tag_len + 1);
+        strcpy((*reqs)[*n].tag, tag);
+        (*reqs)[*n].seq = *n;
+        (*n)++;
+    }
+    fclose(fp);
+    return 0;
+}
+
+/**
+ * @brief
+ *      split a comma separated list in place
+ * @ret
+ *      number of items, -1 if there are more than MAX_RUNS
+ */
+static int split_list(char *list, char **out) {
+    char *p;
+    int n = 0;
+
+    for (p = strtok(list, ","); p; p = strtok(NULL, ",")) {
+        if (n == MAX_RUNS) {
+            return -1;
+        }
+        out[n++] = p;
+    }
+    return n;
+}
+
+/**
+ * @brief
+ *      replay requests on a new cache
+ * @param
+ *      reqs/n: the requests
+ *      policy/admission/size: the cache
+ *      res: result is stored here
+ * @ret
+ *      0 if OK, -1 if policy is unknown
+ */
+static int run(replay_req_t *reqs, unsigned int n, const char *policy,
+               int admission, int size, replay_result_t *res) {
+    static char body[MAX_OBJECT_SIZE];
+    static char out[MAX_OBJECT_SIZE];
+    cache_t cache;
+    long long start;
+    unsigned int i;
+    int out_size;
+
+    if (cache_init(&cache, policy, admission)) {
+        return -1;
+    }
+    cache_resize(&cache, size);
+    res->hits = 0;
+    res->hit_bytes = 0;
+
+    start = trace_now_us();
+    for (i = 0; i < n; i++) {
+        if (read_cache(&cache, reqs[i].tag, "", out, &out_size)) {
+            res->hits++;
+            res->hit_bytes += reqs[i].rec.size;
+        } else if (reqs[i].rec.status == 200 &&
+                   reqs[i].rec.size <= MAX_OBJECT_SIZE) {
+            write_cache(&cache, reqs[i].tag, NULL, body, reqs[i].rec.size);
+        }
+    }
+    res->secs = (trace_now_us() - start) / 1e6;
+
+    cache_deinit(&cache);
+    return 0;
+}
+
+/**
+ * @brief
+ *      print usage
+ */
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-a] [-p policies] [-C sizes] trace...\n",
+            prog);
+    fprintf(stderr, "  -a  use TinyLFU admission filter\n");
+    fprintf(stderr, "  -p  comma separated policies, "
+                    "lru,gdsf,lfuda by default\n");
+    fprintf(stderr, "  -C  comma separated capacities in bytes, %d by "
+                    "default\n", MAX_CACHE_SIZE);
+}
+
+int main(int argc, char **argv) {
+    char default_policies[] = "lru,gdsf,lfuda";
+    char *policies[MAX_RUNS], *sizes[MAX_RUNS];
+    char *policy_list = default_policies, *size_list = NULL;
+    int n_policy, n_size = 1, admission = 0, opt, i, j, size;
+    replay_req_t *reqs = NULL;
+    unsigned int n = 0, cap = 0, k;
+    unsigned long hits = 0;
+    unsigned long long bytes = 0, hit_bytes = 0;
+    replay_result_t res;
+
+    while ((opt = getopt(argc, argv, "aC:p:")) != -1) {
+        switch (opt) {
+            case 'a':
+                admission = 1;
+                break;
+            case 'C':
+                size_list = optarg;
+                break;
+            case 'p':
+                policy_list = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    if (optind == argc || (n_policy = split_list(policy_list, policies)) <= 0 ||
+        (NULL != size_list && (n_size = split_list(size_list, sizes)) <= 0)) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    for (i = optind; i < argc; i++) {
+        if (load_trace(argv[i], &reqs, &n, &cap)) {
+            exit(1);
+        }
+    }
+    qsort(reqs, n, sizeof(replay_req_t), by_time);
+
+    // what proxy had while recording
+    for (k = 0; k < n; k++) {
+        bytes += reqs[k].rec.size;
+        if (reqs[k].rec.hit) {
+            hits++;
+            hit_bytes += reqs[k].rec.size;
+        }
+    }
+    printf("%u requests, %llu bytes, recorded hit %.2f%%, byte hit %.2f%%\n",
+           n, bytes, n ? 100.0 * hits / n : 0,
+           bytes ? 100.0 * hit_bytes / bytes : 0);
+    printf("%-8s %-10s %-10s %-8s %-10s %s\n", "policy", "admission",
+           "capacity", "hit%", "byte hit%", "Mreq/s");
+
+    for (i = 0; i < n_policy; i++) {
+        for (j = 0; j < n_size; j++) {
+            size = (NULL == size_list) ? MAX_CACHE_SIZE : atoi(sizes[j]);
+            if (size <= 0 ||
+                run(reqs, n, policies[i], admission, size, &res)) {
+                fprintf(stderr, "bad policy %s or size\n", policies[i]);
+                exit(1);
+            }
+            printf("%-8s %-10s %-10d %-8.2f %-10.2f %.2f\n", policies[i],
+                   admission ? "tinylfu" : "none", size,
+                   n ? 100.0 * res.hits / n : 0,
+                   bytes ? 100.0 * res.hit_bytes / bytes : 0,
+                   res.secs > 0 ? n / res.secs / 1e6 : 0);
+        }
+    }
+
+    for (k = 0; k < n; k++) {
+        Free(reqs[k].tag);
+    }
+    Free(reqs);
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include "csapp.h"
+#include "sketch.h"
+
+/**
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * @note
+ *      Count-min sketch used by TinyLFU admission of cache.
+ *      1. Each key is mapped to one counter in each row, the 
+ *         estimate is the minimum of them
+ *      2. Counters are small and saturated, after sample_size 
+ *         increments all counters are halved, so old popularity 
+ *         fades out (aging)
+ **/
+
+/** Static helper function */
+
+/**
+ * @brief
+ *      index of key's counter in a row, by double hashing
+ * @param
+ *      sp: pointer to sketch_t
+ *      h: hash of key
+ *      row: row number
+ * @ret
+ *      index into table
+ */
+static int counter_index(sketch_t *sp, unsigned long long h, int row) {
+    unsigned int h1 = (unsigned int)h;
+    unsigned int h2 = (unsigned int)(h >> 32) | 1;
+    return row * sp->width + ((h1 + row * h2) & (sp->width - 1));
+}
+
+/**
+ * @brief
+ *      halve all counters
+ * @note
+ *      not thread safe, the caller should hold mutex
+ * @param
+ *      sp: pointer to sketch_t
+ */
+static void age_all(sketch_t *sp) {
+    int i;
+    for (i = 0; i < SKETCH_DEPTH * sp->width; i++) {
+        sp->table[i] >>= 1;
+    }
+    sp->additions /= 2;
+}
+
+/** public function for other program to call */
+
+/**
+ * @brief
+ *      64-bit FNV-1a hash of a string
+ * @param
+ *      key: string to hash
+ * @ret
+ *      hash value
+ */
+unsigned long long fnv_hash(const char *key) {
+    unsigned long long h = 14695981039346656037ULL;
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief
+ *      initialize sketch
+ * @param
+ *      sp: pointer to sketch_t
+ *      width: counters per row, will be rounded up to power of 2
+ */
+void sketch_init(sketch_t *sp, int width) {
+    int w = 1;
+    while (w < width) {
+        w <<= 1;
+    }
+    sp->width = w;
+    sp->table = Calloc(SKETCH_DEPTH * w, sizeof(unsigned char));
+    sp->additions = 0;
+    sp->sample_size = 10 * w;
+    Sem_init(&sp->mutex, 0, 1);
+}
+
+/**
+ * @brief
+ *      de-initialize sketch
+ * @param
+ *      sp: pointer to sketch_t
+ */
+void sketch_deinit(sketch_t *sp) {
+    Free(sp->table);
+}
+
+/**
+ * @brief
+ *      record one access of key
+ * @note
+ *      conservative update: only the minimum counters are increased,
+ *      which reduces over-estimation
+ * @param
+ *      sp: pointer to sketch_t
+ *      key: accessed key
+ */
+void sketch_increment(sketch_t *sp, const char *key) {
+    unsigned long long h = fnv_hash(key);
+    int idx[SKETCH_DEPTH];
+    int i, min = SKETCH_MAX_CNT;
+
+    for (i = 0; i < SKETCH_DEPTH; i++) {
+        idx[i] = counter_index(sp, h, i);
+    }
+
+    P(&sp->mutex);
+    for (i = 0; i < SKETCH_DEPTH; i++) {
+        if (sp->table[idx[i]] < min) {
+            min = sp->table[idx[i]];
+        }
+    }
+    if (min < SKETCH_MAX_CNT) {
+        for (i = 0; i < SKETCH_DEPTH; i++) {
+            if (sp->table[idx[i]] == min) {
+                sp->table[idx[i]]++;
+            }
+        }
+    }
+    if (++sp->additions >= sp->sample_size) {
+        age_all(sp);
+    }
+    V(&sp->mutex);
+}
+
+/**
+ * @brief
+ *      estimate access frequency of key
+ * @param
+ *      sp: pointer to sketch_t
+ *      key: key to estimate
+ * @ret
+ *      estimated frequency, 0 ~ SKETCH_MAX_CNT
+ */
+int sketch_estimate(sketch_t *sp, const char *key) {
+    unsigned long long h = fnv_hash(key);
+    int i, cnt, min = SKETCH_MAX_CNT;
+
+    P(&sp->mutex);
+    for (i = 0; i < SKETCH_DEPTH; i++) {
+        cnt = sp->table[counter_index(sp, h, i)];
+        if (cnt < min) {
+            min = cnt;
+        }
+    }
+    V(&sp->mutex);
+    return min;
+}
@@ -0,0 +1,25 @@
+#ifndef __SKETCH_H__
+#define __SKETCH_H__
+
+#include "csapp.h"
+
+#define SKETCH_DEPTH 4       /// number of hash rows
+#define SKETCH_MAX_CNT 15    /// counters saturate here (4-bit like)
+
+/** count-min sketch to estimate access frequency of a key */
+typedef struct {
+    unsigned char *table;    /// SKETCH_DEPTH rows of width counters
+    int width;               /// counters per row, power of 2
+    int additions;           /// increments since last aging
+    int sample_size;         /// halve all counters after this many
+    sem_t mutex;             /// protects table
+} sketch_t;
+
+/* 64-bit FNV-1a hash, also used by cache for tags */
+unsigned long long fnv_hash(const char *key);
+void sketch_init(sketch_t *sp, int width);
+void sketch_deinit(sketch_t *sp);
+void sketch_increment(sketch_t *sp, const char *key);
+int sketch_estimate(sketch_t *sp, const char *key);
+
+#endif /* __SKETCH_H__ */
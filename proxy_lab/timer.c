@@ -0,0 +1,224 @@
+#include "csapp.h"
+#include "timer.h"
+
+/**
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * @note
+ *      Hashed timer wheel to enforce deadlines on blocking I/O.
+ *      1. An entry is put into slot (expire % TW_SLOTS), the expire
+ *         tick is absolute so an entry further than one round just 
+ *         stays until its round comes
+ *      2. A thread advances the wheel every TW_TICK_MS and fires 
+ *         entries of current slot which are due
+ *      3. Firing an entry shuts down its fds, so a worker blocked on
+ *         read/write of them returns immediately. The worker must 
+ *         disarm the entry before closing the fds, so a fd is never
+ *         shut down after it's reused
+ **/
+
+/** Static helper function */
+
+/**
+ * @brief
+ *      link te into its slot
+ * @note
+ *      not thread safe, the caller should hold mutex
+ * @param
+ *      tw: pointer to timer_wheel_t
+ *      te: entry to link
+ */
+static void link_entry(timer_wheel_t *tw, timer_entry_t *te) {
+    timer_entry_t **head = &tw->slots[te->expire % TW_SLOTS];
+
+    te->prev = NULL;
+    te->next = *head;
+    if (NULL != *head) {
+        (*head)->prev = te;
+    }
+    *head = te;
+    te->linked = 1;
+}
+
+/**
+ * @brief
+ *      unlink te from its slot
+ * @note
+ *      not thread safe, the caller should hold mutex
+ * @param
+ *      tw: pointer to timer_wheel_t
+ *      te: entry to unlink
+ */
+static void unlink_entry(timer_wheel_t *tw, timer_entry_t *te) {
+    if (!te->linked) {
+        return;
+    }
+    if (NULL == te->prev) {
+        tw->slots[te->expire % TW_SLOTS] = te->next;
+    } else {
+        te->prev->next = te->next;
+    }
+    if (NULL != te->next) {
+        te->next->prev = te->prev;
+    }
+    te->linked = 0;
+}
+
+/**
+ * @brief
+ *      fire all due entries of one slot
+ * @note
+ *      not thread safe, the caller should hold mutex
+ * @param
+ *      tw: pointer to timer_wheel_t
+ *      tick: the tick to process
+ */
+static void fire_slot(timer_wheel_t *tw, long long tick) {
+    timer_entry_t *te = tw->slots[tick % TW_SLOTS];
+    timer_entry_t *next;
+    int i;
+
+    while (te) {
+        next = te->next;
+        if (te->expire <= tick) {
+            unlink_entry(tw, te);
+            te->fired = 1;
+            for (i = 0; i < 2; i++) {
+                if (te->fds[i] >= 0) {
+                    shutdown(te->fds[i], SHUT_RDWR);
+                }
+            }
+        }
+        te = next;
+    }
+}
+
+/**
+ * @brief
+ *      thread to drive the wheel
+ * @param
+ *      vargp: pointer to timer_wheel_t
+ */
+static void *tick_thread(void *vargp) {
+    timer_wheel_t *tw = vargp;
+    long long target;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        usleep(TW_TICK_MS * 1000);
+        target = (tw_now_ms() - tw->base_ms) / TW_TICK_MS;
+
+        // catch up if we were late
+        P(&tw->mutex);
+        while (tw->now < target) {
+            tw->now++;
+            fire_slot(tw, tw->now);
+        }
+        V(&tw->mutex);
+    }
+    return NULL;
+}
+
+/** public function for other program to call */
+
+/**
+ * @brief
+ *      initialize a wheel and start its thread
+ * @param
+ *      tw: pointer to timer_wheel_t
+ */
+void tw_init(timer_wheel_t *tw) {
+    pthread_t tid;
+
+    memset(tw->slots, 0, sizeof(tw->slots));
+    tw->now = 0;
+    tw->base_ms = tw_now_ms();
+    Sem_init(&tw->mutex, 0, 1);
+    Pthread_create(&tid, NULL, tick_thread, tw);
+}
+
+/**
+ * @brief
+ *      current time of monotonic clock
+ * @ret
+ *      time in ms
+ */
+long long tw_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief
+ *      initialize an entry
+ * @param
+ *      te: entry to initialize
+ *      total_ms: deadline from now, 0 if none
+ */
+void tw_entry_init(timer_entry_t *te, int total_ms) {
+    te->expire = 0;
+    te->deadline = (total_ms > 0) ? tw_now_ms() + total_ms : 0;
+    te->fds[0] = te->fds[1] = -1;
+    te->linked = 0;
+    te->fired = 0;
+    te->prev = te->next = NULL;
+}
+
+/**
+ * @brief
+ *      arm or re-arm an entry
+ * @note
+ *      Re-arming on every read is cheap: if the new expire tick is 
+ *      the same as the current one nothing is done. An entry fired
+ *      already will not be armed again
+ * @param
+ *      tw: pointer to timer_wheel_t
+ *      te: entry to arm
+ *      fd0, fd1: fds to shut down on expiry, -1 if unused
+ *      ms: expire after ms, 0 means only the deadline applies
+ */
+void tw_arm(timer_wheel_t *tw, timer_entry_t *te, int fd0, int fd1, int ms) {
+    long long now = tw_now_ms();
+    long long when = (ms > 0) ? now + ms : 0;
+    long long expire;
+
+    if (te->deadline && (!when || te->deadline < when)) {
+        when = te->deadline;
+    }
+    if (!when) {            // nothing to enforce
+        tw_disarm(tw, te);
+        return;
+    }
+    // round up, it never fires early
+    expire = (when - tw->base_ms + TW_TICK_MS - 1) / TW_TICK_MS;
+
+    if (te->linked && te->expire == expire && 
+        te->fds[0] == fd0 && te->fds[1] == fd1) {
+        return;  // nothing changed, a racy read is fine here
+    }
+
+    P(&tw->mutex);
+    if (!te->fired) {
+        unlink_entry(tw, te);
+        te->fds[0] = fd0;
+        te->fds[1] = fd1;
+        // due already, fire on next tick
+        te->expire = (expire <= tw->now) ? tw->now + 1 : expire;
+        link_entry(tw, te);
+    }
+    V(&tw->mutex);
+}
+
+/**
+ * @brief
+ *      disarm an entry, after return its fds will not be touched
+ * @param
+ *      tw: pointer to timer_wheel_t
+ *      te: entry to disarm
+ */
+void tw_disarm(timer_wheel_t *tw, timer_entry_t *te) {
+    P(&tw->mutex);
+    unlink_entry(tw, te);
+    V(&tw->mutex);
+}
@@ -0,0 +1,35 @@
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include "csapp.h"
+
+#define TW_SLOTS   512     /// number of slots of the wheel
+#define TW_TICK_MS 100     /// resolution of the wheel
+
+/** one timer, it shuts down its fds on expiry */
+typedef struct timer_entry {
+    long long expire;      /// absolute tick to expire
+    long long deadline;    /// absolute deadline in ms, 0 if none
+    int fds[2];            /// fds to shut down on expiry, -1 if unused
+    int linked;            /// 1 if it's in the wheel
+    volatile int fired;    /// set to 1 once expired
+    struct timer_entry *prev;
+    struct timer_entry *next;
+} timer_entry_t;
+
+/** hashed timer wheel, driven by its own thread */
+typedef struct {
+    timer_entry_t *slots[TW_SLOTS];
+    volatile long long now;   /// current tick
+    long long base_ms;        /// time of tick 0
+    sem_t mutex;              /// protects slots and entries
+} timer_wheel_t;
+
+void tw_init(timer_wheel_t *tw);
+long long tw_now_ms(void);
+void tw_entry_init(timer_entry_t *te, int total_ms);
+/* (re)arm te to expire after ms, capped by its deadline */
+void tw_arm(timer_wheel_t *tw, timer_entry_t *te, int fd0, int fd1, int ms);
+void tw_disarm(timer_wheel_t *tw, timer_entry_t *te);
+
+#endif /* __TIMER_H__ */
@@ -0,0 +1,228 @@
+#include "csapp.h"
+#include "trace.h"
+
+/**
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * @note
+ *      Binary trace of requests, to tune cache offline with replay.c.
+ *      1. each thread recording requests owns a ring of bytes, a
+ *         record is copied in as it will be in file, there's no lock
+ *         as the thread is the only writer of head
+ *      2. a background thread drains every ring to file every
+ *         TRACE_FLUSH_MS, it's the only writer of tails
+ *      3. a record is dropped if the ring of its thread is full, so
+ *         serving never waits for disk
+ *      4. records of different threads are interleaved by chunks,
+ *         a reader sorts them by ts_us if order matters
+ *      5. ring of an exited thread is freed once it's drained
+ **/
+
+/** ring of one thread */
+typedef struct trace_ring {
+    char buf[TRACE_RING_SIZE];
+    unsigned long head;          /// bytes put, by owner thread
+    unsigned long tail;          /// bytes written, by writer thread
+    int dead;                    /// 1 if owner thread exited
+    struct trace_ring *next;
+} trace_ring_t;
+
+/** Shared global variable */
+unsigned int trace_rec_cnt;
+unsigned int trace_drop_cnt;
+
+/** Static global variable */
+static FILE *trace_fp;                 /// NULL if trace is off
+static trace_ring_t *rings;            /// rings of all threads
+static sem_t rings_mutex;              /// protects rings and tails
+static pthread_key_t ring_key;         /// to know when a thread exits
+static __thread trace_ring_t *my_ring; /// ring of calling thread
+
+/** Static helper function */
+
+/**
+ * @brief
+ *      copy bytes into ring at position pos, wrapping around
+ */
+static void ring_put(trace_ring_t *r, unsigned long pos,
+                     const void *src, int len) {
+    int off = pos % TRACE_RING_SIZE;
+    int first = TRACE_RING_SIZE - off;
+
+    if (first > len) {
+        first = len;
+    }
+    memcpy(r->buf + off, src, first);
+    memcpy(r->buf, (const char *)src + first, len - first);
+}
+
+/**
+ * @brief
+ *      called when a thread with a ring exits
+ */
+static void ring_exit(void *vargp) {
+    trace_ring_t *r = vargp;
+    __atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief
+ *      write what's in all rings to file, free rings of exited
+ *      threads once they're empty
+ */
+static void drain_rings(void) {
+    trace_ring_t **pp, *r;
+    unsigned long head;
+    int off, len, dead;
+
+    P(&rings_mutex);
+    for (pp = &rings; NULL != (r = *pp); ) {
+        // read dead first, so a dead ring has nothing after head
+        dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        while (r->tail != head) {
+            off = r->tail % TRACE_RING_SIZE;
+            len = TRACE_RING_SIZE - off;
+            if (len > head - r->tail) {
+                len = head - r->tail;
+            }
+            if (fwrite(r->buf + off, 1, len, trace_fp) != len) {
+                break;   // disk is full, keep it in ring
+            }
+            __atomic_store_n(&r->tail, r->tail + len, __ATOMIC_RELEASE);
+        }
+        if (dead && r->tail == head) {
+            *pp = r->next;
+            Free(r);
+        } else {
+            pp = &r->next;
+        }
+    }
+    fflush(trace_fp);
+    V(&rings_mutex);
+}
+
+/**
+ * @brief
+ *      writer thread, drain rings periodically
+ */
+static void *trace_thread(void *vargp) {
+    Pthread_detach(pthread_self());
+    while (1) {
+        usleep(TRACE_FLUSH_MS * 1000);
+        drain_rings();
+    }
+    return NULL;
+}
+
+/** public function for other program to call */
+
+/**
+ * @brief
+ *      open trace file and start writer thread. What's in rings is
+ *      also written at exit
+ * @param
+ *      path: trace file, it's truncated
+ * @ret
+ *      0 if OK, -1 if file can't be opened
+ */
+int trace_open(const char *path) {
+    pthread_t tid;
+
+    if (NULL == (trace_fp = fopen(path, "w"))) {
+        return -1;
+    }
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), trace_fp);
+    Sem_init(&rings_mutex, 0, 1);
+    pthread_key_create(&ring_key, ring_exit);
+    atexit(drain_rings);
+    Pthread_create(&tid, NULL, trace_thread, NULL);
+    return 0;
+}
+
+/**
+ * @brief
+ *      record one request, ring of calling thread is created at its
+ *      first record
+ * @param
+ *      rec: the record, tag_len is set here
+ *      tag: tag of request, truncated to MAXLINE
+ */
+void trace_record(trace_rec_t *rec, const char *tag) {
+    trace_ring_t *r = my_ring;
+    unsigned long head, tail;
+    int len;
+
+    if (NULL == trace_fp) {
+        return;
+    }
+    if (NULL == r) {
+        r = my_ring = Malloc(sizeof(trace_ring_t));
+        r->head = r->tail = 0;
+        r->dead = 0;
+        pthread_setspecific(ring_key, r);
+        P(&rings_mutex);
+        r->next = rings;
+        rings = r;
+        V(&rings_mutex);
+    }
+
+    rec->tag_len = strnlen(tag, MAXLINE - 1);
+    len = sizeof(trace_rec_t) + rec->tag_len;
+    head = r->head;
+    tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (TRACE_RING_SIZE - (head - tail) < len) {
+        __sync_fetch_and_add(&trace_drop_cnt, 1);
+        return;
+    }
+    ring_put(r, head, rec, sizeof(trace_rec_t));
+    ring_put(r, head + sizeof(trace_rec_t), tag, rec->tag_len);
+    __atomic_store_n(&r->head, head + len, __ATOMIC_RELEASE);
+    __sync_fetch_and_add(&trace_rec_cnt, 1);
+}
+
+/**
+ * @brief
+ *      current unix time in us
+ */
+long long trace_now_us(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/**
+ * @brief
+ *      check magic of a trace file
+ * @ret
+ *      0 if OK, -1 if it's not a trace file
+ */
+int trace_read_header(FILE *fp) {
+    char magic[sizeof(TRACE_MAGIC)];
+
+    if (fread(magic, 1, strlen(TRACE_MAGIC), fp) != strlen(TRACE_MAGIC) ||
+        memcmp(magic, TRACE_MAGIC, strlen(TRACE_MAGIC))) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *      read next record of a trace file
+ * @param
+ *      fp: trace file, after its header
+ *      rec: the record is stored here
+ *      tag: tag is stored here with '\0', MAXLINE at least
+ * @ret
+ *      1 if OK, 0 on end of file or a truncated record
+ */
+int trace_read(FILE *fp, trace_rec_t *rec, char *tag) {
+    if (fread(rec, sizeof(trace_rec_t), 1, fp) != 1 ||
+        rec->tag_len >= MAXLINE ||
+        fread(tag, 1, rec->tag_len, fp) != rec->tag_len) {
+        return 0;
+    }
+    tag[rec->tag_len] = '\0';
+    return 1;
+}
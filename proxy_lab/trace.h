@@ -0,0 +1,41 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "csapp.h"
+#include <stdint.h>
+
+#define TRACE_MAGIC     "PXTRACE1"     /// first 8 bytes of a trace file
+#define TRACE_RING_SIZE (64 * 1024)    /// bytes of ring per thread
+#define TRACE_FLUSH_MS  100            /// rings are drained this often
+
+/**
+ * one request in trace file, the tag follows without '\0'.
+ * Fields are in host byte order
+ */
+typedef struct {
+    uint64_t ts_us;        /// when request is accepted, unix time in us
+    uint32_t latency_us;   /// from accepted to finished
+    uint32_t size;         /// bytes of response, may exceed cache limit
+    uint16_t status;       /// status of response, 0 if there's none
+    uint8_t hit;           /// 1 if served from cache
+    uint8_t reserved;
+    uint16_t tag_len;      /// bytes of tag following
+    uint16_t reserved2;
+} trace_rec_t;
+
+extern unsigned int trace_rec_cnt;    /// records written to file
+extern unsigned int trace_drop_cnt;   /// records dropped as ring is full
+
+/* return 0 if OK, -1 if file can't be opened */
+int trace_open(const char *path);
+/* record one request of calling thread, no-op if trace is not open */
+void trace_record(trace_rec_t *rec, const char *tag);
+/* current unix time in us */
+long long trace_now_us(void);
+
+/* return 0 if fp begins with TRACE_MAGIC, -1 otherwise */
+int trace_read_header(FILE *fp);
+/* read a record and its tag (MAXLINE), return 1 if OK, 0 on end */
+int trace_read(FILE *fp, trace_rec_t *rec, char *tag);
+
+#endif /* __TRACE_H__ */
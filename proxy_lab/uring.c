@@ -0,0 +1,288 @@
+#include "csapp.h"
+#include "uring.h"
+#include <sys/syscall.h>
+
+/**
+ * @author Wei-Lin Tsai weilints@andrew.cmu.edu
+ *
+ * @note
+ *      A minimal io_uring by raw syscalls, so we don't depend on 
+ *      liburing. Only one thread may use a ring.
+ *      1. sqes are filled by uring_get_sqe/uring_prep_*, and all of 
+ *         them are submitted by one io_uring_enter together with 
+ *         waiting for completions
+ *      2. head/tail shared with kernel are accessed with acquire/
+ *         release atomics
+ **/
+
+/** Static helper function */
+
+/**
+ * @brief
+ *      wrapper of io_uring_enter
+ */
+static int uring_enter(uring_t *ur, unsigned to_submit, unsigned wait_nr) {
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+
+    ur->enter_cnt++;
+    return syscall(__NR_io_uring_enter, ur->fd, to_submit, wait_nr, 
+                   flags, NULL, 0);
+}
+
+/**
+ * @brief
+ *      fill common fields of a sqe
+ */
+static void prep_rw(struct io_uring_sqe *sqe, int op, int fd, 
+                    const void *addr, unsigned len, unsigned long long off,
+                    unsigned long long data) {
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = data;
+}
+
+/** public function for other program to call */
+
+/**
+ * @brief
+ *      set up a ring and map its queues
+ * @param
+ *      ur: pointer to uring_t
+ *      entries: size of submission queue, power of 2
+ * @ret
+ *      0 if OK, -1 if error with errno set
+ */
+int uring_init(uring_t *ur, unsigned entries) {
+    struct io_uring_params p;
+    int fd;
+
+    memset(ur, 0, sizeof(*ur));
+    memset(&p, 0, sizeof(p));
+    if ((fd = syscall(__NR_io_uring_setup, entries, &p)) < 0) {
+        return -1;
+    }
+    ur->fd = fd;
+
+    ur->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ur->cq_ring_sz = p.cq_off.cqes + 
+                     p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ur->cq_ring_sz > ur->sq_ring_sz) {
+            ur->sq_ring_sz = ur->cq_ring_sz;
+        }
+        ur->cq_ring_sz = ur->sq_ring_sz;
+    }
+
+    ur->sq_ring = mmap(NULL, ur->sq_ring_sz, PROT_READ | PROT_WRITE, 
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ur->sq_ring == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ur->cq_ring = ur->sq_ring;
+    } else {
+        ur->cq_ring = mmap(NULL, ur->cq_ring_sz, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ur->cq_ring == MAP_FAILED) {
+            munmap(ur->sq_ring, ur->sq_ring_sz);
+            close(fd);
+            return -1;
+        }
+    }
+    ur->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    ur->sqes = mmap(NULL, ur->sqes_sz, PROT_READ | PROT_WRITE, 
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ur->sqes == MAP_FAILED) {
+        if (ur->cq_ring != ur->sq_ring) {
+            munmap(ur->cq_ring, ur->cq_ring_sz);
+        }
+        munmap(ur->sq_ring, ur->sq_ring_sz);
+        close(fd);
+        return -1;
+    }
+
+    ur->sq_head = (unsigned *)((char *)ur->sq_ring + p.sq_off.head);
+    ur->sq_tail = (unsigned *)((char *)ur->sq_ring + p.sq_off.tail);
+    ur->sq_mask = (unsigned *)((char *)ur->sq_ring + p.sq_off.ring_mask);
+    ur->sq_array = (unsigned *)((char *)ur->sq_ring + p.sq_off.array);
+    ur->cq_head = (unsigned *)((char *)ur->cq_ring + p.cq_off.head);
+    ur->cq_tail = (unsigned *)((char *)ur->cq_ring + p.cq_off.tail);
+    ur->cq_mask = (unsigned *)((char *)ur->cq_ring + p.cq_off.ring_mask);
+    ur->cqes = (struct io_uring_cqe *)((char *)ur->cq_ring + p.cq_off.cqes);
+    return 0;
+}
+
+/**
+ * @brief
+ *      unmap queues and close the ring
+ * @param
+ *      ur: pointer to uring_t
+ */
+void uring_deinit(uring_t *ur) {
+    munmap(ur->sqes, ur->sqes_sz);
+    if (ur->cq_ring != ur->sq_ring) {
+        munmap(ur->cq_ring, ur->cq_ring_sz);
+    }
+    munmap(ur->sq_ring, ur->sq_ring_sz);
+    close(ur->fd);
+}
+
+/**
+ * @brief
+ *      register buffers, so the kernel doesn't map them on every 
+ *      READ_FIXED/WRITE_FIXED
+ * @param
+ *      ur: pointer to uring_t
+ *      iov/n: the buffers, buf_index of a sqe is index in iov
+ * @ret
+ *      0 if OK, -1 if error
+ */
+int uring_register_buffers(uring_t *ur, struct iovec *iov, unsigned n) {
+    return syscall(__NR_io_uring_register, ur->fd, 
+                   IORING_REGISTER_BUFFERS, iov, n) < 0 ? -1 : 0;
+}
+
+/**
+ * @brief
+ *      get a free sqe, it's published at once and submitted by next 
+ *      uring_submit_and_wait
+ * @param
+ *      ur: pointer to uring_t
+ * @ret
+ *      a cleared sqe, NULL if sq is full even after submitting
+ */
+struct io_uring_sqe *uring_get_sqe(uring_t *ur) {
+    unsigned head, tail, idx;
+    struct io_uring_sqe *sqe;
+
+    head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+    tail = *ur->sq_tail;
+    if (tail - head > *ur->sq_mask) {  // full, let kernel take some
+        if (uring_enter(ur, ur->to_submit, 0) > 0) {
+            ur->to_submit = 0;
+        }
+        head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head > *ur->sq_mask) {
+            return NULL;
+        }
+    }
+
+    idx = tail & *ur->sq_mask;
+    sqe = &ur->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ur->sq_array[idx] = idx;
+    __atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ur->to_submit++;
+    return sqe;
+}
+
+/**
+ * @brief
+ *      submit all pending sqes and wait for completions by one 
+ *      syscall
+ * @param
+ *      ur: pointer to uring_t
+ *      wait_nr: number of completions to wait for
+ * @ret
+ *      0 if OK, -1 if error or interrupted by a signal
+ */
+int uring_submit_and_wait(uring_t *ur, unsigned wait_nr) {
+    int rc;
+
+    if (!wait_nr && !ur->to_submit) {
+        return 0;
+    }
+    // completions already there, don't wait
+    if (wait_nr && NULL != uring_peek_cqe(ur) && !ur->to_submit) {
+        return 0;
+    }
+    if ((rc = uring_enter(ur, ur->to_submit, wait_nr)) < 0) {
+        return -1;
+    }
+    ur->to_submit -= (rc < ur->to_submit) ? rc : ur->to_submit;
+    return 0;
+}
+
+/**
+ * @brief
+ *      peek next completion without consuming it
+ * @param
+ *      ur: pointer to uring_t
+ * @ret
+ *      the cqe, NULL if none
+ */
+struct io_uring_cqe *uring_peek_cqe(uring_t *ur) {
+    unsigned head = *ur->cq_head;
+
+    if (head == __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ur->cqes[head & *ur->cq_mask];
+}
+
+/**
+ * @brief
+ *      consume the completion got by uring_peek_cqe
+ * @param
+ *      ur: pointer to uring_t
+ */
+void uring_cqe_seen(uring_t *ur) {
+    __atomic_store_n(ur->cq_head, *ur->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief
+ *      prepare an accept of a listening fd
+ * @param
+ *      addr/addrlen: address of peer will be stored here, they must
+ *                    be valid until completion
+ */
+void uring_prep_accept(struct io_uring_sqe *sqe, int fd, 
+                       struct sockaddr *addr, socklen_t *addrlen,
+                       unsigned long long data) {
+    prep_rw(sqe, IORING_OP_ACCEPT, fd, addr, 0, 
+            (unsigned long)addrlen, data);
+}
+
+/**
+ * @brief
+ *      prepare a read or write on a registered buffer
+ * @param
+ *      sqe: from uring_get_sqe
+ *      op: IORING_OP_READ_FIXED or IORING_OP_WRITE_FIXED
+ *      fd: the socket
+ *      buf/len: a range inside registered buffer buf_index
+ *      data: user_data to be returned in cqe
+ */
+void uring_prep_rw_fixed(struct io_uring_sqe *sqe, int op, int fd, 
+                         char *buf, unsigned len, int buf_index, 
+                         unsigned long long data) {
+    prep_rw(sqe, op, fd, buf, len, 0, data);
+    sqe->buf_index = buf_index;
+}
+
+/**
+ * @brief
+ *      prepare a close
+ */
+void uring_prep_close(struct io_uring_sqe *sqe, int fd, 
+                      unsigned long long data) {
+    prep_rw(sqe, IORING_OP_CLOSE, fd, NULL, 0, 0, data);
+}
+
+/**
+ * @brief
+ *      prepare a cancel of a pending op, which completes with 
+ *      -ECANCELED
+ * @param
+ *      target: user_data of the op to cancel
+ */
+void uring_prep_cancel(struct io_uring_sqe *sqe, unsigned long long target,
+                       unsigned long long data) {
+    prep_rw(sqe, IORING_OP_ASYNC_CANCEL, -1, (void *)(unsigned long)target, 
+            0, 0, data);
+}
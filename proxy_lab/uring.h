@@ -0,0 +1,56 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include "csapp.h"
+#include <linux/io_uring.h>
+
+/** a minimal io_uring, set up by raw syscalls */
+typedef struct {
+    int fd;                         /// fd of the ring
+    /** submission queue */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned to_submit;             /// sqes filled but not submitted
+    /** completion queue */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    /** mappings, for deinit */
+    void *sq_ring;
+    size_t sq_ring_sz;
+    void *cq_ring;
+    size_t cq_ring_sz;
+    size_t sqes_sz;
+    unsigned long enter_cnt;        /// number of io_uring_enter calls
+} uring_t;
+
+/* return 0 if OK, -1 if io_uring is not available */
+int uring_init(uring_t *ur, unsigned entries);
+void uring_deinit(uring_t *ur);
+/* register buffers for READ_FIXED/WRITE_FIXED, return 0 if OK */
+int uring_register_buffers(uring_t *ur, struct iovec *iov, unsigned n);
+
+/* return a cleared sqe, submit pending ones first if sq is full */
+struct io_uring_sqe *uring_get_sqe(uring_t *ur);
+/* submit pending sqes and wait for wait_nr completions, 0 if OK */
+int uring_submit_and_wait(uring_t *ur, unsigned wait_nr);
+/* return next completion, NULL if none */
+struct io_uring_cqe *uring_peek_cqe(uring_t *ur);
+void uring_cqe_seen(uring_t *ur);
+
+void uring_prep_accept(struct io_uring_sqe *sqe, int fd, 
+                       struct sockaddr *addr, socklen_t *addrlen,
+                       unsigned long long data);
+void uring_prep_rw_fixed(struct io_uring_sqe *sqe, int op, int fd, 
+                         char *buf, unsigned len, int buf_index, 
+                         unsigned long long data);
+void uring_prep_close(struct io_uring_sqe *sqe, int fd, 
+                      unsigned long long data);
+void uring_prep_cancel(struct io_uring_sqe *sqe, unsigned long long target,
+                       unsigned long long data);
+
+#endif /* __URING_H__ */